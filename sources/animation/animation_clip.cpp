@@ -0,0 +1,231 @@
+#include "animation_clip.h"
+#include <algorithm>
+#include <cmath>
+#include <assimp/scene.h>
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <file_watcher.h>
+#include <log.h>
+
+static void destroy_clip(AnimationClip &)
+{
+}
+
+template<>
+ResourcePool<AnimationClip> &resource_pool<AnimationClip>()
+{
+  static ResourcePool<AnimationClip> pool("clips", destroy_clip);
+  return pool;
+}
+
+static AnimationClipHandle add_clip(AnimationClip &&clip, const std::string &key)
+{
+  size_t bytes = clip.samples.size() * sizeof(BoneTransform);
+  return resource_pool<AnimationClip>().add(std::move(clip), bytes, key);
+}
+
+AnimationClipHandle make_animation_clip(const char *name, int bone_count, int frame_count, float sample_rate, std::vector<BoneTransform> &&samples)
+{
+  AnimationClip clip;
+  clip.name = name;
+  clip.sampleRate = sample_rate;
+  clip.frameCount = frame_count;
+  clip.boneCount = bone_count;
+  clip.duration = (frame_count - 1) / sample_rate;
+  clip.samples = std::move(samples);
+  return add_clip(std::move(clip), {});
+}
+
+AnimationClipHandle make_additive_clip(const AnimationClip &clip, const BoneTransform *reference_pose)
+{
+  std::vector<BoneTransform> samples(clip.samples.size());
+  for (int frame = 0; frame < clip.frameCount; frame++)
+  {
+    const BoneTransform *source = clip.frame(frame);
+    BoneTransform *delta = samples.data() + (size_t)frame * clip.boneCount;
+    for (int i = 0; i < clip.boneCount; i++)
+    {
+      const BoneTransform &reference = reference_pose[i];
+      delta[i].translation = source[i].translation - reference.translation;
+      delta[i].rotation = normalize(inverse(reference.rotation) * source[i].rotation);
+      if (delta[i].rotation.w < 0.f)
+        delta[i].rotation = -delta[i].rotation;
+      delta[i].scale = source[i].scale / reference.scale;
+    }
+  }
+  return make_animation_clip((clip.name + "_additive").c_str(), clip.boneCount, clip.frameCount, clip.sampleRate, std::move(samples));
+}
+
+template<typename Key>
+static int find_key(const Key *keys, unsigned count, double time)
+{
+  unsigned first = 0, last = count;
+  while (first + 1 < last)
+  {
+    unsigned middle = (first + last) / 2;
+    if (keys[middle].mTime <= time)
+      first = middle;
+    else
+      last = middle;
+  }
+  return first;
+}
+
+static vec3 sample_keys(const aiVectorKey *keys, unsigned count, double time, vec3 fallback)
+{
+  if (count == 0)
+    return fallback;
+  int i = find_key(keys, count, time);
+  if (i + 1 == (int)count || time <= keys[i].mTime)
+    return to_vec3(keys[i].mValue);
+  float t = (float)((time - keys[i].mTime) / (keys[i + 1].mTime - keys[i].mTime));
+  return mix(to_vec3(keys[i].mValue), to_vec3(keys[i + 1].mValue), t);
+}
+
+static quat sample_keys(const aiQuatKey *keys, unsigned count, double time, quat fallback)
+{
+  if (count == 0)
+    return fallback;
+  int i = find_key(keys, count, time);
+  if (i + 1 == (int)count || time <= keys[i].mTime)
+    return to_quat(keys[i].mValue);
+  float t = (float)((time - keys[i].mTime) / (keys[i + 1].mTime - keys[i].mTime));
+  return slerp(to_quat(keys[i].mValue), to_quat(keys[i + 1].mValue), t);
+}
+
+static AnimationClip create_clip(const aiAnimation *animation, const Skeleton &skeleton, float sample_rate)
+{
+  AnimationClip clip;
+  clip.name = animation->mName.C_Str();
+  double ticksPerSecond = animation->mTicksPerSecond > 0.0 ? animation->mTicksPerSecond : 25.0;
+  clip.duration = (float)(animation->mDuration / ticksPerSecond);
+  clip.frameCount = std::max(1, (int)std::ceil(clip.duration * sample_rate) + 1);
+  // frames are evenly spaced over the whole clip, so the rate is adjusted a bit
+  clip.sampleRate = clip.frameCount > 1 ? (clip.frameCount - 1) / clip.duration : sample_rate;
+  clip.boneCount = skeleton.size();
+  clip.samples.resize((size_t)clip.frameCount * clip.boneCount);
+
+  std::vector<BoneTransform> bindPose(skeleton.size());
+  std::vector<const aiNodeAnim *> channels(skeleton.size(), nullptr);
+  for (int bone = 0; bone < skeleton.size(); bone++)
+    bindPose[bone] = to_bone_transform(skeleton.localBindPose[bone]);
+  for (unsigned i = 0; i < animation->mNumChannels; i++)
+  {
+    int bone = skeleton.find_bone(animation->mChannels[i]->mNodeName.C_Str());
+    if (bone >= 0)
+      channels[bone] = animation->mChannels[i];
+  }
+
+  for (int frame = 0; frame < clip.frameCount; frame++)
+  {
+    double time = (double)frame / clip.sampleRate * ticksPerSecond;
+    BoneTransform *pose = clip.samples.data() + (size_t)frame * clip.boneCount;
+    for (int bone = 0; bone < skeleton.size(); bone++)
+    {
+      const aiNodeAnim *channel = channels[bone];
+      if (!channel)
+      {
+        pose[bone] = bindPose[bone];
+        continue;
+      }
+      pose[bone].translation = sample_keys(channel->mPositionKeys, channel->mNumPositionKeys, time, bindPose[bone].translation);
+      pose[bone].rotation = sample_keys(channel->mRotationKeys, channel->mNumRotationKeys, time, bindPose[bone].rotation);
+      pose[bone].scale = sample_keys(channel->mScalingKeys, channel->mNumScalingKeys, time, bindPose[bone].scale);
+    }
+  }
+  return clip;
+}
+
+std::vector<AnimationClipHandle> load_animation_clips(const char *path, const Skeleton &skeleton, float sample_rate)
+{
+  std::vector<AnimationClipHandle> result;
+  // the first clip of a file decides, a file is always loaded whole
+  std::string key = normalize_path(path) + ":";
+  for (int i = 0; AnimationClipHandle clip = resource_pool<AnimationClip>().find(key + std::to_string(i)); i++)
+    result.push_back(clip);
+  if (!result.empty())
+    return result;
+
+  Assimp::Importer importer;
+  importer.SetPropertyBool(AI_CONFIG_IMPORT_FBX_PRESERVE_PIVOTS, false);
+  importer.SetPropertyFloat(AI_CONFIG_GLOBAL_SCALE_FACTOR_KEY, 1.f);
+  importer.ReadFile(path, aiProcess_GlobalScale);
+
+  const aiScene *scene = importer.GetScene();
+  if (!scene || scene->mNumAnimations == 0)
+  {
+    debug_error("no animations in %s", path);
+    return result;
+  }
+  for (unsigned i = 0; i < scene->mNumAnimations; i++)
+    result.push_back(add_clip(create_clip(scene->mAnimations[i], skeleton, sample_rate), key + std::to_string(i)));
+  return result;
+}
+
+// pair of frames around time and position between them
+static int clip_frame(const AnimationClip &clip, float time, bool loop, float &t)
+{
+  t = 0.f;
+  if (clip.frameCount == 1 || clip.duration <= 0.f)
+    return 0;
+  if (loop)
+  {
+    time = std::fmod(time, clip.duration);
+    if (time < 0.f)
+      time += clip.duration;
+  }
+  float position = std::clamp(time, 0.f, clip.duration) * clip.sampleRate;
+  int frame = std::min((int)position, clip.frameCount - 2);
+  t = position - frame;
+  return frame;
+}
+
+void sample_clip(const AnimationClip &clip, float time, bool loop, BoneTransform *pose)
+{
+  float t;
+  int frame = clip_frame(clip, time, loop, t);
+  if (clip.frameCount == 1)
+    std::copy(clip.frame(0), clip.frame(0) + clip.boneCount, pose);
+  else
+    lerp_pose(pose, clip.frame(frame), clip.frame(frame + 1), t, clip.boneCount);
+}
+
+void sample_clip(const AnimationClip &clip, float time, bool loop, const BoneMask &mask, BoneTransform *pose)
+{
+  float t;
+  int frame = clip_frame(clip, time, loop, t);
+  const BoneTransform *a = clip.frame(frame);
+  const BoneTransform *b = clip.frame(std::min(frame + 1, clip.frameCount - 1));
+  for_each_masked_bone(mask, [&](int i) { lerp_pose(pose + i, a + i, b + i, t, 1); });
+}
+
+static void accumulate_bone(const BoneTransform &a, const BoneTransform &b, float t, float weight, BoneTransform &pose)
+{
+  float rotationWeight = dot(a.rotation, b.rotation) < 0.f ? -t : t;
+  quat rotation = normalize(a.rotation * (1.f - t) + b.rotation * rotationWeight);
+  pose.translation += mix(a.translation, b.translation, t) * weight;
+  pose.rotation = pose.rotation + rotation * (dot(pose.rotation, rotation) < 0.f ? -weight : weight);
+  pose.scale += mix(a.scale, b.scale, t) * weight;
+}
+
+void accumulate_clip(const AnimationClip &clip, float time, bool loop, float weight, BoneTransform *pose)
+{
+  float t;
+  int frame = clip_frame(clip, time, loop, t);
+  const BoneTransform *a = clip.frame(frame);
+  const BoneTransform *b = clip.frame(std::min(frame + 1, clip.frameCount - 1));
+  for (int i = 0; i < clip.boneCount; i++)
+    accumulate_bone(a[i], b[i], t, weight, pose[i]);
+}
+
+void accumulate_clip(const AnimationClip &clip, float time, bool loop, float weight, const BoneMask &mask, BoneTransform *pose)
+{
+  float t;
+  int frame = clip_frame(clip, time, loop, t);
+  const BoneTransform *a = clip.frame(frame);
+  const BoneTransform *b = clip.frame(std::min(frame + 1, clip.frameCount - 1));
+  for_each_masked_bone(mask, [&](int i)
+  {
+    accumulate_bone(a[i], b[i], t, weight, pose[i]);
+  });
+}
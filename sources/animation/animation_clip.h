@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <resource_registry.h>
+#include "bone_mask.h"
+#include "pose.h"
+#include "skeleton.h"
+
+// Clip resampled at a fixed rate for one skeleton, so sampling is two rows lookup and a lerp.
+// Samples are frame major: every frame is a full local pose in skeleton bone order.
+struct AnimationClip
+{
+  std::string name;
+  float duration = 0.f; // seconds, the last frame is at duration
+  float sampleRate = 30.f;
+  int frameCount = 0;
+  int boneCount = 0;
+  std::vector<BoneTransform> samples;
+
+  const BoneTransform *frame(int index) const { return samples.data() + (size_t)index * boneCount; }
+};
+
+using AnimationClipHandle = Handle<AnimationClip>;
+template<> ResourcePool<AnimationClip> &resource_pool<AnimationClip>();
+
+// every animation of the file retargeted by bone names, bones without channel keep the bind pose.
+// Loads of the same file share clips, the caller owns one reference of each.
+std::vector<AnimationClipHandle> load_animation_clips(const char *path, const Skeleton &skeleton, float sample_rate = 30.f);
+// samples has frame_count * bone_count transforms
+AnimationClipHandle make_animation_clip(const char *name, int bone_count, int frame_count, float sample_rate, std::vector<BoneTransform> &&samples);
+// samples relative to the reference pose for additive layers: translation and rotation deltas, scale ratio
+AnimationClipHandle make_additive_clip(const AnimationClip &clip, const BoneTransform *reference_pose);
+
+// looped clips wrap time, others clamp it
+void sample_clip(const AnimationClip &clip, float time, bool loop, BoneTransform *pose);
+void sample_clip(const AnimationClip &clip, float time, bool loop, const BoneMask &mask, BoneTransform *pose);
+// adds weighted sample to pose the same way as blend_pose_add, pose has to be normalized after all samples
+void accumulate_clip(const AnimationClip &clip, float time, bool loop, float weight, BoneTransform *pose);
+// only bones of the mask are read and written
+void accumulate_clip(const AnimationClip &clip, float time, bool loop, float weight, const BoneMask &mask, BoneTransform *pose);
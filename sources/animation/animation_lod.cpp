@@ -0,0 +1,30 @@
+#include "animation_lod.h"
+
+int select_animation_lod(const std::vector<AnimationLodLevel> &levels, float distance)
+{
+  int level = 0;
+  while (level + 1 < (int)levels.size() && distance >= levels[level + 1].distance)
+    level++;
+  return level;
+}
+
+BoneMask make_reduced_bone_mask(const Skeleton &skeleton, const std::vector<std::string> &skipped_patterns)
+{
+  std::vector<std::pair<std::string, float>> roots;
+  for (int i = 0; i < skeleton.size(); i++)
+  {
+    const std::string &name = skeleton.names[i];
+    bool skipped = false;
+    for (const std::string &pattern : skipped_patterns)
+      skipped |= name.find(pattern) != std::string::npos;
+    if (skipped || skeleton.parents[i] < 0)
+      roots.emplace_back(name, skipped ? 0.f : 1.f);
+  }
+  return make_bone_mask(skeleton, roots);
+}
+
+void interpolate_model_pose(mat4 *result, const mat4 *from, const mat4 *to, float t, int count)
+{
+  for (int i = 0; i < count; i++)
+    result[i] = from[i] + (to[i] - from[i]) * t;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "bone_mask.h"
+
+// Distant characters evaluate their pose every updateInterval frames and may skip small bones.
+struct AnimationLodLevel
+{
+  float distance; // the level is used from this camera distance
+  int updateInterval;
+  bool reducedBones;
+  bool simpleShading; // rendered with the LOD1 variant of the character shader
+};
+
+// levels sorted by distance, the first one starts at 0
+int select_animation_lod(const std::vector<AnimationLodLevel> &levels, float distance);
+
+// Characters get phase by index, so every frame evaluates about 1 / interval of a level.
+inline bool animation_update_due(int interval, int character, uint64_t frame)
+{
+  return interval <= 1 || (frame + character) % interval == 0;
+}
+
+// bones whose names contain any of the patterns are dropped together with their subtrees
+BoneMask make_reduced_bone_mask(const Skeleton &skeleton, const std::vector<std::string> &skipped_patterns);
+
+// Componentwise lerp of model space matrices, cheap in-between of two cached palettes.
+// The shear it adds is small when the poses are a few frames apart.
+void interpolate_model_pose(mat4 *result, const mat4 *from, const mat4 *to, float t, int count);
@@ -0,0 +1,447 @@
+#include "blend_tree.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+// weights below it are treated as zero and their subtrees are skipped
+static constexpr float MinWeight = 1e-3f;
+
+BlendTree::~BlendTree()
+{
+  for (const BlendNode &node : nodes)
+    release_resource(node.clip);
+}
+
+int BlendTree::add_parameter(const char *name)
+{
+  int index = find_parameter(name);
+  if (index >= 0)
+    return index;
+  parameters.emplace_back(name);
+  return (int)parameters.size() - 1;
+}
+
+int BlendTree::find_parameter(const char *name) const
+{
+  for (size_t i = 0; i < parameters.size(); i++)
+    if (parameters[i] == name)
+      return (int)i;
+  return -1;
+}
+
+static int add_node(BlendTree &tree, BlendNode &&node)
+{
+  tree.nodes.push_back(std::move(node));
+  tree.root = (int)tree.nodes.size() - 1;
+  return tree.root;
+}
+
+int BlendTree::add_clip(AnimationClipHandle clip, float speed, bool loop)
+{
+  acquire_resource(clip);
+  BlendNode node;
+  node.type = BlendNodeType::Clip;
+  node.clip = clip;
+  node.speed = speed;
+  node.loop = loop;
+  return add_node(*this, std::move(node));
+}
+
+static BlendNode make_parent(BlendTree &tree, BlendNodeType type, const std::vector<int> &child_nodes)
+{
+  if (child_nodes.empty() || child_nodes.size() > BlendTree::MaxChildren)
+    throw std::runtime_error{"blend node needs from 1 to " + std::to_string(BlendTree::MaxChildren) + " children"};
+  BlendNode node;
+  node.type = type;
+  node.firstChild = (int)tree.children.size();
+  node.childCount = (int)child_nodes.size();
+  tree.children.insert(tree.children.end(), child_nodes.begin(), child_nodes.end());
+  tree.childWeightParameters.resize(tree.children.size(), -1);
+  tree.childPositions.resize(tree.children.size(), vec2(0.f));
+  return node;
+}
+
+int BlendTree::add_blend(const std::vector<int> &child_nodes, const std::vector<int> &weight_parameters)
+{
+  BlendNode node = make_parent(*this, BlendNodeType::Blend, child_nodes);
+  for (int i = 0; i < node.childCount && i < (int)weight_parameters.size(); i++)
+    childWeightParameters[node.firstChild + i] = weight_parameters[i];
+  return add_node(*this, std::move(node));
+}
+
+int BlendTree::add_blend_space_1d(int parameter, const std::vector<int> &child_nodes, const std::vector<float> &positions)
+{
+  // samples are kept sorted, evaluation looks for the pair around the parameter
+  std::vector<int> order(child_nodes.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](int a, int b) { return positions[a] < positions[b]; });
+  std::vector<int> sortedNodes;
+  for (int i : order)
+    sortedNodes.push_back(child_nodes[i]);
+
+  BlendNode node = make_parent(*this, BlendNodeType::BlendSpace1D, sortedNodes);
+  node.parameterX = parameter;
+  for (int i = 0; i < node.childCount; i++)
+    childPositions[node.firstChild + i] = vec2(positions[order[i]], 0.f);
+  return add_node(*this, std::move(node));
+}
+
+// Bowyer-Watson, sample counts are small so the quadratic version is enough
+static std::vector<ivec3> delaunay_triangulation(const std::vector<vec2> &points)
+{
+  int n = (int)points.size();
+  if (n < 3)
+    return {};
+  vec2 minPoint = points[0], maxPoint = points[0];
+  for (const vec2 &p : points)
+  {
+    minPoint = min(minPoint, p);
+    maxPoint = max(maxPoint, p);
+  }
+  float size = max(max(maxPoint.x - minPoint.x, maxPoint.y - minPoint.y), 1e-3f) * 20.f;
+  vec2 center = (minPoint + maxPoint) * 0.5f;
+  std::vector<vec2> vertices = points;
+  vertices.push_back(center + vec2(-size, -size));
+  vertices.push_back(center + vec2(size, -size));
+  vertices.push_back(center + vec2(0.f, size));
+
+  struct Triangle
+  {
+    ivec3 v;
+    vec2 circleCenter;
+    float radius2;
+  };
+  auto make_triangle = [&](int a, int b, int c)
+  {
+    vec2 pa = vertices[a], pb = vertices[b], pc = vertices[c];
+    float d = 2.f * (pa.x * (pb.y - pc.y) + pb.x * (pc.y - pa.y) + pc.x * (pa.y - pb.y));
+    Triangle t{ivec3(a, b, c), vec2(0.f), INFINITY};
+    if (std::abs(d) > 1e-12f)
+    {
+      float la = dot(pa, pa), lb = dot(pb, pb), lc = dot(pc, pc);
+      t.circleCenter = vec2(la * (pb.y - pc.y) + lb * (pc.y - pa.y) + lc * (pa.y - pb.y),
+                            la * (pc.x - pb.x) + lb * (pa.x - pc.x) + lc * (pb.x - pa.x)) / d;
+      t.radius2 = dot(pa - t.circleCenter, pa - t.circleCenter);
+    }
+    return t;
+  };
+
+  std::vector<Triangle> triangulation = {make_triangle(n, n + 1, n + 2)};
+  for (int i = 0; i < n; i++)
+  {
+    const vec2 &p = vertices[i];
+    std::vector<ivec2> edges;
+    for (size_t j = 0; j < triangulation.size();)
+    {
+      const Triangle &t = triangulation[j];
+      if (dot(p - t.circleCenter, p - t.circleCenter) <= t.radius2)
+      {
+        for (int k = 0; k < 3; k++)
+          edges.push_back(ivec2(t.v[k], t.v[(k + 1) % 3]));
+        triangulation[j] = triangulation.back();
+        triangulation.pop_back();
+      }
+      else
+        j++;
+    }
+    // edges shared by two removed triangles are inside the hole
+    for (size_t a = 0; a < edges.size(); a++)
+    {
+      bool shared = false;
+      for (size_t b = 0; b < edges.size(); b++)
+        shared |= a != b && ((edges[a].x == edges[b].y && edges[a].y == edges[b].x) || edges[a] == edges[b]);
+      if (!shared)
+        triangulation.push_back(make_triangle(edges[a].x, edges[a].y, i));
+    }
+  }
+
+  std::vector<ivec3> result;
+  for (const Triangle &t : triangulation)
+  {
+    if (t.v.x >= n || t.v.y >= n || t.v.z >= n)
+      continue;
+    vec2 ab = points[t.v.y] - points[t.v.x], ac = points[t.v.z] - points[t.v.x];
+    if (std::abs(ab.x * ac.y - ab.y * ac.x) > 1e-6f)
+      result.push_back(t.v);
+  }
+  return result;
+}
+
+int BlendTree::add_blend_space_2d(int parameter_x, int parameter_y, const std::vector<int> &child_nodes, const std::vector<vec2> &positions)
+{
+  BlendNode node = make_parent(*this, BlendNodeType::BlendSpace2D, child_nodes);
+  node.parameterX = parameter_x;
+  node.parameterY = parameter_y;
+  for (int i = 0; i < node.childCount; i++)
+    childPositions[node.firstChild + i] = positions[i];
+  std::vector<ivec3> nodeTriangles = delaunay_triangulation(positions);
+  node.firstTriangle = (int)triangles.size();
+  node.triangleCount = (int)nodeTriangles.size();
+  triangles.insert(triangles.end(), nodeTriangles.begin(), nodeTriangles.end());
+  return add_node(*this, std::move(node));
+}
+
+static float parameter_value(const float *parameters, int index)
+{
+  return index >= 0 ? parameters[index] : 0.f;
+}
+
+// squared distance to segment ab, t is position of the closest point along it
+static float closest_on_segment(vec2 p, vec2 a, vec2 b, float &t)
+{
+  vec2 ab = b - a;
+  float length2 = dot(ab, ab);
+  t = length2 > 0.f ? clamp(dot(p - a, ab) / length2, 0.f, 1.f) : 0.f;
+  vec2 d = a + ab * t - p;
+  return dot(d, d);
+}
+
+static void blend_space_2d_weights(const BlendTree &tree, const BlendNode &node, vec2 p, float *weights)
+{
+  const vec2 *positions = tree.childPositions.data() + node.firstChild;
+  std::fill(weights, weights + node.childCount, 0.f);
+  for (int i = 0; i < node.triangleCount; i++)
+  {
+    ivec3 t = tree.triangles[node.firstTriangle + i];
+    vec2 a = positions[t.x], b = positions[t.y], c = positions[t.z];
+    vec2 v0 = b - a, v1 = c - a, v2 = p - a;
+    float d = v0.x * v1.y - v1.x * v0.y;
+    float wb = (v2.x * v1.y - v1.x * v2.y) / d;
+    float wc = (v0.x * v2.y - v2.x * v0.y) / d;
+    float wa = 1.f - wb - wc;
+    const float eps = -1e-5f;
+    if (wa >= eps && wb >= eps && wc >= eps)
+    {
+      weights[t.x] = max(wa, 0.f);
+      weights[t.y] = max(wb, 0.f);
+      weights[t.z] = max(wc, 0.f);
+      return;
+    }
+  }
+  // outside of the hull (or no triangles for collinear samples) the closest point of an edge is used
+  float bestDistance = INFINITY, bestT = 0.f;
+  int bestA = 0, bestB = 0;
+  auto test_edge = [&](int a, int b)
+  {
+    float t;
+    float distance = closest_on_segment(p, positions[a], positions[b], t);
+    if (distance < bestDistance)
+    {
+      bestDistance = distance;
+      bestT = t;
+      bestA = a;
+      bestB = b;
+    }
+  };
+  if (node.triangleCount > 0)
+  {
+    for (int i = 0; i < node.triangleCount; i++)
+    {
+      ivec3 t = tree.triangles[node.firstTriangle + i];
+      test_edge(t.x, t.y);
+      test_edge(t.y, t.z);
+      test_edge(t.z, t.x);
+    }
+  }
+  else
+  {
+    for (int a = 0; a < node.childCount; a++)
+      for (int b = a; b < node.childCount; b++)
+        test_edge(a, b);
+  }
+  weights[bestA] += 1.f - bestT;
+  weights[bestB] += bestT;
+}
+
+int BlendTree::child_weights(int node_index, const float *parameters, float *weights) const
+{
+  const BlendNode &node = nodes[node_index];
+  switch (node.type)
+  {
+  case BlendNodeType::Clip:
+    return 0;
+  case BlendNodeType::Blend:
+  {
+    float sum = 0.f;
+    for (int i = 0; i < node.childCount; i++)
+    {
+      weights[i] = max(parameter_value(parameters, childWeightParameters[node.firstChild + i]), 0.f);
+      sum += weights[i];
+    }
+    for (int i = 0; i < node.childCount; i++)
+      weights[i] = sum > 0.f ? weights[i] / sum : (i == 0 ? 1.f : 0.f);
+    break;
+  }
+  case BlendNodeType::BlendSpace1D:
+  {
+    const vec2 *positions = childPositions.data() + node.firstChild;
+    float x = clamp(parameter_value(parameters, node.parameterX), positions[0].x, positions[node.childCount - 1].x);
+    std::fill(weights, weights + node.childCount, 0.f);
+    int i = 0;
+    while (i + 2 < node.childCount && positions[i + 1].x < x)
+      i++;
+    if (node.childCount == 1)
+      weights[0] = 1.f;
+    else
+    {
+      float range = positions[i + 1].x - positions[i].x;
+      float t = range > 0.f ? (x - positions[i].x) / range : 0.f;
+      weights[i] = 1.f - t;
+      weights[i + 1] = t;
+    }
+    break;
+  }
+  case BlendNodeType::BlendSpace2D:
+    blend_space_2d_weights(*this, node, vec2(parameter_value(parameters, node.parameterX), parameter_value(parameters, node.parameterY)), weights);
+    break;
+  }
+  return node.childCount;
+}
+
+float BlendTree::node_duration(int node_index, const float *parameters) const
+{
+  const BlendNode &node = nodes[node_index];
+  if (node.type == BlendNodeType::Clip)
+  {
+    const AnimationClip *clip = get_resource(node.clip);
+    return clip && node.speed > 0.f ? clip->duration / node.speed : 0.f;
+  }
+  float weights[MaxChildren];
+  child_weights(node_index, parameters, weights);
+  float duration = 0.f;
+  for (int i = 0; i < node.childCount; i++)
+    if (weights[i] >= MinWeight)
+      duration += weights[i] * node_duration(children[node.firstChild + i], parameters);
+  return duration;
+}
+
+// blend spaces start a synchronized subtree, its clips play at the same normalized phase
+static float subtree_phase(const BlendTree &tree, int node_index, const float *parameters, float time, float phase)
+{
+  if (phase >= 0.f || tree.nodes[node_index].type == BlendNodeType::Blend)
+    return phase;
+  float duration = tree.node_duration(node_index, parameters);
+  return duration > 0.f ? time / duration - std::floor(time / duration) : phase;
+}
+
+static float clip_time(const BlendNode &node, const AnimationClip &clip, float time, float phase)
+{
+  return phase >= 0.f ? phase * clip.duration : time * node.speed;
+}
+
+// children above MinWeight, weights are normalized over them
+static int contributing_children(const BlendTree &tree, int node_index, const float *parameters, int *children, float *weights, BlendTreeStats &stats)
+{
+  const BlendNode &node = tree.nodes[node_index];
+  float childWeights[BlendTree::MaxChildren];
+  tree.child_weights(node_index, parameters, childWeights);
+  int count = 0;
+  float weightSum = 0.f;
+  for (int i = 0; i < node.childCount; i++)
+    if (childWeights[i] >= MinWeight)
+    {
+      children[count] = tree.children[node.firstChild + i];
+      weights[count++] = childWeights[i];
+      weightSum += childWeights[i];
+    }
+    else
+      stats.skippedNodes++;
+  for (int i = 0; i < count; i++)
+    weights[i] /= weightSum;
+  return count;
+}
+
+struct BlendContext
+{
+  const BlendTree &tree;
+  const float *parameters;
+  float time;
+  float phase; // normalized time of synchronized subtree, negative outside of blend spaces
+  PosePool &pool;
+  BlendTreeStats &stats;
+};
+
+static void evaluate_node(BlendContext &context, int node_index, BoneTransform *pose)
+{
+  const BlendTree &tree = context.tree;
+  const BlendNode &node = tree.nodes[node_index];
+  const int boneCount = context.pool.bone_count();
+  if (node.type == BlendNodeType::Clip)
+  {
+    const AnimationClip *clip = get_resource(node.clip);
+    if (!clip)
+    {
+      std::fill(pose, pose + boneCount, BoneTransform());
+      return;
+    }
+    sample_clip(*clip, clip_time(node, *clip, context.time, context.phase), node.loop, pose);
+    context.stats.sampledClips++;
+    return;
+  }
+
+  int children[BlendTree::MaxChildren];
+  float weights[BlendTree::MaxChildren];
+  int count = contributing_children(tree, node_index, context.parameters, children, weights, context.stats);
+  float savedPhase = context.phase;
+  context.phase = subtree_phase(tree, node_index, context.parameters, context.time, context.phase);
+
+  if (count == 1)
+    evaluate_node(context, children[0], pose);
+  else
+  {
+    PooledPose childPose(context.pool);
+    for (int i = 0; i < count; i++)
+    {
+      evaluate_node(context, children[i], childPose.data);
+      if (i == 0)
+        blend_pose_first(pose, childPose.data, weights[i], boneCount);
+      else
+        blend_pose_add(pose, childPose.data, weights[i], boneCount);
+    }
+    normalize_pose(pose, boneCount);
+  }
+  context.phase = savedPhase;
+}
+
+void evaluate_blend_tree(const BlendTree &tree, const float *parameters, float time, PosePool &pool, BoneTransform *pose, BlendTreeStats *stats)
+{
+  BlendTreeStats localStats;
+  BlendContext context{tree, parameters, time, -1.f, pool, stats ? *stats : localStats};
+  if (tree.root >= 0)
+    evaluate_node(context, tree.root, pose);
+  else
+    std::fill(pose, pose + pool.bone_count(), BoneTransform());
+}
+
+static void collect_node(const BlendTree &tree, int node_index, const float *parameters, float time, float phase, float weight, int target,
+  FrameVector<ClipSample> &samples, BlendTreeStats &stats)
+{
+  const BlendNode &node = tree.nodes[node_index];
+  if (node.type == BlendNodeType::Clip)
+  {
+    if (const AnimationClip *clip = get_resource(node.clip))
+    {
+      samples.push_back({node.clip, clip_time(node, *clip, time, phase), weight, node.loop, target});
+      stats.sampledClips++;
+    }
+    return;
+  }
+  int children[BlendTree::MaxChildren];
+  float weights[BlendTree::MaxChildren];
+  int count = contributing_children(tree, node_index, parameters, children, weights, stats);
+  phase = subtree_phase(tree, node_index, parameters, time, phase);
+  for (int i = 0; i < count; i++)
+    if (weight * weights[i] >= MinWeight)
+      collect_node(tree, children[i], parameters, time, phase, weight * weights[i], target, samples, stats);
+    else
+      stats.skippedNodes++;
+}
+
+void collect_clip_samples(const BlendTree &tree, int node, const float *parameters, float time, float weight, int target,
+  FrameVector<ClipSample> &samples, BlendTreeStats *stats)
+{
+  BlendTreeStats localStats;
+  if (node >= 0 && weight >= MinWeight)
+    collect_node(tree, node, parameters, time, -1.f, weight, target, samples, stats ? *stats : localStats);
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <frame_allocator.h>
+#include "animation_clip.h"
+#include "pose.h"
+
+enum class BlendNodeType : uint8_t
+{
+  Clip,
+  Blend, // weights are parameter values normalized by their sum
+  BlendSpace1D,
+  BlendSpace2D // samples are Delaunay triangulated, weights are barycentric
+};
+
+// Nodes refer to children by index, children of one node are a range in BlendTree arrays.
+struct BlendNode
+{
+  BlendNodeType type = BlendNodeType::Clip;
+  AnimationClipHandle clip;
+  float speed = 1.f;
+  bool loop = true;
+  int firstChild = 0;
+  int childCount = 0;
+  int parameterX = -1;
+  int parameterY = -1;
+  int firstTriangle = 0;
+  int triangleCount = 0;
+};
+
+// Tree is immutable while it is evaluated, many characters can evaluate one tree with their own parameters.
+class BlendTree
+{
+public:
+  static constexpr int MaxChildren = 32;
+
+  std::vector<BlendNode> nodes;
+  std::vector<int> children;
+  std::vector<int> childWeightParameters; // Blend
+  std::vector<vec2> childPositions; // blend spaces, 1D uses x
+  std::vector<ivec3> triangles; // indices of children inside the node range
+  std::vector<std::string> parameters;
+  int root = -1;
+
+  BlendTree() = default;
+  BlendTree(const BlendTree &) = delete;
+  BlendTree &operator=(const BlendTree &) = delete;
+  // releases clip references
+  ~BlendTree();
+
+  int add_parameter(const char *name);
+  int find_parameter(const char *name) const;
+  // every add returns node index, the last added node becomes the root
+  int add_clip(AnimationClipHandle clip, float speed = 1.f, bool loop = true);
+  int add_blend(const std::vector<int> &child_nodes, const std::vector<int> &weight_parameters);
+  int add_blend_space_1d(int parameter, const std::vector<int> &child_nodes, const std::vector<float> &positions);
+  int add_blend_space_2d(int parameter_x, int parameter_y, const std::vector<int> &child_nodes, const std::vector<vec2> &positions);
+
+  // seconds of one cycle, blend spaces average durations of children by weight
+  float node_duration(int node, const float *parameters) const;
+  // weights of node children, returns their count
+  int child_weights(int node, const float *parameters, float *weights) const;
+};
+
+struct BlendTreeStats
+{
+  int sampledClips = 0;
+  int skippedNodes = 0; // children with zero weight, their subtrees are not evaluated
+};
+
+// time is seconds since the tree started, children of blend spaces are synchronized by normalized phase
+void evaluate_blend_tree(const BlendTree &tree, const float *parameters, float time, PosePool &pool, BoneTransform *pose, BlendTreeStats *stats = nullptr);
+
+// one contributing clip of a flattened tree
+struct ClipSample
+{
+  AnimationClipHandle clip;
+  float time;
+  float weight;
+  bool loop;
+  int target; // pose the sample is accumulated into
+};
+
+// Leaves of the subtree with weights multiplied along the path, the same pruning as evaluate_blend_tree.
+// Samples of many trees can be sorted by clip and accumulated with accumulate_clip.
+void collect_clip_samples(const BlendTree &tree, int node, const float *parameters, float time, float weight, int target,
+  FrameVector<ClipSample> &samples, BlendTreeStats *stats = nullptr);
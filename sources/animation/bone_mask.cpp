@@ -0,0 +1,44 @@
+#include "bone_mask.h"
+#include <log.h>
+
+static BoneMask compile_mask(std::vector<float> &&weights)
+{
+  BoneMask mask;
+  mask.boneCount = weights.size();
+  mask.bits.assign((mask.boneCount + 63) / 64, 0);
+  for (int i = 0; i < mask.boneCount; i++)
+    if (weights[i] > 0.f)
+    {
+      mask.bits[i >> 6] |= uint64_t(1) << (i & 63);
+      mask.activeBones++;
+    }
+  mask.weights = std::move(weights);
+  return mask;
+}
+
+BoneMask make_bone_mask(const Skeleton &skeleton, const std::vector<std::pair<std::string, float>> &roots)
+{
+  const int boneCount = skeleton.size();
+  std::vector<float> rootWeights(boneCount, -1.f);
+  for (const auto &[name, weight] : roots)
+  {
+    int bone = skeleton.find_bone(name.c_str());
+    if (bone >= 0)
+      rootWeights[bone] = weight;
+    else
+      debug_error("bone mask root %s not found", name.c_str());
+  }
+  // parents go first, so one pass spreads weights down the hierarchy
+  std::vector<float> weights(boneCount, 0.f);
+  for (int i = 0; i < boneCount; i++)
+  {
+    int parent = skeleton.parents[i];
+    weights[i] = rootWeights[i] >= 0.f ? rootWeights[i] : (parent >= 0 ? weights[parent] : 0.f);
+  }
+  return compile_mask(std::move(weights));
+}
+
+BoneMask make_full_mask(int bone_count)
+{
+  return compile_mask(std::vector<float>(bone_count, 1.f));
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "skeleton.h"
+
+// Per bone weights of a partial layer in skeleton order, bits mark bones with nonzero weight.
+// Loops over masked bones skip whole words, so a layer costs by the bones it touches.
+struct BoneMask
+{
+  std::vector<uint64_t> bits;
+  std::vector<float> weights;
+  int boneCount = 0;
+  int activeBones = 0;
+
+  bool test(int bone) const { return (bits[bone >> 6] >> (bone & 63)) & 1; }
+};
+
+// subtrees of the named roots get their weight, a root inside another subtree overrides it
+BoneMask make_bone_mask(const Skeleton &skeleton, const std::vector<std::pair<std::string, float>> &roots);
+BoneMask make_full_mask(int bone_count);
+
+template<typename F>
+void for_each_masked_bone(const BoneMask &mask, F &&f)
+{
+  for (int word = 0, n = mask.bits.size(); word < n; word++)
+  {
+    uint64_t bits = mask.bits[word];
+    for (int bit = 0; bits != 0; bit++, bits >>= 1)
+      if (bits & 1)
+        f(word * 64 + bit);
+  }
+}
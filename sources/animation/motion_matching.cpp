@@ -0,0 +1,524 @@
+#include "motion_matching.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <log.h>
+#include <profiler.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MOTION_SSE
+#endif
+
+constexpr int Stride = MotionDatabase::Stride;
+// floats summed between early out checks
+constexpr int BlockSize = 8;
+static_assert(Stride % BlockSize == 0, "rows are made of whole blocks");
+static_assert(MotionFeatureOffsets[MotionFeatureCount] <= Stride, "features don't fit the row");
+
+static int find_bone_containing(const Skeleton &skeleton, const std::string &pattern)
+{
+  for (int i = 0, n = skeleton.size(); i < n; i++)
+    if (skeleton.names[i].find(pattern) != std::string::npos)
+      return i;
+  debug_error("motion matching: no bone named like %s, root is used", pattern.c_str());
+  return 0;
+}
+
+MotionDatabase::MotionDatabase(const Skeleton &skeleton, const MotionFeatureSettings &settings) :
+  skeleton(&skeleton),
+  settings(settings),
+  hipsBone(find_bone_containing(skeleton, settings.hips)),
+  leftFootBone(find_bone_containing(skeleton, settings.leftFoot)),
+  rightFootBone(find_bone_containing(skeleton, settings.rightFoot))
+{
+}
+
+MotionDatabase::~MotionDatabase()
+{
+  for (AnimationClipHandle clip : clips)
+    release_resource(clip);
+}
+
+static vec2 ground_direction(const vec3 &direction)
+{
+  vec2 d = vec2(direction.x, direction.z);
+  float len = length(d);
+  return len > 1e-5f ? d / len : vec2(0.f, 1.f);
+}
+
+void MotionDatabase::add_clip(AnimationClipHandle handle)
+{
+  const AnimationClip &clip = *get_resource(handle);
+  const int boneCount = skeleton->size();
+  if (clip.boneCount != boneCount || clip.frameCount == 0)
+  {
+    debug_error("motion matching: clip %s has %d bones, skeleton has %d, it isn't added", clip.name.c_str(), clip.boneCount, boneCount);
+    return;
+  }
+  acquire_resource(handle);
+  int clipIndex = clips.size();
+  clips.push_back(handle);
+
+  const int n = clip.frameCount;
+  std::vector<mat4> modelPose(boneCount);
+  std::vector<vec3> hips(n), leftFoot(n), rightFoot(n);
+  std::vector<vec2> facing(n);
+  for (int f = 0; f < n; f++)
+  {
+    calculate_model_pose(*skeleton, clip.frame(f), modelPose.data());
+    hips[f] = vec3(modelPose[hipsBone][3]);
+    leftFoot[f] = vec3(modelPose[leftFootBone][3]);
+    rightFoot[f] = vec3(modelPose[rightFootBone][3]);
+    facing[f] = ground_direction(mat3(modelPose[hipsBone]) * settings.hipsForward);
+  }
+
+  int futureFrames[MotionTrajectorySamples];
+  for (int s = 0; s < MotionTrajectorySamples; s++)
+    futureFrames[s] = (int)std::round(settings.trajectoryTimes[s] * clip.sampleRate);
+
+  for (int f = 0; f < n; f++)
+  {
+    // character stands under the hips and faces along them, z is forward
+    const vec3 origin = vec3(hips[f].x, 0.f, hips[f].z);
+    const vec2 d = facing[f];
+    auto to_character = [d](const vec3 &v) { return vec3(d.y * v.x - d.x * v.z, v.y, d.x * v.x + d.y * v.z); };
+    int prev = max(min(f, n - 2), 0), next = min(prev + 1, n - 1);
+    auto velocity = [&](const std::vector<vec3> &p) { return to_character((p[next] - p[prev]) * clip.sampleRate); };
+
+    size_t start = features.size();
+    features.resize(start + Stride, 0.f);
+    float *row = features.data() + start;
+    for (int s = 0; s < MotionTrajectorySamples; s++)
+    {
+      int future = min(f + futureFrames[s], n - 1);
+      vec3 position = to_character(vec3(hips[future].x, 0.f, hips[future].z) - origin);
+      vec3 direction = to_character(vec3(facing[future].x, 0.f, facing[future].y));
+      row[MotionFeatureOffsets[TrajectoryPositionFeature] + s * 2] = position.x;
+      row[MotionFeatureOffsets[TrajectoryPositionFeature] + s * 2 + 1] = position.z;
+      row[MotionFeatureOffsets[TrajectoryDirectionFeature] + s * 2] = direction.x;
+      row[MotionFeatureOffsets[TrajectoryDirectionFeature] + s * 2 + 1] = direction.z;
+    }
+    const vec3 values[] = {
+      to_character(leftFoot[f] - origin), to_character(rightFoot[f] - origin),
+      velocity(leftFoot), velocity(rightFoot), velocity(hips)};
+    memcpy(row + MotionFeatureOffsets[FootPositionFeature], values, sizeof(values));
+    frames.push_back({clipIndex, f});
+  }
+}
+
+void MotionDatabase::build()
+{
+  const int n = size();
+  if (n == 0)
+    return;
+  for (int feature = 0; feature < MotionFeatureCount; feature++)
+  {
+    int first = MotionFeatureOffsets[feature], last = MotionFeatureOffsets[feature + 1];
+    double variance = 0.0;
+    for (int i = first; i < last; i++)
+    {
+      double sum = 0.0, squares = 0.0;
+      for (int r = 0; r < n; r++)
+      {
+        double v = row(r)[i];
+        sum += v;
+        squares += v * v;
+      }
+      mean[i] = sum / n;
+      variance += max(squares / n - (double)mean[i] * mean[i], 0.0);
+    }
+    // one deviation for all floats of a feature keeps its geometry, e.g. xz of a position
+    float deviation = std::sqrt(variance / (last - first));
+    for (int i = first; i < last; i++)
+      scale[i] = settings.weights[feature] / max(deviation, 1e-5f);
+  }
+  for (int r = 0; r < n; r++)
+  {
+    float *values = features.data() + (size_t)r * Stride;
+    for (int i = 0; i < Stride; i++)
+      values[i] = (values[i] - mean[i]) * scale[i];
+  }
+}
+
+void MotionDatabase::normalize(const float *raw, float *normalized, MotionFeature first, MotionFeature last) const
+{
+  for (int i = MotionFeatureOffsets[first]; i < MotionFeatureOffsets[last]; i++)
+    normalized[i] = (raw[i] - mean[i]) * scale[i];
+}
+
+// Squared distance of two rows. With EarlyOut the sum is checked after every block of floats
+// and returned as soon as it reaches limit, trajectory goes first since it rejects most rows.
+template<bool EarlyOut>
+static float row_distance(const float *a, const float *b, float limit)
+{
+#if defined(__AVX__)
+  __m256 sum = _mm256_setzero_ps();
+  for (int i = 0; i < Stride; i += BlockSize)
+  {
+    __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(d, d));
+    if (EarlyOut || i + BlockSize == Stride)
+    {
+      __m128 s = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+      s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+      float partial = _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+      if (partial >= limit || i + BlockSize == Stride)
+        return partial;
+    }
+  }
+  return 0.f;
+#elif defined(MOTION_SSE)
+  __m128 sum = _mm_setzero_ps();
+  for (int i = 0; i < Stride; i += BlockSize)
+  {
+    __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+    sum = _mm_add_ps(sum, _mm_add_ps(_mm_mul_ps(d0, d0), _mm_mul_ps(d1, d1)));
+    if (EarlyOut || i + BlockSize == Stride)
+    {
+      __m128 s = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+      float partial = _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+      if (partial >= limit || i + BlockSize == Stride)
+        return partial;
+    }
+  }
+  return 0.f;
+#else
+  float sum = 0.f;
+  for (int i = 0; i < Stride; i += BlockSize)
+  {
+    for (int j = i; j < i + BlockSize; j++)
+      sum += (a[j] - b[j]) * (a[j] - b[j]);
+    if (EarlyOut && sum >= limit)
+      break;
+  }
+  return sum;
+#endif
+}
+
+// squared distance from the query to the box, same early out as rows
+static float box_distance(const float *box_min, const float *box_max, const float *query, float limit)
+{
+#if defined(__AVX__)
+  __m256 sum = _mm256_setzero_ps(), zero = _mm256_setzero_ps();
+  for (int i = 0; i < Stride; i += BlockSize)
+  {
+    __m256 q = _mm256_loadu_ps(query + i);
+    __m256 d = _mm256_add_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(box_min + i), q), zero),
+      _mm256_max_ps(_mm256_sub_ps(q, _mm256_loadu_ps(box_max + i)), zero));
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(d, d));
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    float partial = _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    if (partial >= limit || i + BlockSize == Stride)
+      return partial;
+  }
+  return 0.f;
+#elif defined(MOTION_SSE)
+  __m128 sum = _mm_setzero_ps(), zero = _mm_setzero_ps();
+  for (int i = 0; i < Stride; i += BlockSize)
+  {
+    __m128 q0 = _mm_loadu_ps(query + i), q1 = _mm_loadu_ps(query + i + 4);
+    __m128 d0 = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(box_min + i), q0), zero), _mm_max_ps(_mm_sub_ps(q0, _mm_loadu_ps(box_max + i)), zero));
+    __m128 d1 = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(box_min + i + 4), q1), zero), _mm_max_ps(_mm_sub_ps(q1, _mm_loadu_ps(box_max + i + 4)), zero));
+    sum = _mm_add_ps(sum, _mm_add_ps(_mm_mul_ps(d0, d0), _mm_mul_ps(d1, d1)));
+    __m128 s = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    float partial = _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    if (partial >= limit || i + BlockSize == Stride)
+      return partial;
+  }
+  return 0.f;
+#else
+  float sum = 0.f;
+  for (int i = 0; i < Stride; i += BlockSize)
+  {
+    for (int j = i; j < i + BlockSize; j++)
+    {
+      float d = max(box_min[j] - query[j], 0.f) + max(query[j] - box_max[j], 0.f);
+      sum += d * d;
+    }
+    if (sum >= limit)
+      break;
+  }
+  return sum;
+#endif
+}
+
+template<bool EarlyOut>
+static MotionMatch search_rows(const float *rows, int count, const float *query, MotionMatch best)
+{
+  for (int r = 0; r < count; r++)
+  {
+    float cost = row_distance<EarlyOut>(rows + (size_t)r * Stride, query, best.cost);
+    if (cost < best.cost)
+      best = {r, cost};
+  }
+  return best;
+}
+
+MotionMatch search_motion_brute_force(const MotionDatabase &database, const float *query, bool early_out, MotionSearchStats *stats)
+{
+  if (stats)
+    stats->rows += database.size();
+  return early_out ?
+    search_rows<true>(database.features.data(), database.size(), query, MotionMatch()) :
+    search_rows<false>(database.features.data(), database.size(), query, MotionMatch());
+}
+
+int MotionKdTree::build_node(const MotionDatabase &database, int *order, int first, int count, int leaf_size)
+{
+  int index = nodes.size();
+  nodes.push_back({first, count});
+  boxMin.resize(boxMin.size() + Stride, FLT_MAX);
+  boxMax.resize(boxMax.size() + Stride, -FLT_MAX);
+  float *lo = boxMin.data() + (size_t)index * Stride, *hi = boxMax.data() + (size_t)index * Stride;
+  for (int r = first; r < first + count; r++)
+  {
+    const float *values = database.row(order[r]);
+    for (int i = 0; i < Stride; i++)
+    {
+      lo[i] = min(lo[i], values[i]);
+      hi[i] = max(hi[i], values[i]);
+    }
+  }
+  if (count <= leaf_size)
+    return index;
+
+  int axis = 0;
+  for (int i = 1; i < Stride; i++)
+    if (hi[i] - lo[i] > hi[axis] - lo[axis])
+      axis = i;
+  int half = count / 2;
+  std::nth_element(order + first, order + first + half, order + first + count,
+    [&database, axis](int a, int b) { return database.row(a)[axis] < database.row(b)[axis]; });
+  int left = build_node(database, order, first, half, leaf_size);
+  int right = build_node(database, order, first + half, count - half, leaf_size);
+  nodes[index].left = left;
+  nodes[index].right = right;
+  return index;
+}
+
+void MotionKdTree::build(const MotionDatabase &database, int leaf_size)
+{
+  nodes.clear();
+  boxMin.clear();
+  boxMax.clear();
+  const int n = database.size();
+  rowIndex.resize(n);
+  std::iota(rowIndex.begin(), rowIndex.end(), 0);
+  if (n > 0)
+    build_node(database, rowIndex.data(), 0, n, max(leaf_size, 1));
+  rows.resize((size_t)n * Stride);
+  for (int r = 0; r < n; r++)
+    memcpy(rows.data() + (size_t)r * Stride, database.row(rowIndex[r]), sizeof(float) * Stride);
+}
+
+MotionMatch MotionKdTree::search(const float *query, MotionSearchStats *stats) const
+{
+  MotionMatch best;
+  if (nodes.empty())
+    return best;
+  struct Entry
+  {
+    int node;
+    float distance;
+  };
+  // nodes split in halves, so the depth stays far below the stack size
+  Entry stack[64];
+  int top = 0;
+  stack[top++] = {0, 0.f};
+  while (top > 0)
+  {
+    Entry entry = stack[--top];
+    if (entry.distance >= best.cost)
+      continue;
+    const Node &node = nodes[entry.node];
+    if (stats)
+      stats->nodes++;
+    if (node.left < 0)
+    {
+      MotionMatch leaf = search_rows<true>(rows.data() + (size_t)node.first * Stride, node.count, query, {-1, best.cost});
+      if (leaf.row >= 0)
+        best = {rowIndex[node.first + leaf.row], leaf.cost};
+      if (stats)
+        stats->rows += node.count;
+      continue;
+    }
+    float distances[2];
+    const int children[2] = {node.left, node.right};
+    for (int i = 0; i < 2; i++)
+      distances[i] = box_distance(boxMin.data() + (size_t)children[i] * Stride, boxMax.data() + (size_t)children[i] * Stride, query, best.cost);
+    // the nearer child is popped first
+    int nearer = distances[1] < distances[0];
+    if (distances[1 - nearer] < best.cost)
+      stack[top++] = {children[1 - nearer], distances[1 - nearer]};
+    if (distances[nearer] < best.cost)
+      stack[top++] = {children[nearer], distances[nearer]};
+  }
+  return best;
+}
+
+void MotionMatcher::update(float dt, const vec2 *desired_positions, const vec2 *desired_directions)
+{
+  const MotionDatabase &db = *database;
+  if (db.size() == 0)
+    return;
+  const float frameDuration = 1.f / get_resource(db.clips[db.frames[row].clip])->sampleRate;
+  bool clipEnd = false;
+  frameTime += dt;
+  while (frameTime >= frameDuration)
+  {
+    if (row + 1 < db.size() && db.frames[row + 1].clip == db.frames[row].clip)
+    {
+      row++;
+      frameTime -= frameDuration;
+    }
+    else
+    {
+      frameTime = 0.f;
+      clipEnd = true;
+    }
+  }
+  searchTime -= dt;
+  if (searchTime > 0.f && !clipEnd)
+    return;
+  searchTime = searchInterval;
+
+  // pose features are taken from the current row, the trajectory from the caller
+  float raw[MotionDatabase::Stride] = {}, query[MotionDatabase::Stride];
+  memcpy(query, db.row(row), sizeof(query));
+  for (int s = 0; s < MotionTrajectorySamples; s++)
+  {
+    raw[MotionFeatureOffsets[TrajectoryPositionFeature] + s * 2] = desired_positions[s].x;
+    raw[MotionFeatureOffsets[TrajectoryPositionFeature] + s * 2 + 1] = desired_positions[s].y;
+    raw[MotionFeatureOffsets[TrajectoryDirectionFeature] + s * 2] = desired_directions[s].x;
+    raw[MotionFeatureOffsets[TrajectoryDirectionFeature] + s * 2 + 1] = desired_directions[s].y;
+  }
+  db.normalize(raw, query, TrajectoryPositionFeature, FootPositionFeature);
+  MotionMatch match = tree ? tree->search(query) : search_motion_brute_force(db, query);
+  searches++;
+  if (match.row < 0 || match.row == row)
+    return;
+  // a few frames ahead in the same clip is what playing on gives anyway
+  const int nearFrames = 3;
+  bool near = db.frames[match.row].clip == db.frames[row].clip && std::abs(match.row - row) <= nearFrames;
+  if (!near || clipEnd)
+  {
+    row = match.row;
+    frameTime = 0.f;
+    jumps++;
+  }
+}
+
+void MotionMatcher::sample(BoneTransform *pose) const
+{
+  const MotionFrame &frame = database->frames[row];
+  const AnimationClip &clip = *get_resource(database->clips[frame.clip]);
+  sample_clip(clip, frame.frame / clip.sampleRate + frameTime, false, pose);
+}
+
+void benchmark_motion_search(const MotionDatabase &database, int max_rows, int query_count)
+{
+  const int sourceRows = database.size();
+  if (sourceRows == 0 || max_rows <= 0)
+    return;
+  const int used = MotionFeatureOffsets[MotionFeatureCount];
+  debug_log("motion search benchmark on synthetic data: noisy copies of %d rows, times are not representative of a real capture", sourceRows);
+  std::mt19937 random(1);
+  std::normal_distribution<float> normal(0.f, 1.f);
+  std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+  for (int rows = min(sourceRows, max_rows);; rows = (int)min((int64_t)rows * 10, (int64_t)max_rows))
+  {
+    // every copy is shifted as a whole, so the data keeps clusters of similar frames like a bigger capture would
+    MotionDatabase copy;
+    copy.features.assign((size_t)rows * Stride, 0.f);
+    copy.frames.resize(rows);
+    float offset[Stride] = {};
+    for (int r = 0; r < rows; r++)
+    {
+      if (r % sourceRows == 0 && r > 0)
+        for (int i = 0; i < used; i++)
+          offset[i] = normal(random) * 0.5f;
+      const float *source = database.row(r % sourceRows);
+      float *values = copy.features.data() + (size_t)r * Stride;
+      for (int i = 0; i < used; i++)
+        values[i] = source[i] + offset[i] + normal(random) * 0.02f;
+      copy.frames[r] = database.frames[r % sourceRows];
+    }
+    double mean[Stride] = {}, deviation[Stride] = {};
+    for (int r = 0; r < rows; r++)
+      for (int i = 0; i < used; i++)
+      {
+        mean[i] += copy.row(r)[i];
+        deviation[i] += (double)copy.row(r)[i] * copy.row(r)[i];
+      }
+    for (int i = 0; i < used; i++)
+    {
+      mean[i] /= rows;
+      deviation[i] = std::sqrt(max(deviation[i] / rows - mean[i] * mean[i], 0.0));
+    }
+
+    // near rows: noisy copies of random rows, the best case for the tree
+    // random: trajectories of random speed and turn rate, every pose float drawn on its own from the spread of its column
+    std::vector<float> nearQueries((size_t)query_count * Stride, 0.f), randomQueries((size_t)query_count * Stride, 0.f);
+    for (int q = 0; q < query_count; q++)
+    {
+      const float *source = copy.row(random() % rows);
+      float *query = nearQueries.data() + (size_t)q * Stride;
+      for (int i = 0; i < used; i++)
+        query[i] = source[i] + normal(random) * 0.2f;
+
+      query = randomQueries.data() + (size_t)q * Stride;
+      float raw[Stride] = {};
+      float speed = (uniform(random) + 1.f) * 2.f, turnRate = uniform(random) * 1.5f;
+      for (int s = 0; s < MotionTrajectorySamples; s++)
+      {
+        float t = database.settings.trajectoryTimes[s], angle = turnRate * t;
+        raw[MotionFeatureOffsets[TrajectoryPositionFeature] + s * 2] = std::sin(angle * 0.5f) * speed * t;
+        raw[MotionFeatureOffsets[TrajectoryPositionFeature] + s * 2 + 1] = std::cos(angle * 0.5f) * speed * t;
+        raw[MotionFeatureOffsets[TrajectoryDirectionFeature] + s * 2] = std::sin(angle);
+        raw[MotionFeatureOffsets[TrajectoryDirectionFeature] + s * 2 + 1] = std::cos(angle);
+      }
+      database.normalize(raw, query, TrajectoryPositionFeature, FootPositionFeature);
+      for (int i = MotionFeatureOffsets[FootPositionFeature]; i < used; i++)
+        query[i] = mean[i] + normal(random) * deviation[i];
+    }
+
+    uint64_t start = profiler_time();
+    MotionKdTree tree;
+    tree.build(copy);
+    float buildMs = (profiler_time() - start) * 1e-6f;
+
+    auto run = [&](const char *name, const std::vector<float> &queries)
+    {
+      std::vector<MotionMatch> results(query_count);
+      float ms[3];
+      MotionSearchStats treeStats;
+      int mismatches = 0;
+      for (int method = 0; method < 3; method++)
+      {
+        start = profiler_time();
+        for (int q = 0; q < query_count; q++)
+        {
+          const float *query = queries.data() + (size_t)q * Stride;
+          MotionMatch match = method == 2 ? tree.search(query, &treeStats) : search_motion_brute_force(copy, query, method == 1);
+          if (method == 0)
+            results[q] = match;
+          else
+            mismatches += std::abs(match.cost - results[q].cost) > 1e-4f * max(results[q].cost, 1.f);
+        }
+        ms[method] = (profiler_time() - start) * 1e-6f / query_count;
+      }
+      debug_log("motion search %d rows, %s queries: brute force %.4f ms, early out %.4f ms, kd tree %.4f ms (%.2f%% rows tested, %.0f ms build), %d mismatches",
+        rows, name, ms[0], ms[1], ms[2], treeStats.rows * 100.0 / ((double)rows * query_count), buildMs, mismatches);
+    };
+    run("near rows", nearQueries);
+    run("random", randomQueries);
+    if (rows == max_rows)
+      break;
+  }
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <cfloat>
+#include <string>
+#include <vector>
+#include "animation_clip.h"
+
+// Features of a database row in storage order, all of them in the character space of the row:
+// ground position and facing of the character in the future, feet positions and velocities, hips velocity.
+enum MotionFeature
+{
+  TrajectoryPositionFeature, // xz for every trajectory sample
+  TrajectoryDirectionFeature, // xz for every trajectory sample
+  FootPositionFeature, // left and right xyz
+  FootVelocityFeature,
+  HipVelocityFeature,
+  MotionFeatureCount
+};
+
+constexpr int MotionTrajectorySamples = 3;
+// first float of every feature, the last entry is the count of used floats
+constexpr int MotionFeatureOffsets[MotionFeatureCount + 1] = {0, 6, 12, 18, 24, 27};
+
+struct MotionFeatureSettings
+{
+  // bones are found by the first name containing the pattern
+  std::string hips = "Hips";
+  std::string leftFoot = "LeftFoot";
+  std::string rightFoot = "RightFoot";
+  vec3 hipsForward = vec3(0.f, 0.f, 1.f); // facing axis in hips bone space, it is projected on the ground
+  float trajectoryTimes[MotionTrajectorySamples] = {0.33f, 0.66f, 1.f}; // seconds ahead
+  float weights[MotionFeatureCount] = {1.f, 1.5f, 0.75f, 1.f, 1.f};
+};
+
+struct MotionFrame
+{
+  int clip;
+  int frame;
+};
+
+struct MotionMatch
+{
+  int row = -1;
+  float cost = FLT_MAX; // squared distance of normalized features
+};
+
+struct MotionSearchStats
+{
+  int64_t rows = 0; // rows whose distance was computed, maybe partially
+  int64_t nodes = 0; // acceleration nodes visited
+};
+
+// Row major matrix of features, one row per frame of every added clip.
+// build normalizes every feature by its mean and standard deviation averaged over its floats and scales it by its weight,
+// so distances of rows are plain squared distances.
+class MotionDatabase
+{
+public:
+  static constexpr int Stride = 32; // floats per row, padded with zeros for 8 wide SIMD
+
+  const Skeleton *skeleton = nullptr;
+  MotionFeatureSettings settings;
+  int hipsBone = 0, leftFootBone = 0, rightFootBone = 0;
+  std::vector<AnimationClipHandle> clips;
+  std::vector<MotionFrame> frames; // source of every row
+  std::vector<float> features; // Stride floats per row
+  float mean[Stride] = {};
+  float scale[Stride] = {}; // zero for padding
+
+  MotionDatabase() = default;
+  MotionDatabase(const Skeleton &skeleton, const MotionFeatureSettings &settings);
+  MotionDatabase(const MotionDatabase &) = delete;
+  MotionDatabase &operator=(const MotionDatabase &) = delete;
+  // releases clip references
+  ~MotionDatabase();
+
+  // appends raw features of every frame, trajectory samples past the end of the clip take its last frame
+  void add_clip(AnimationClipHandle clip);
+  void build();
+
+  int size() const { return (int)frames.size(); }
+  const float *row(int index) const { return features.data() + (size_t)index * Stride; }
+  // floats of [first, last) feature, raw values are given in the same order as they are stored
+  void normalize(const float *raw, float *normalized, MotionFeature first = TrajectoryPositionFeature, MotionFeature last = MotionFeatureCount) const;
+};
+
+// query is normalized and padded to Stride, early out drops rows once a partial distance is worse than the best one
+MotionMatch search_motion_brute_force(const MotionDatabase &database, const float *query, bool early_out = true, MotionSearchStats *stats = nullptr);
+
+// KD tree with bounding boxes over rows of a database, exact search.
+// Nodes split at the median of their widest dimension, the search skips nodes whose box is farther than the best row.
+// Leaves keep their rows contiguously, so the tree holds a reordered copy of the features.
+class MotionKdTree
+{
+  struct Node
+  {
+    int first, count;
+    int left = -1, right = -1; // leaves have no children
+  };
+  std::vector<Node> nodes;
+  std::vector<float> boxMin, boxMax; // Stride floats per node
+  std::vector<float> rows;
+  std::vector<int> rowIndex; // database row of every reordered row
+
+  int build_node(const MotionDatabase &database, int *order, int first, int count, int leaf_size);
+
+public:
+  void build(const MotionDatabase &database, int leaf_size = 16);
+  MotionMatch search(const float *query, MotionSearchStats *stats = nullptr) const;
+  bool empty() const { return nodes.empty(); }
+};
+
+// Plays database frames and jumps to the best match of the current pose and the desired trajectory every searchInterval.
+// Jumps are instant, blending them is left to the caller.
+struct MotionMatcher
+{
+  const MotionDatabase *database = nullptr;
+  const MotionKdTree *tree = nullptr; // brute force search without it
+  float searchInterval = 0.1f;
+  int row = 0;
+  float frameTime = 0.f; // seconds after the frame of the row
+  float searchTime = 0.f;
+  int searches = 0;
+  int jumps = 0;
+
+  // desired trajectory is in the current character space, positions and directions are xz
+  void update(float dt, const vec2 *desired_positions, const vec2 *desired_directions);
+  void sample(BoneTransform *pose) const;
+};
+
+// Query time of every search on synthetic databases made of noisy copies of this one, sizes go up by 10 times to max_rows.
+// Queries near existing rows and random ones are timed separately, results are written to the log.
+void benchmark_motion_search(const MotionDatabase &database, int max_rows, int query_count = 100);
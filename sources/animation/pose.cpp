@@ -0,0 +1,75 @@
+#include "pose.h"
+#include <glm/gtx/matrix_decompose.hpp>
+
+BoneTransform to_bone_transform(const mat4 &matrix)
+{
+  BoneTransform result;
+  vec3 skew;
+  vec4 perspective;
+  glm::decompose(matrix, result.scale, result.rotation, result.translation, skew, perspective);
+  result.rotation = normalize(result.rotation);
+  return result;
+}
+
+mat4 to_mat4(const BoneTransform &transform)
+{
+  mat4 result = mat4_cast(transform.rotation);
+  result[0] *= transform.scale.x;
+  result[1] *= transform.scale.y;
+  result[2] *= transform.scale.z;
+  result[3] = vec4(transform.translation, 1.f);
+  return result;
+}
+
+void to_matrices(const BoneTransform *pose, mat4 *matrices, int count)
+{
+  for (int i = 0; i < count; i++)
+    matrices[i] = to_mat4(pose[i]);
+}
+
+void calculate_model_pose(const Skeleton &skeleton, const BoneTransform *local_pose, mat4 *model_pose)
+{
+  for (int i = 0, n = skeleton.size(); i < n; i++)
+  {
+    int parent = skeleton.parents[i];
+    model_pose[i] = (parent >= 0 ? model_pose[parent] : skeleton.rootTransform) * to_mat4(local_pose[i]);
+  }
+}
+
+void blend_pose_first(BoneTransform *result, const BoneTransform *pose, float weight, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    result[i].translation = pose[i].translation * weight;
+    result[i].rotation = pose[i].rotation * weight;
+    result[i].scale = pose[i].scale * weight;
+  }
+}
+
+void blend_pose_add(BoneTransform *result, const BoneTransform *pose, float weight, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    float rotationWeight = dot(result[i].rotation, pose[i].rotation) < 0.f ? -weight : weight;
+    result[i].translation += pose[i].translation * weight;
+    result[i].rotation = result[i].rotation + pose[i].rotation * rotationWeight;
+    result[i].scale += pose[i].scale * weight;
+  }
+}
+
+void normalize_pose(BoneTransform *pose, int count)
+{
+  for (int i = 0; i < count; i++)
+    pose[i].rotation = normalize(pose[i].rotation);
+}
+
+void lerp_pose(BoneTransform *result, const BoneTransform *a, const BoneTransform *b, float t, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    float rotationWeight = dot(a[i].rotation, b[i].rotation) < 0.f ? -t : t;
+    result[i].translation = mix(a[i].translation, b[i].translation, t);
+    result[i].rotation = normalize(a[i].rotation * (1.f - t) + b[i].rotation * rotationWeight);
+    result[i].scale = mix(a[i].scale, b[i].scale, t);
+  }
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "3dmath.h"
+#include <memory>
+#include <vector>
+#include "skeleton.h"
+
+// Local transform of a bone. Poses are blended in this form and converted to matrices once at the end.
+struct BoneTransform
+{
+  vec3 translation = vec3(0.f);
+  quat rotation = quat(1.f, 0.f, 0.f, 0.f);
+  vec3 scale = vec3(1.f);
+};
+
+BoneTransform to_bone_transform(const mat4 &matrix);
+mat4 to_mat4(const BoneTransform &transform);
+void to_matrices(const BoneTransform *pose, mat4 *matrices, int count);
+void calculate_model_pose(const Skeleton &skeleton, const BoneTransform *local_pose, mat4 *model_pose);
+
+// Weighted sum of poses, weights of one blend should add up to 1.
+// Rotations are summed on the hemisphere of the first pose and normalized by normalize_pose (nlerp).
+void blend_pose_first(BoneTransform *result, const BoneTransform *pose, float weight, int count);
+void blend_pose_add(BoneTransform *result, const BoneTransform *pose, float weight, int count);
+void normalize_pose(BoneTransform *pose, int count);
+void lerp_pose(BoneTransform *result, const BoneTransform *a, const BoneTransform *b, float t, int count);
+
+// Pose buffers for one bone count. Evaluation takes and returns them in stack order,
+// so after the first frames a tree is evaluated without allocations.
+class PosePool
+{
+  int boneCount;
+  std::vector<std::unique_ptr<BoneTransform[]>> buffers;
+  int used = 0;
+
+public:
+  explicit PosePool(int bone_count) : boneCount(bone_count) {}
+  PosePool(const PosePool &) = delete;
+  PosePool &operator=(const PosePool &) = delete;
+
+  BoneTransform *acquire()
+  {
+    if (used == (int)buffers.size())
+      buffers.emplace_back(new BoneTransform[boneCount]);
+    return buffers[used++].get();
+  }
+  // the last acquired buffer
+  void release() { used--; }
+
+  int bone_count() const { return boneCount; }
+  int capacity() const { return (int)buffers.size(); }
+};
+
+struct PooledPose
+{
+  PosePool &pool;
+  BoneTransform *data;
+
+  explicit PooledPose(PosePool &pose_pool) : pool(pose_pool), data(pose_pool.acquire()) {}
+  PooledPose(const PooledPose &) = delete;
+  PooledPose &operator=(const PooledPose &) = delete;
+  ~PooledPose() { pool.release(); }
+};
@@ -0,0 +1,62 @@
+#include "pose_cache.h"
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <frame_allocator.h>
+
+size_t PoseCache::KeyHash::operator()(const Key &key) const
+{
+  uint64_t h = (uint64_t(key.clip) << 32 | uint32_t(key.time)) * 0x9E3779B97F4A7C15ull;
+  return size_t(h ^ (h >> 29) ^ (uintptr_t(key.mask) >> 4));
+}
+
+void PoseCache::begin_frame()
+{
+  // clear keeps buckets, so after warm up lookups don't allocate
+  for (Shard &shard : shards)
+    shard.poses.clear();
+}
+
+const BoneTransform *PoseCache::sample(AnimationClipHandle handle, const AnimationClip &clip, float time, bool loop, const BoneMask *mask)
+{
+  if (loop && clip.duration > 0.f)
+  {
+    time = std::fmod(time, clip.duration);
+    if (time < 0.f)
+      time += clip.duration;
+  }
+  Key key{handle.value, 0, mask};
+  if (timeStep > 0.f)
+  {
+    key.time = (int32_t)std::lround(time / timeStep);
+    time = key.time * timeStep;
+  }
+  else
+    std::memcpy(&key.time, &time, sizeof(time));
+
+  Shard &shard = shards[KeyHash()(key) % ShardCount];
+  std::atomic<const BoneTransform *> *entry;
+  bool inserted;
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.poses.try_emplace(key, nullptr);
+    entry = &it.first->second;
+    inserted = it.second;
+  }
+  if (!inserted)
+  {
+    hits.fetch_add(1, std::memory_order_relaxed);
+    const BoneTransform *pose;
+    while (!(pose = entry->load(std::memory_order_acquire)))
+      std::this_thread::yield();
+    return pose;
+  }
+  misses.fetch_add(1, std::memory_order_relaxed);
+  BoneTransform *pose = frame_alloc<BoneTransform>(clip.boneCount);
+  if (mask)
+    sample_clip(clip, time, loop, *mask, pose);
+  else
+    sample_clip(clip, time, loop, pose);
+  entry->store(pose, std::memory_order_release);
+  return pose;
+}
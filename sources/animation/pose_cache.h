@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include "animation_clip.h"
+
+struct PoseCacheStats
+{
+  int64_t hits = 0;
+  int64_t misses = 0; // poses sampled
+};
+
+// Clip samples of one frame keyed by (clip, quantized time, bone mask). Characters that play a clip
+// in phase share one sampled pose and read it by pointer. Poses live in frame memory.
+// It pays off only for crowds with synchronized clips, rounded times change poses of the others.
+class PoseCache
+{
+  struct Key
+  {
+    uint32_t clip;
+    int32_t time; // multiples of timeStep, bits of the exact time when timeStep is 0
+    const BoneMask *mask;
+
+    bool operator==(const Key &other) const { return clip == other.clip && time == other.time && mask == other.mask; }
+  };
+  struct KeyHash
+  {
+    size_t operator()(const Key &key) const;
+  };
+  // Lookups of parallel evaluations lock only the shard of their key. The first one inserts an empty entry
+  // and samples outside of the lock, others wait until the pose is published.
+  struct Shard
+  {
+    std::mutex mutex;
+    std::unordered_map<Key, std::atomic<const BoneTransform *>, KeyHash> poses;
+  };
+  static constexpr int ShardCount = 16;
+  Shard shards[ShardCount];
+  std::atomic<int64_t> hits{0};
+  std::atomic<int64_t> misses{0};
+
+public:
+  float timeStep = 1.f / 60.f; // seconds, sampling times are rounded to it
+
+  // before evaluations of the frame, drops poses of the last one
+  void begin_frame();
+  // normalized pose with clip bones, only bones of the mask are valid when it is set
+  const BoneTransform *sample(AnimationClipHandle handle, const AnimationClip &clip, float time, bool loop, const BoneMask *mask);
+  PoseCacheStats stats() const { return {hits.load(), misses.load()}; }
+};
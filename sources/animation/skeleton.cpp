@@ -0,0 +1,49 @@
+#include "skeleton.h"
+#include <cfloat>
+
+int Skeleton::find_bone(const char *name) const
+{
+  for (int i = 0, n = size(); i < n; i++)
+    if (names[i] == name)
+      return i;
+  return -1;
+}
+
+void calculate_model_pose(const Skeleton &skeleton, const mat4 *local_pose, mat4 *model_pose)
+{
+  for (int i = 0, n = skeleton.size(); i < n; i++)
+  {
+    int parent = skeleton.parents[i];
+    model_pose[i] = (parent >= 0 ? model_pose[parent] : skeleton.rootTransform) * local_pose[i];
+  }
+}
+
+void calculate_skinning_palette(const Skeleton &skeleton, const mat4 *model_pose, mat4 *palette)
+{
+  for (int i = 0, n = skeleton.size(); i < n; i++)
+    palette[i] = model_pose[i] * skeleton.invBindPose[i];
+}
+
+BoundingBox calculate_skinned_bounds(const Skeleton &skeleton, const mat4 &transform, const mat4 *model_pose)
+{
+  BoundingBox box{vec3(FLT_MAX), vec3(-FLT_MAX)};
+  for (int i = 0, n = skeleton.size(); i < n; i++)
+  {
+    const vec4 &sphere = skeleton.boneBounds[i];
+    if (sphere.w <= 0.f)
+      continue;
+    mat4 boneTransform = transform * model_pose[i];
+    vec3 center = vec3(boneTransform * vec4(vec3(sphere), 1.f));
+    float scale = sqrt(max(dot(boneTransform[0], boneTransform[0]),
+                       max(dot(boneTransform[1], boneTransform[1]), dot(boneTransform[2], boneTransform[2]))));
+    vec3 radius = vec3(sphere.w * scale);
+    box.minPoint = min(box.minPoint, center - radius);
+    box.maxPoint = max(box.maxPoint, center + radius);
+  }
+  if (box.minPoint.x > box.maxPoint.x)
+  {
+    vec3 position = vec3(transform[3]);
+    box = {position, position};
+  }
+  return box;
+}
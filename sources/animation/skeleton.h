@@ -0,0 +1,39 @@
+#pragma once
+#include "3dmath.h"
+#include <vector>
+#include <string>
+#include <memory>
+
+struct BoundingBox
+{
+  vec3 minPoint;
+  vec3 maxPoint;
+};
+
+// Bones are sorted topologically, parents[i] < i, so a single forward pass
+// is enough to go from local to model space.
+struct Skeleton
+{
+  std::vector<std::string> names;
+  std::vector<int> parents;
+  std::vector<mat4> localBindPose;
+  // mesh space -> bone space, identity for helper nodes without skin
+  std::vector<mat4> invBindPose;
+  // bounding sphere of skinned vertices in bone space, w = 0 if bone has no vertices
+  std::vector<vec4> boneBounds;
+  // box in bone space with no skinned vertex of the bone inside, so it stays inside the mesh, empty if bone has no vertices
+  std::vector<BoundingBox> boneInnerBoxes;
+  // places the skeleton root in mesh space
+  mat4 rootTransform = mat4(1.f);
+
+  int size() const { return (int)parents.size(); }
+  int find_bone(const char *name) const;
+};
+
+using SkeletonPtr = std::shared_ptr<Skeleton>;
+
+void calculate_model_pose(const Skeleton &skeleton, const mat4 *local_pose, mat4 *model_pose);
+void calculate_skinning_palette(const Skeleton &skeleton, const mat4 *model_pose, mat4 *palette);
+
+// world space box around all skinned bones
+BoundingBox calculate_skinned_bounds(const Skeleton &skeleton, const mat4 &transform, const mat4 *model_pose);
@@ -0,0 +1,435 @@
+#include "state_machine.h"
+#include <algorithm>
+#include <stdexcept>
+
+int StateMachine::add_group(const char *name, int parent)
+{
+  AnimationState state;
+  state.name = name;
+  state.parent = parent;
+  states.push_back(std::move(state));
+  int index = (int)states.size() - 1;
+  if (parent >= 0 && states[parent].defaultChild < 0)
+    states[parent].defaultChild = index;
+  return index;
+}
+
+int StateMachine::add_state(const char *name, int node, int parent)
+{
+  if (node < 0 || node >= (int)tree.nodes.size())
+    throw std::runtime_error{std::string("state ") + name + " has no blend tree node"};
+  int index = add_group(name, parent);
+  states[index].node = node;
+  if (initialState < 0)
+    initialState = index;
+  return index;
+}
+
+int StateMachine::add_transition(int from, int to, float duration, const std::vector<TransitionCondition> &transition_conditions, float exit_time,
+  TransitionMode mode)
+{
+  StateTransition transition;
+  transition.from = from;
+  transition.to = to;
+  transition.duration = duration;
+  transition.exitTime = exit_time;
+  transition.firstCondition = (int)conditions.size();
+  transition.conditionCount = (int)transition_conditions.size();
+  transition.mode = mode;
+  conditions.insert(conditions.end(), transition_conditions.begin(), transition_conditions.end());
+  transitions.push_back(transition);
+  return (int)transitions.size() - 1;
+}
+
+int StateMachine::add_layer(const char *name, int node, LayerBlend blend, BoneMask &&mask, int weight_parameter)
+{
+  if (node < 0 || node >= (int)tree.nodes.size())
+    throw std::runtime_error{std::string("layer ") + name + " has no blend tree node"};
+  layers.push_back({name, node, blend, weight_parameter, std::move(mask)});
+  return (int)layers.size() - 1;
+}
+
+int StateMachine::find_state(const char *name) const
+{
+  for (size_t i = 0; i < states.size(); i++)
+    if (states[i].name == name)
+      return (int)i;
+  return -1;
+}
+
+int StateMachine::resolve_leaf(int state) const
+{
+  while (state >= 0 && states[state].node < 0)
+    state = states[state].defaultChild;
+  return state;
+}
+
+void StateMachine::build()
+{
+  leafTransitions.clear();
+  leafTransitionRanges.assign(states.size(), ivec2(0));
+  for (int i = 0, n = states.size(); i < n; i++)
+  {
+    if (states[i].node < 0)
+    {
+      if (resolve_leaf(i) < 0)
+        throw std::runtime_error{"state group " + states[i].name + " has no states"};
+      continue;
+    }
+    leafTransitionRanges[i].x = leafTransitions.size();
+    for (int state = i; state >= 0; state = states[state].parent)
+      for (int j = 0, m = transitions.size(); j < m; j++)
+        if (transitions[j].from == state)
+          leafTransitions.push_back(j);
+    leafTransitionRanges[i].y = leafTransitions.size() - leafTransitionRanges[i].x;
+  }
+}
+
+StateMachineBatch::StateMachineBatch(const StateMachine &state_machine, int bone_count) :
+  machine(&state_machine), boneCount(bone_count), parameterCount(state_machine.tree.parameters.size())
+{
+  for (const AnimationLayer &layer : state_machine.layers)
+    if (layer.mask.boneCount != bone_count)
+      throw std::runtime_error{"mask of layer " + layer.name + " has " + std::to_string(layer.mask.boneCount) + " bones, skeleton has " + std::to_string(bone_count)};
+}
+
+int StateMachineBatch::add_character()
+{
+  parameters.resize(parameters.size() + parameterCount, 0.f);
+  time.push_back(0.f);
+  state.push_back(machine->initialState);
+  stateTime.push_back(0.f);
+  fromState.push_back(-1);
+  fromTime.push_back(0.f);
+  fadeTime.push_back(0.f);
+  fadeDuration.push_back(0.f);
+  inertialization.push_back(InertializationNoPose);
+  poses.resize(poses.size() + boneCount);
+  offsets.resize(offsets.size() + boneCount);
+  return count++;
+}
+
+static bool conditions_hold(const StateMachine &machine, const StateTransition &transition, const float *parameters)
+{
+  for (int i = 0; i < transition.conditionCount; i++)
+  {
+    const TransitionCondition &condition = machine.conditions[transition.firstCondition + i];
+    float value = parameters[condition.parameter];
+    if (condition.type == ConditionType::Greater ? !(value > condition.value) : !(value < condition.value))
+      return false;
+  }
+  return true;
+}
+
+void update_state_machines(StateMachineBatch &batch, float dt, StateMachineStats *stats)
+{
+  const StateMachine &machine = *batch.machine;
+  for (int i = 0; i < batch.count; i++)
+  {
+    const float *parameters = batch.character_parameters(i);
+    batch.time[i] += dt;
+    batch.stateTime[i] += dt;
+    if (batch.fromState[i] >= 0)
+    {
+      batch.fromTime[i] += dt;
+      batch.fadeTime[i] += dt;
+      if (batch.fadeTime[i] >= batch.fadeDuration[i])
+        batch.fromState[i] = -1;
+    }
+    else if (batch.inertialization[i] == InertializationDecaying)
+    {
+      batch.fadeTime[i] += dt;
+      if (batch.fadeTime[i] >= batch.fadeDuration[i])
+        batch.inertialization[i] = InertializationNone;
+    }
+
+    int current = batch.state[i];
+    ivec2 range = machine.leafTransitionRanges[current];
+    for (int j = 0; j < range.y; j++)
+    {
+      const StateTransition &transition = machine.transitions[machine.leafTransitions[range.x + j]];
+      int target = machine.resolve_leaf(transition.to);
+      if (target == current || !conditions_hold(machine, transition, parameters))
+        continue;
+      if (transition.exitTime >= 0.f)
+      {
+        float duration = machine.tree.node_duration(machine.states[current].node, parameters);
+        if (duration > 0.f && batch.stateTime[i] < transition.exitTime * duration)
+          continue;
+      }
+      uint8_t &inertialization = batch.inertialization[i];
+      if (transition.mode == TransitionMode::Inertialization && transition.duration > 0.f && inertialization != InertializationNoPose)
+      {
+        // the last output is the source, so transitions during crossfades and other decays stay continuous
+        if (inertialization != InertializationPending)
+        {
+          const BoneTransform *pose = batch.pose(i);
+          std::copy(pose, pose + batch.boneCount, batch.offsets.begin() + (size_t)i * batch.boneCount);
+        }
+        inertialization = InertializationPending;
+        batch.fromState[i] = -1;
+      }
+      else
+      {
+        // crossfade during another transition drops its source, the pose jumps by the weight the source still had
+        if (inertialization != InertializationNoPose)
+          inertialization = InertializationNone;
+        batch.fromState[i] = transition.duration > 0.f ? current : -1;
+      }
+      batch.fromTime[i] = batch.stateTime[i];
+      batch.fadeTime[i] = 0.f;
+      batch.fadeDuration[i] = transition.duration;
+      batch.state[i] = target;
+      batch.stateTime[i] = 0.f;
+      if (stats)
+        stats->transitions++;
+      break;
+    }
+  }
+}
+
+// source pose in offsets becomes source - target
+static void compute_offsets(BoneTransform *offsets, const BoneTransform *target, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    offsets[i].translation -= target[i].translation;
+    offsets[i].rotation = offsets[i].rotation * inverse(target[i].rotation);
+    if (offsets[i].rotation.w < 0.f)
+      offsets[i].rotation = -offsets[i].rotation;
+    offsets[i].scale -= target[i].scale;
+  }
+}
+
+// Offsets fade out by a quintic with zero velocity and acceleration at both ends.
+// Velocity of the source is not carried over, the offset only decays.
+static void apply_offsets(BoneTransform *pose, const BoneTransform *offsets, float t, int count)
+{
+  t = clamp(t, 0.f, 1.f);
+  float decay = 1.f - t * t * t * (t * (t * 6.f - 15.f) + 10.f);
+  const quat identity(1.f, 0.f, 0.f, 0.f);
+  for (int i = 0; i < count; i++)
+  {
+    pose[i].translation += offsets[i].translation * decay;
+    pose[i].rotation = normalize((identity * (1.f - decay) + offsets[i].rotation * decay) * pose[i].rotation);
+    pose[i].scale += offsets[i].scale * decay;
+  }
+}
+
+static void sort_samples(FrameVector<ClipSample> &samples)
+{
+  std::sort(samples.begin(), samples.end(), [](const ClipSample &a, const ClipSample &b)
+  {
+    return a.clip.value != b.clip.value ? a.clip.value < b.clip.value : a.target < b.target;
+  });
+}
+
+// sample targets index poses and weight sums, mask limits sampled bones
+static void accumulate_samples(const FrameVector<ClipSample> &samples, int bone_count, const BoneMask *mask, PoseCache *cache,
+  BoneTransform *const *poses, float *weight_sums)
+{
+  for (size_t i = 0; i < samples.size();)
+  {
+    AnimationClipHandle handle = samples[i].clip;
+    const AnimationClip *clip = get_resource(handle);
+    for (; i < samples.size() && samples[i].clip == handle; i++)
+    {
+      const ClipSample &sample = samples[i];
+      if (clip->boneCount != bone_count)
+        continue;
+      BoneTransform *pose = poses[sample.target];
+      if (cache)
+      {
+        const BoneTransform *cached = cache->sample(handle, *clip, sample.time, sample.loop, mask);
+        if (mask)
+          for_each_masked_bone(*mask, [&](int bone) { blend_pose_add(pose + bone, cached + bone, sample.weight, 1); });
+        else
+          blend_pose_add(pose, cached, sample.weight, bone_count);
+      }
+      else if (mask)
+        accumulate_clip(*clip, sample.time, sample.loop, sample.weight, *mask, pose);
+      else
+        accumulate_clip(*clip, sample.time, sample.loop, sample.weight, pose);
+      weight_sums[sample.target] += sample.weight;
+    }
+  }
+}
+
+static const BoneTransform ZeroTransform{vec3(0.f), quat(0.f, 0.f, 0.f, 0.f), vec3(0.f)};
+
+static void normalize_bone(BoneTransform &bone, float inv_sum)
+{
+  bone.translation *= inv_sum;
+  bone.rotation = normalize(bone.rotation);
+  bone.scale *= inv_sum;
+}
+
+struct EvaluationRange
+{
+  StateMachineBatch &batch;
+  const int *characters;
+  int count;
+  const BoneMask *lodMask;
+  BoneTransform *const *poses;
+  FrameVector<ClipSample> &samples;
+  StateMachineStats &stats;
+};
+
+static void apply_layer(const AnimationLayer &layer, EvaluationRange &range, BoneTransform *const *layer_poses)
+{
+  StateMachineBatch &batch = range.batch;
+  const StateMachine &machine = *batch.machine;
+  const int count = range.count;
+  const BoneMask &mask = layer.mask;
+  const BoneMask *lodMask = range.lodMask;
+  FrameVector<float> layerWeights(count);
+  FrameVector<ClipSample> &samples = range.samples;
+  samples.clear();
+  for (int i = 0; i < count; i++)
+  {
+    int character = range.characters[i];
+    const float *parameters = batch.character_parameters(character);
+    layerWeights[i] = layer.weightParameter >= 0 ? clamp(parameters[layer.weightParameter], 0.f, 1.f) : 1.f;
+    if (layerWeights[i] > 0.f)
+      collect_clip_samples(machine.tree, layer.node, parameters, batch.time[character], 1.f, i, samples, &range.stats.tree);
+  }
+  sort_samples(samples);
+
+  for (int i = 0; i < count; i++)
+    if (layerWeights[i] > 0.f)
+    {
+      BoneTransform *pose = layer_poses[i];
+      for_each_masked_bone(mask, [pose](int bone) { pose[bone] = ZeroTransform; });
+    }
+  FrameVector<float> weightSums(count, 0.f);
+  accumulate_samples(samples, batch.boneCount, &mask, batch.poseCache, layer_poses, weightSums.data());
+
+  const quat identity(1.f, 0.f, 0.f, 0.f);
+  for (int i = 0; i < count; i++)
+  {
+    if (weightSums[i] <= 0.f)
+      continue;
+    BoneTransform *layerPose = layer_poses[i];
+    BoneTransform *pose = range.poses[i];
+    float invSum = 1.f / weightSums[i];
+    float layerWeight = layerWeights[i];
+    if (layer.blend == LayerBlend::Override)
+      for_each_masked_bone(mask, [&](int bone)
+      {
+        if (lodMask && !lodMask->test(bone))
+          return;
+        normalize_bone(layerPose[bone], invSum);
+        lerp_pose(pose + bone, pose + bone, layerPose + bone, layerWeight * mask.weights[bone], 1);
+      });
+    else
+      for_each_masked_bone(mask, [&](int bone)
+      {
+        if (lodMask && !lodMask->test(bone))
+          return;
+        BoneTransform &delta = layerPose[bone];
+        normalize_bone(delta, invSum);
+        float weight = layerWeight * mask.weights[bone];
+        quat rotation = delta.rotation.w < 0.f ? -delta.rotation : delta.rotation;
+        pose[bone].translation += delta.translation * weight;
+        pose[bone].rotation = normalize(pose[bone].rotation * normalize(identity * (1.f - weight) + rotation * weight));
+        pose[bone].scale *= mix(vec3(1.f), delta.scale, weight);
+      });
+    range.stats.layerBones += mask.activeBones;
+  }
+}
+
+void evaluate_state_machines(StateMachineBatch &batch, const int *characters, int count, const BoneMask *lod_mask, StateMachineStats *stats)
+{
+  const StateMachine &machine = *batch.machine;
+  const int boneCount = batch.boneCount;
+  StateMachineStats localStats;
+  StateMachineStats &s = stats ? *stats : localStats;
+
+  FrameVector<ClipSample> samples;
+  samples.reserve(count * 4);
+  FrameVector<BoneTransform *> poses(count);
+  for (int i = 0; i < count; i++)
+  {
+    int character = characters[i];
+    poses[i] = batch.poses.data() + (size_t)character * boneCount;
+    const float *parameters = batch.character_parameters(character);
+    float weight = 1.f;
+    if (batch.fromState[character] >= 0)
+    {
+      float t = clamp(batch.fadeTime[character] / batch.fadeDuration[character], 0.f, 1.f);
+      weight = t * t * (3.f - 2.f * t);
+      collect_clip_samples(machine.tree, machine.states[batch.fromState[character]].node, parameters, batch.fromTime[character], 1.f - weight, i,
+        samples, &s.tree);
+      s.crossfades++;
+    }
+    collect_clip_samples(machine.tree, machine.states[batch.state[character]].node, parameters, batch.stateTime[character], weight, i, samples, &s.tree);
+  }
+  sort_samples(samples);
+
+  for (int i = 0; i < count; i++)
+    if (lod_mask)
+      for_each_masked_bone(*lod_mask, [pose = poses[i]](int bone) { pose[bone] = ZeroTransform; });
+    else
+      std::fill(poses[i], poses[i] + boneCount, ZeroTransform);
+  FrameVector<float> weightSums(count, 0.f);
+  accumulate_samples(samples, boneCount, lod_mask, batch.poseCache, poses.data(), weightSums.data());
+
+  // pruned samples leave sums a bit below 1, bones skipped by LOD get the rest pose
+  const bool hasRestPose = (int)batch.restPose.size() == boneCount;
+  for (int i = 0; i < count; i++)
+  {
+    BoneTransform *pose = poses[i];
+    if (weightSums[i] <= 0.f)
+    {
+      if (hasRestPose)
+        std::copy(batch.restPose.begin(), batch.restPose.end(), pose);
+      else
+        std::fill(pose, pose + boneCount, BoneTransform());
+      continue;
+    }
+    float invSum = 1.f / weightSums[i];
+    if (!lod_mask)
+    {
+      for (int j = 0; j < boneCount; j++)
+        normalize_bone(pose[j], invSum);
+      continue;
+    }
+    for (int j = 0; j < boneCount; j++)
+      if (lod_mask->test(j))
+        normalize_bone(pose[j], invSum);
+      else
+        pose[j] = hasRestPose ? batch.restPose[j] : BoneTransform();
+  }
+
+  // layer poses are written only at masked bones, the buffer needs no initialization
+  if (!machine.layers.empty())
+  {
+    BoneTransform *layerBuffer = frame_alloc<BoneTransform>((size_t)count * boneCount);
+    FrameVector<BoneTransform *> layerPoses(count);
+    for (int i = 0; i < count; i++)
+      layerPoses[i] = layerBuffer + (size_t)i * boneCount;
+    EvaluationRange range{batch, characters, count, lod_mask, poses.data(), samples, s};
+    for (const AnimationLayer &layer : machine.layers)
+      apply_layer(layer, range, layerPoses.data());
+  }
+
+  // offsets are taken from the final pose, so layers stay continuous through transitions too
+  for (int i = 0; i < count; i++)
+  {
+    int character = characters[i];
+    uint8_t &inertialization = batch.inertialization[character];
+    BoneTransform *offsets = batch.offsets.data() + (size_t)character * boneCount;
+    if (inertialization == InertializationNoPose)
+      inertialization = InertializationNone;
+    else if (inertialization == InertializationPending)
+    {
+      compute_offsets(offsets, poses[i], boneCount);
+      inertialization = InertializationDecaying;
+    }
+    if (inertialization == InertializationDecaying)
+    {
+      apply_offsets(poses[i], offsets, batch.fadeTime[character] / batch.fadeDuration[character], boneCount);
+      s.inertializations++;
+    }
+  }
+}
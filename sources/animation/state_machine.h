@@ -0,0 +1,142 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "blend_tree.h"
+#include "bone_mask.h"
+#include "pose_cache.h"
+
+enum class ConditionType : uint8_t
+{
+  Greater,
+  Less
+};
+
+enum class TransitionMode : uint8_t
+{
+  Crossfade, // samples both states until the fade ends
+  Inertialization // samples only the target, the difference to the source pose decays over duration
+};
+
+struct TransitionCondition
+{
+  int parameter;
+  ConditionType type;
+  float value;
+};
+
+struct StateTransition
+{
+  int from; // leaf or group, transition of a group is taken from any state inside it
+  int to; // entering a group enters its default state
+  float duration; // seconds of crossfade or offset decay
+  float exitTime; // normalized time of the source state, negative allows any time
+  int firstCondition;
+  int conditionCount; // every condition has to hold
+  TransitionMode mode;
+};
+
+struct AnimationState
+{
+  std::string name;
+  int parent = -1;
+  int node = -1; // blend tree node, -1 for groups
+  int defaultChild = -1; // the first child of a group
+};
+
+enum class LayerBlend : uint8_t
+{
+  Override, // replaces masked bones of the layers below
+  Additive // clips made by make_additive_clip, deltas are applied on top of the layers below
+};
+
+// Layer plays a blend tree node on top of the state machine output, its time runs from the character start.
+struct AnimationLayer
+{
+  std::string name;
+  int node;
+  LayerBlend blend;
+  int weightParameter; // -1 for full weight
+  BoneMask mask; // bones outside of it are not sampled
+};
+
+// Hierarchical state machine. States play subtrees of one blend tree, so all states share its parameters.
+// After build every leaf state has a flat list of transitions of itself and its groups, closest first.
+class StateMachine
+{
+public:
+  BlendTree tree;
+  std::vector<AnimationState> states;
+  std::vector<StateTransition> transitions;
+  std::vector<TransitionCondition> conditions;
+  std::vector<AnimationLayer> layers; // applied in order after the states
+  std::vector<int> leafTransitions;
+  std::vector<ivec2> leafTransitionRanges; // first and count in leafTransitions, by state
+  int initialState = -1;
+
+  int add_group(const char *name, int parent = -1);
+  // the first added leaf is the initial state
+  int add_state(const char *name, int node, int parent = -1);
+  int add_transition(int from, int to, float duration, const std::vector<TransitionCondition> &transition_conditions, float exit_time = -1.f,
+    TransitionMode mode = TransitionMode::Crossfade);
+  int add_layer(const char *name, int node, LayerBlend blend, BoneMask &&mask, int weight_parameter = -1);
+  int find_state(const char *name) const;
+  // leaf entered when the state is entered
+  int resolve_leaf(int state) const;
+  void build();
+};
+
+enum InertializationState : uint8_t
+{
+  InertializationNone,
+  InertializationNoPose, // character was not evaluated yet, transitions can't take its pose
+  InertializationPending, // offsets hold the source pose
+  InertializationDecaying
+};
+
+// State of many characters running one state machine, every array has one entry per character.
+// update and evaluate go over the arrays in one pass without per character objects.
+struct StateMachineBatch
+{
+  const StateMachine *machine = nullptr;
+  int boneCount = 0;
+  int parameterCount = 0;
+  int count = 0;
+  std::vector<float> parameters; // parameterCount per character
+  std::vector<float> time; // since the character was added, drives layers
+  std::vector<int> state;
+  std::vector<float> stateTime;
+  std::vector<int> fromState; // source of crossfade, -1 without it
+  std::vector<float> fromTime;
+  std::vector<float> fadeTime; // of crossfade or inertialization
+  std::vector<float> fadeDuration;
+  std::vector<uint8_t> inertialization; // InertializationState
+  std::vector<BoneTransform> poses; // local poses written by evaluate, boneCount per character
+  // inertialization: source pose until the target is evaluated, then source - target offsets, boneCount per character
+  std::vector<BoneTransform> offsets;
+  std::vector<BoneTransform> restPose; // boneCount transforms for bones skipped by LOD, identity when empty
+  PoseCache *poseCache = nullptr; // clip samples are shared through it when set
+
+  // layer masks have to be made for bone_count bones
+  StateMachineBatch(const StateMachine &state_machine, int bone_count);
+  int add_character();
+  float *character_parameters(int character) { return parameters.data() + (size_t)character * parameterCount; }
+  const BoneTransform *pose(int character) const { return poses.data() + (size_t)character * boneCount; }
+};
+
+struct StateMachineStats
+{
+  int transitions = 0;
+  int crossfades = 0; // characters blending two states
+  int inertializations = 0; // characters decaying transition offsets
+  int layerBones = 0; // bones sampled by layers, partial layers touch only their masks
+  BlendTreeStats tree;
+};
+
+// advances time, takes transitions and finishes crossfades and offset decays
+void update_state_machines(StateMachineBatch &batch, float dt, StateMachineStats *stats = nullptr);
+// Writes poses of the listed characters. Clip samples of the list are sorted by clip,
+// so every clip is read in one go for all of them. Disjoint lists can be evaluated in parallel.
+// Inertialized characters sample only their current state, their output is also the source of the next transition.
+// With lod_mask only its bones are sampled, the others get the rest pose.
+void evaluate_state_machines(StateMachineBatch &batch, const int *characters, int count, const BoneMask *lod_mask = nullptr,
+  StateMachineStats *stats = nullptr);
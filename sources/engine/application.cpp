@@ -3,12 +3,31 @@
 #include <imgui/imgui_impl_opengl3.h>
 #include <imgui/imgui_impl_sdl.h>
 #include <SDL2/SDL.h>
+#include <render/ring_buffer.h>
+#include <render/debug_arrow.h>
+#include <render/shader.h>
+#include <render/global_render_data.h>
+#include <render/render_device.h>
+#include "file_watcher.h"
+#include "job_system.h"
+#include "profiler.h"
+#include "frame_pacing.h"
+#include "render_thread.h"
+#include "headless_context.h"
+#include "frame_statistics.h"
+#include "frame_allocator.h"
+#include "resource_registry.h"
+#include <cstring>
+#include <cstdlib>
 
 extern void game_init();
+extern void game_close();
 extern void game_update();
 extern void game_render();
+extern void game_imgui();
 extern void start_time();
 extern void update_time();
+extern void set_fixed_delta_time(float delta_time);
 
 typedef void *SDL_GLContext;
 
@@ -19,44 +38,227 @@ struct SDLContext
 };
 
 SDLContext context;
+static ApplicationSettings appSettings;
+static bool headlessContext = false; // EGL context instead of SDL window
+static GLuint offscreenFramebuffer = 0;
+static GLuint offscreenTextures[2] = {};
+static std::unique_ptr<RecordingRenderDevice> recordingDevice;
 
-void init_application(const char *project_name, int width, int height, bool full_screen)
+static bool parse_vsync(const char *value, VSyncMode &mode)
+{
+  const char *names[] = {"off", "on", "adaptive"};
+  for (int i = 0; i < 3; i++)
+    if (!strcmp(value, names[i]))
+    {
+      mode = (VSyncMode)i;
+      return true;
+    }
+  return false;
+}
+
+bool parse_command_line(int argc, char **argv, ApplicationSettings &settings)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (!strcmp(arg, "--render-thread"))
+      settings.renderThread = true;
+    else if (!strcmp(arg, "--headless"))
+      settings.headless = true;
+    else if (!strcmp(arg, "--windowed"))
+      settings.fullScreen = false;
+    else if (!strcmp(arg, "--frames") && hasValue)
+      settings.frameCount = atoi(argv[++i]);
+    else if (!strcmp(arg, "--fixed-dt") && hasValue)
+      settings.fixedDeltaTime = atof(argv[++i]);
+    else if (!strcmp(arg, "--vsync") && hasValue && parse_vsync(argv[i + 1], frame_pacing_settings().vsync))
+      i++;
+    else if (!strcmp(arg, "--size") && hasValue && sscanf(argv[i + 1], "%dx%d", &settings.width, &settings.height) == 2)
+      i++;
+    else if (!strcmp(arg, "--stats") && hasValue)
+      settings.statsPath = argv[++i];
+    else if (!strcmp(arg, "--log") && hasValue)
+      settings.logPath = argv[++i];
+    else if (!strcmp(arg, "--record-render"))
+      settings.recordRender = true;
+    else if (!strcmp(arg, "--null-render"))
+      settings.nullRender = true;
+    else if (!strcmp(arg, "--render-trace") && hasValue)
+      settings.renderTracePath = argv[++i];
+    else if (!strcmp(arg, "--max-draw-calls") && hasValue)
+      settings.maxDrawCalls = atoi(argv[++i]);
+    else if (!strcmp(arg, "--max-program-binds") && hasValue)
+      settings.maxProgramBinds = atoi(argv[++i]);
+    else if (!strcmp(arg, "--characters") && hasValue)
+      settings.characterCount = atoi(argv[++i]);
+    else if (!strcmp(arg, "--crossfade"))
+      settings.crossfadeTransitions = true;
+    else if (!strcmp(arg, "--no-animation-lod"))
+      settings.animationLod = false;
+    else if (!strcmp(arg, "--pose-cache-step") && hasValue)
+      settings.poseCacheStep = atof(argv[++i]);
+    else if (!strcmp(arg, "--crowd") && hasValue)
+      settings.crowdCount = atoi(argv[++i]);
+    else if (!strcmp(arg, "--crowd-half"))
+      settings.crowdHalfPrecision = true;
+    else if (!strcmp(arg, "--motion-matching"))
+      settings.motionMatching = true;
+    else if (!strcmp(arg, "--motion-matching-benchmark") && hasValue)
+      settings.motionMatchingBenchmark = atoi(argv[++i]);
+    else
+    {
+      printf("unknown argument %s\n"
+        "usage: %s [--render-thread] [--headless] [--windowed] [--frames N] [--fixed-dt seconds] [--size WxH] [--stats file.json] [--log file.txt]\n"
+        "  [--vsync off|on|adaptive] [--record-render] [--null-render] [--render-trace file.txt] [--max-draw-calls N] [--max-program-binds N]\n"
+        "  [--characters N] [--crossfade] [--no-animation-lod] [--pose-cache-step seconds] [--crowd N] [--crowd-half]\n"
+        "  [--motion-matching] [--motion-matching-benchmark max_rows]\n",
+        arg, argv[0]);
+      return false;
+    }
+  }
+  if (settings.headless && settings.frameCount <= 0)
+  {
+    const int defaultHeadlessFrames = 600;
+    settings.frameCount = defaultHeadlessFrames;
+  }
+  settings.recordRender |= settings.nullRender || settings.renderTracePath || settings.maxDrawCalls >= 0 || settings.maxProgramBinds >= 0;
+  return true;
+}
+
+const ApplicationSettings &application_settings()
+{
+  return appSettings;
+}
+
+// headless rendering goes to this framebuffer, surfaceless context has no default one
+static void create_offscreen_framebuffer(int width, int height)
+{
+  glGenTextures(2, offscreenTextures);
+  glBindTexture(GL_TEXTURE_2D, offscreenTextures[0]);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+  glBindTexture(GL_TEXTURE_2D, offscreenTextures[1]);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glGenFramebuffers(1, &offscreenFramebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, offscreenFramebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, offscreenTextures[0], 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, offscreenTextures[1], 0);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    debug_error("offscreen framebuffer %dx%d is incomplete", width, height);
+  glViewport(0, 0, width, height);
+}
+
+static void destroy_offscreen_framebuffer()
+{
+  if (!offscreenFramebuffer)
+    return;
+  glDeleteFramebuffers(1, &offscreenFramebuffer);
+  glDeleteTextures(2, offscreenTextures);
+  offscreenFramebuffer = 0;
+}
+
+static void make_context_current(bool attach)
+{
+  if (headlessContext)
+    make_headless_context_current(attach);
+  else
+    SDL_GL_MakeCurrent(context.window, attach ? context.gl_context : nullptr);
+}
+
+static void create_window(const ApplicationSettings &settings)
 {
   SDL_Init(SDL_INIT_EVERYTHING);
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, 0);
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
-  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 5);
 
 
   size_t window_flags = SDL_WINDOW_OPENGL;
-  if (full_screen)
+  if (settings.headless)
+    window_flags |= SDL_WINDOW_HIDDEN;
+  else if (settings.fullScreen)
     window_flags |= SDL_WINDOW_MAXIMIZED | SDL_WINDOW_RESIZABLE;
-  context.window = SDL_CreateWindow(project_name, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, (SDL_WindowFlags)(window_flags));
+  context.window = SDL_CreateWindow(settings.projectName, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, settings.width, settings.height, (SDL_WindowFlags)(window_flags));
   context.gl_context = SDL_GL_CreateContext(context.window);
   SDL_GL_MakeCurrent(context.window, context.gl_context);
-  SDL_GL_SetSwapInterval(0);
 
   if (!gladLoadGLLoader(SDL_GL_GetProcAddress))
   {
     throw std::runtime_error{"Glad error"};
   }
-  IMGUI_CHECKVERSION();
-  ImGui::CreateContext();
-  ImGui::StyleColorsDark();
+}
+
+void init_application(const ApplicationSettings &settings)
+{
+  appSettings = settings;
+  init_log(settings.logPath);
+  if (settings.headless)
+  {
+    headlessContext = create_headless_context(settings.width, settings.height);
+    if (headlessContext && !gladLoadGLLoader((GLADloadproc)headless_get_proc_address))
+      throw std::runtime_error{"Glad error"};
+  }
+  // hidden window is the headless fallback where EGL isn't available
+  if (!headlessContext)
+    create_window(settings);
+
+  if (!settings.headless)
+  {
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    ImGui::StyleColorsDark();
 
-  ImGui_ImplSDL2_InitForOpenGL(context.window, context.gl_context);
-  const char *glsl_version = "#version 450";
-  ImGui_ImplOpenGL3_Init(glsl_version);
+    ImGui_ImplSDL2_InitForOpenGL(context.window, context.gl_context);
+    const char *glsl_version = "#version 450";
+    ImGui_ImplOpenGL3_Init(glsl_version);
+    // builds font atlas now, later NewFrame is called on the render thread after game thread used it
+    ImGui_ImplOpenGL3_NewFrame();
+  }
+  else
+    create_offscreen_framebuffer(settings.width, settings.height);
   glEnable(GL_DEBUG_OUTPUT);
+
+  const size_t dynamicBufferRegionSize = 64 << 20;
+  init_dynamic_buffer(dynamicBufferRegionSize);
+  init_job_system();
+  init_profiler();
+  init_shader_hot_reload("sources/shaders");
+  register_render_data_layouts();
+  init_debug_render();
+  set_fixed_delta_time(settings.fixedDeltaTime);
+  if (settings.recordRender)
+  {
+    recordingDevice = std::make_unique<RecordingRenderDevice>(settings.nullRender ? nullptr : &render_device());
+    set_render_device(recordingDevice.get());
+  }
 }
 
 void close_application()
 {
-  ImGui_ImplOpenGL3_Shutdown();
-  ImGui_ImplSDL2_Shutdown();
-  ImGui::DestroyContext();
-  SDL_Quit();
+  close_render_thread();
+  set_render_device(nullptr);
+  recordingDevice.reset();
+  close_job_system();
+  close_profiler();
+  close_frame_pacing();
+  close_debug_render();
+  close_resources();
+  close_file_watcher();
+  close_dynamic_buffer();
+  destroy_offscreen_framebuffer();
+  if (!appSettings.headless)
+  {
+    ImGui_ImplOpenGL3_Shutdown();
+    ImGui_ImplSDL2_Shutdown();
+    ImGui::DestroyContext();
+  }
+  if (headlessContext)
+    destroy_headless_context();
+  else
+    SDL_Quit();
+  close_log();
 }
 
 
@@ -91,45 +293,222 @@ static bool sdl_event_handler()
   return running;
 }
 
-void main_loop()
+static VSyncMode appliedVSync;
+static bool vsyncApplied = false;
+
+static void apply_vsync(VSyncMode mode)
+{
+  if (vsyncApplied && mode == appliedVSync)
+    return;
+  int interval = mode == VSyncMode::Off ? 0 : mode == VSyncMode::On ? 1 : -1;
+  if (SDL_GL_SetSwapInterval(interval) != 0 && mode == VSyncMode::Adaptive)
+  {
+    debug_log("adaptive vsync isn't supported, fallback to vsync");
+    mode = VSyncMode::On;
+    frame_pacing_settings().vsync = mode;
+    SDL_GL_SetSwapInterval(1);
+  }
+  appliedVSync = mode;
+  vsyncApplied = true;
+}
+
+// ImGui rebuilds draw lists every frame, the render thread replays its own copy
+struct ImGuiRenderData
+{
+  ImDrawData drawData;
+  ImVector<ImDrawList *> lists;
+
+  explicit ImGuiRenderData(const ImDrawData &source) : drawData(source)
+  {
+    for (int i = 0; i < source.CmdListsCount; i++)
+      lists.push_back(source.CmdLists[i]->CloneOutput());
+    drawData.CmdLists = lists.Data;
+  }
+  ~ImGuiRenderData()
+  {
+    for (ImDrawList *list : lists)
+      IM_DELETE(list);
+  }
+};
+
+static void record_imgui()
+{
+  ImGui_ImplSDL2_NewFrame(context.window);
+  ImGui::NewFrame();
+  {
+    if (ImGui::BeginMainMenuBar())
+    {
+      game_imgui();
+      frame_pacing_menu();
+      resources_menu();
+      profiler_menu();
+      ImGui::EndMainMenuBar();
+    }
+    profiler_window();
+  }
+  ImGui::Render();
+
+  // without render thread the draw data is still valid on replay
+  std::unique_ptr<ImGuiRenderData> renderData;
+  if (is_render_thread_mode())
+    renderData = std::make_unique<ImGuiRenderData>(*ImGui::GetDrawData());
+  enqueue_render_command([renderData = std::move(renderData)]()
+  {
+    ImGui_ImplOpenGL3_NewFrame();
+    ImGui_ImplOpenGL3_RenderDrawData(renderData ? &renderData->drawData : ImGui::GetDrawData());
+  });
+}
+
+static float elapsed_ms(uint64_t from, uint64_t to)
+{
+  return (to - from) * 1e-6f;
+}
+
+// fails the run when the peak frame is over budget, it makes draw overhead checkable in CI
+static bool check_render_budget(const RecordingRenderDevice &device)
+{
+  const RenderStats &peak = device.peak_frame_stats();
+  bool passed = true;
+  if (appSettings.maxDrawCalls >= 0 && peak.drawCalls > appSettings.maxDrawCalls)
+  {
+    debug_error("%d draw calls per frame, budget is %d", peak.drawCalls, appSettings.maxDrawCalls);
+    passed = false;
+  }
+  if (appSettings.maxProgramBinds >= 0 && peak.programBinds > appSettings.maxProgramBinds)
+  {
+    debug_error("%d program binds per frame, budget is %d", peak.programBinds, appSettings.maxProgramBinds);
+    passed = false;
+  }
+  return passed;
+}
+
+int main_loop()
 {
   start_time();
   game_init();
+  init_render_thread(appSettings.renderThread, make_context_current);
 
+  const bool headless = appSettings.headless;
+  FrameStatistics &statistics = frame_statistics();
+  int frameCount = 0;
   bool running = true;
   while (running)
   {
+    uint64_t frameStart = profiler_time();
+    begin_frame_allocator();
+    update_resources();
+    apply_shader_reloads();
     update_time();
+    profiler_begin_frame();
 
-		running = sdl_event_handler();
+    uint64_t inputTime = profiler_time();
+		running = headless || sdl_event_handler();
 
     if (running)
     {
-      game_update();
-      SDL_GL_SwapWindow(context.window);
-
-      game_render();
-
-      ImGui_ImplOpenGL3_NewFrame();
-      ImGui_ImplSDL2_NewFrame(context.window);
-      ImGui::NewFrame();
+      VSyncMode vsync = frame_pacing_settings().vsync;
+      uint64_t frame = profiler_frame_number();
+      enqueue_render_command([vsync, frame, headless]()
       {
-        if (ImGui::BeginMainMenuBar())
+        profiler_begin_gpu_frame(frame);
+        if (!headless)
+          apply_vsync(vsync);
+        update_shader_hot_reload();
         {
-          ImGui::EndMainMenuBar();
+          PROFILE_SCOPE("wait_gpu");
+          wait_frame_in_flight();
         }
+        dynamic_buffer().begin_frame();
+        if (recordingDevice)
+          recordingDevice->begin_frame();
+        if (offscreenFramebuffer)
+        {
+          glBindFramebuffer(GL_FRAMEBUFFER, offscreenFramebuffer);
+          glViewport(0, 0, appSettings.width, appSettings.height);
+        }
+      });
+      uint64_t updateStart = profiler_time();
+      {
+        // simulation of this frame overlaps with GPU work of previous ones
+        PROFILE_SCOPE("game_update");
+        game_update();
       }
+      uint64_t renderStart = profiler_time();
+      {
+        PROFILE_SCOPE("game_render");
+        RENDER_PROFILE_SCOPE("game_render");
+        game_render();
+      }
+      if (!headless)
+      {
+        PROFILE_SCOPE("imgui");
+        RENDER_PROFILE_SCOPE("imgui");
+        record_imgui();
+      }
+      enqueue_render_command([inputTime, headless]()
+      {
+        dynamic_buffer().end_frame();
+        if (!headless)
+        {
+          PROFILE_SCOPE("swap");
+          SDL_GL_SwapWindow(context.window);
+        }
+        end_frame_pacing(inputTime);
+        if (recordingDevice)
+          recordingDevice->end_frame();
+      });
+      uint64_t submitStart = profiler_time();
+      {
+        PROFILE_SCOPE("submit");
+        submit_render_frame();
+      }
+      limit_frame_rate();
 
-      ImGui::Render();
-      ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+      uint64_t frameEnd = profiler_time();
+      if (appSettings.frameCount > 0)
+      {
+        statistics.add("frame", elapsed_ms(frameStart, frameEnd));
+        statistics.add("game_update", elapsed_ms(updateStart, renderStart));
+        statistics.add("game_render", elapsed_ms(renderStart, submitStart));
+        statistics.add("submit", elapsed_ms(submitStart, frameEnd));
+        running = ++frameCount < appSettings.frameCount;
+      }
     }
+    profiler_end_frame();
 	}
+  flush_render_thread();
+  game_close();
+
+  if (!statistics.empty())
+  {
+    debug_log("%d frames%s%s", frameCount, headless ? ", headless" : "", appSettings.renderThread ? ", render thread" : "");
+    statistics.print();
+    FrameAllocatorStats arena = frame_allocator_stats();
+    debug_log("frame arena: last frame %zu bytes, peak %zu bytes, %zu bytes reserved by %d threads",
+      arena.lastFrameBytes, arena.peakFrameBytes, arena.capacityBytes, arena.threadCount);
+    for (const ResourceStats &resources : resource_stats())
+      debug_log("%s: %d alive, %zu bytes, peak %zu bytes, %d of %d loads shared",
+        resources.name, resources.count, resources.bytes, resources.peakBytes, resources.deduplicated, resources.loads);
+    if (appSettings.statsPath)
+      statistics.save_json(appSettings.statsPath);
+  }
+  if (recordingDevice)
+  {
+    recordingDevice->print();
+    if (appSettings.renderTracePath)
+      recordingDevice->save_trace(appSettings.renderTracePath);
+    if (!check_render_budget(*recordingDevice))
+      return 2;
+  }
+  return 0;
 }
 
 
 float get_aspect_ratio()
 {
+  if (appSettings.headless)
+    return (float)appSettings.width / appSettings.height;
   int width, height;
   SDL_GL_GetDrawableSize(context.window, &width, &height);
   return (float)width / height;
-}
\ No newline at end of file
+}
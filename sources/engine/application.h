@@ -2,8 +2,43 @@
 #include "log.h"
 #include "input.h"
 
+struct ApplicationSettings
+{
+  const char *projectName = "animations";
+  int width = 2048;
+  int height = 1024;
+  bool fullScreen = true;
+  bool renderThread = false;
+  // offscreen context without window, for benchmarks on machines without display
+  bool headless = false;
+  int frameCount = 0; // 0 runs until quit
+  float fixedDeltaTime = 0.f; // 0 uses wall clock
+  const char *statsPath = nullptr; // frame timings as json
+  const char *logPath = nullptr; // copy of stdout log
+  // render calls go through RecordingRenderDevice, counters are printed at exit
+  bool recordRender = false;
+  bool nullRender = false; // recording without GL draw calls, implies recordRender
+  const char *renderTracePath = nullptr; // calls of the last frame as text
+  // budgets per frame, run fails when the peak frame exceeds them, -1 disables check
+  int maxDrawCalls = -1;
+  int maxProgramBinds = -1;
+  // animation benchmark: characters in the scene, transitions crossfade instead of inertialization
+  int characterCount = 1;
+  bool crossfadeTransitions = false;
+  bool animationLod = true; // distant characters update less often and skip small bones
+  float poseCacheStep = -1.f; // seconds clip sample times are rounded to for sharing, 0 shares exact times, negative disables the cache
+  int crowdCount = 0; // instances animated by baked textures, drawn with one call
+  bool crowdHalfPrecision = false;
+  bool motionMatching = false; // one more character in front of the grid is driven by motion matching over the locomotion clips
+  int motionMatchingBenchmark = 0; // max database rows of the motion search benchmark run at start, 0 skips it
+};
+
+// returns false and prints usage on unknown arguments
+bool parse_command_line(int argc, char **argv, ApplicationSettings &settings);
+const ApplicationSettings &application_settings();
+
 float get_aspect_ratio();
 
 float get_time();
 
-float get_delta_time();
\ No newline at end of file
+float get_delta_time();
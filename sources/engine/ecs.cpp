@@ -0,0 +1,231 @@
+#include "ecs.h"
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include "job_system.h"
+#include "profiler.h"
+#include "log.h"
+
+namespace ecs
+{
+static std::mutex registryMutex;
+static ComponentInfo componentInfos[MaxComponents];
+static int componentCount = 0;
+
+int register_component(const ComponentInfo &info)
+{
+  std::lock_guard<std::mutex> lock(registryMutex);
+  if (componentCount == MaxComponents)
+    throw std::runtime_error{"too many ecs component types"};
+  // chunk memory comes from operator new[], it isn't aligned stronger than that
+  if (info.alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+    debug_error("component of %zu bytes needs alignment %zu, chunks give only %zu", info.size, info.alignment, (size_t)__STDCPP_DEFAULT_NEW_ALIGNMENT__);
+  componentInfos[componentCount] = info;
+  return componentCount++;
+}
+
+const ComponentInfo &component_info(int id)
+{
+  return componentInfos[id];
+}
+
+static size_t align_up(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+Archetype::Archetype(ComponentMask component_mask) : mask(component_mask)
+{
+  std::fill(std::begin(columnIndex), std::end(columnIndex), -1);
+  size_t rowSize = sizeof(Entity);
+  size_t paddingSize = 0;
+  for (int id = 0; id < MaxComponents; id++)
+    if (mask & (ComponentMask(1) << id))
+    {
+      columnIndex[id] = (int8_t)components.size();
+      components.push_back(id);
+      rowSize += component_info(id).size;
+      paddingSize += component_info(id).alignment;
+    }
+  capacity = std::max<int>(1, (int)((ChunkSize - paddingSize) / rowSize));
+
+  // entity array goes first, then components in id order
+  size_t offset = sizeof(Entity) * capacity;
+  for (int id : components)
+  {
+    const ComponentInfo &info = component_info(id);
+    offset = align_up(offset, info.alignment);
+    columnOffsets.push_back(offset);
+    offset += info.size * capacity;
+  }
+}
+
+
+World::~World()
+{
+  for (Archetype *archetype : archetypeList)
+    for (Archetype::Chunk &chunk : archetype->chunks)
+      for (int row = 0; row < chunk.count; row++)
+        for (size_t column = 0; column < archetype->components.size(); column++)
+          component_info(archetype->components[column]).destroy(archetype->component(chunk, column, row));
+}
+
+Archetype &World::get_archetype(ComponentMask mask)
+{
+  std::unique_ptr<Archetype> &archetype = archetypes[mask];
+  if (!archetype)
+  {
+    archetype = std::make_unique<Archetype>(mask);
+    archetypeList.push_back(archetype.get());
+  }
+  return *archetype;
+}
+
+Entity World::allocate_entity()
+{
+  uint32_t index;
+  if (!freeIndices.empty())
+  {
+    index = freeIndices.back();
+    freeIndices.pop_back();
+  }
+  else
+  {
+    index = records.size();
+    records.emplace_back();
+  }
+  entityCount++;
+  return {index, records[index].generation};
+}
+
+World::EntityRecord &World::place(Entity entity, Archetype &archetype)
+{
+  if (archetype.chunks.empty() || archetype.chunks.back().count == archetype.capacity)
+    archetype.chunks.push_back({std::unique_ptr<char[]>(new char[Archetype::ChunkSize]), 0});
+  Archetype::Chunk &chunk = archetype.chunks.back();
+  int row = chunk.count++;
+  archetype.entities(chunk)[row] = entity;
+
+  EntityRecord &record = records[entity.index];
+  record.archetype = &archetype;
+  record.chunk = (int)archetype.chunks.size() - 1;
+  record.row = row;
+  return record;
+}
+
+void World::remove_row(Archetype &archetype, int chunk_index, int row)
+{
+  // chunks stay dense, only the last one is partially filled
+  Archetype::Chunk &last = archetype.chunks.back();
+  int lastRow = last.count - 1;
+  Archetype::Chunk &chunk = archetype.chunks[chunk_index];
+  if (&chunk != &last || row != lastRow)
+  {
+    for (size_t column = 0; column < archetype.components.size(); column++)
+      component_info(archetype.components[column]).move(archetype.component(chunk, column, row), archetype.component(last, column, lastRow));
+    Entity moved = archetype.entities(last)[lastRow];
+    archetype.entities(chunk)[row] = moved;
+    records[moved.index].chunk = chunk_index;
+    records[moved.index].row = row;
+  }
+  if (--last.count == 0)
+    archetype.chunks.pop_back();
+}
+
+void World::destroy_row(Archetype &archetype, int chunk, int row)
+{
+  for (size_t column = 0; column < archetype.components.size(); column++)
+    component_info(archetype.components[column]).destroy(archetype.component(archetype.chunks[chunk], column, row));
+  remove_row(archetype, chunk, row);
+}
+
+void World::destroy(Entity entity)
+{
+  if (!alive(entity))
+    return;
+  EntityRecord &record = records[entity.index];
+  destroy_row(*record.archetype, record.chunk, record.row);
+  record.archetype = nullptr;
+  record.generation++;
+  freeIndices.push_back(entity.index);
+  entityCount--;
+}
+
+World::EntityRecord &World::change_archetype(Entity entity, ComponentMask new_mask)
+{
+  EntityRecord &record = records[entity.index];
+  Archetype &from = *record.archetype;
+  int fromChunk = record.chunk, fromRow = record.row;
+  Archetype &to = get_archetype(new_mask);
+  place(entity, to);
+  const Archetype::Chunk &toChunk = to.chunks[record.chunk];
+  const Archetype::Chunk &chunk = from.chunks[fromChunk];
+  for (size_t column = 0; column < from.components.size(); column++)
+  {
+    int id = from.components[column];
+    void *source = from.component(chunk, column, fromRow);
+    if (to.has(id))
+      component_info(id).move(to.component(toChunk, to.columnIndex[id], record.row), source);
+    else
+      component_info(id).destroy(source);
+  }
+  // record already points to the new place, remove_row only fixes the entity moved into the old one
+  remove_row(from, fromChunk, fromRow);
+  return record;
+}
+
+void World::parallel_for_chunks(int count, const std::function<void(int)> &body)
+{
+  parallel_for(count, 1, [&](int begin, int end)
+  {
+    for (int i = begin; i < end; i++)
+      body(i);
+  });
+}
+
+
+void Scheduler::add(const char *name, ComponentMask reads, ComponentMask writes, std::function<void(World &)> &&run)
+{
+  int index = (int)systems.size();
+  System system{name, reads, writes, std::move(run), {}, 0};
+  for (int i = 0; i < index; i++)
+  {
+    const System &other = systems[i];
+    if ((other.writes & (reads | writes)) || (other.reads & writes))
+    {
+      systems[i].dependents.push_back(index);
+      system.dependencyCount++;
+    }
+  }
+  systems.push_back(std::move(system));
+  remaining.reset(new std::atomic<int>[systems.size()]);
+}
+
+void Scheduler::run(World &world)
+{
+  for (size_t i = 0; i < systems.size(); i++)
+    remaining[i].store(systems[i].dependencyCount, std::memory_order_relaxed);
+
+  JobHandle handle = std::make_shared<JobCounter>();
+  // finished system starts dependents whose last dependency it was,
+  // they are added before its own job is counted as done, so wait_job can't return early
+  std::function<void(int)> launch = [&](int index)
+  {
+    add_job(handle, [&, index]()
+    {
+      const System &system = systems[index];
+      {
+        ProfileScope scope(system.name);
+        system.run(world);
+      }
+      for (int dependent : system.dependents)
+        if (remaining[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1)
+          launch(dependent);
+    });
+  };
+  for (size_t i = 0; i < systems.size(); i++)
+    if (systems[i].dependencyCount == 0)
+      launch(i);
+  wait_job(handle);
+}
+}
@@ -0,0 +1,281 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "frame_allocator.h"
+
+// Entities with the same set of components share an archetype. Archetype stores them in
+// fixed size chunks, every chunk holds one contiguous array per component (SoA),
+// so queries walk plain arrays instead of chasing pointers.
+// Structural changes (create, destroy, add, remove) are main thread only and not allowed while systems run.
+namespace ecs
+{
+constexpr int MaxComponents = 64;
+using ComponentMask = uint64_t;
+
+struct ComponentInfo
+{
+  size_t size;
+  size_t alignment;
+  void (*move)(void *destination, void *source); // move constructs destination and destroys source
+  void (*destroy)(void *data);
+};
+
+int register_component(const ComponentInfo &info);
+const ComponentInfo &component_info(int id);
+
+// any type gets an id on first use, systems also use ids of non component types to declare shared data access
+template<typename T>
+int component_id()
+{
+  // const T is a different instantiation, it must share the id of T
+  if constexpr (std::is_const_v<T>)
+    return component_id<std::remove_const_t<T>>();
+  else
+  {
+    static const int id = register_component({sizeof(T), alignof(T),
+      [](void *destination, void *source) { new (destination) T(std::move(*(T *)source)); ((T *)source)->~T(); },
+      [](void *data) { ((T *)data)->~T(); }});
+    return id;
+  }
+}
+
+template<typename... Ts>
+ComponentMask component_mask()
+{
+  return (ComponentMask(0) | ... | (ComponentMask(1) << component_id<Ts>()));
+}
+
+struct Entity
+{
+  uint32_t index = ~0u;
+  uint32_t generation = 0;
+
+  bool operator==(const Entity &other) const { return index == other.index && generation == other.generation; }
+  bool operator!=(const Entity &other) const { return !(*this == other); }
+};
+
+class Archetype
+{
+public:
+  static constexpr size_t ChunkSize = 16 << 10;
+
+  struct Chunk
+  {
+    std::unique_ptr<char[]> data;
+    int count = 0;
+  };
+
+  ComponentMask mask = 0;
+  std::vector<int> components; // ids in increasing order
+  std::vector<size_t> columnOffsets; // offset of component array inside a chunk
+  int8_t columnIndex[MaxComponents]; // -1 when archetype has no such component
+  int capacity = 0; // entities per chunk
+  std::vector<Chunk> chunks;
+
+  explicit Archetype(ComponentMask component_mask);
+
+  bool has(int component) const { return columnIndex[component] >= 0; }
+  Entity *entities(const Chunk &chunk) const { return (Entity *)chunk.data.get(); }
+  void *column(const Chunk &chunk, int column) const { return chunk.data.get() + columnOffsets[column]; }
+  void *component(const Chunk &chunk, int column, int row) const
+  {
+    return (char *)this->column(chunk, column) + row * component_info(components[column]).size;
+  }
+  template<typename T>
+  T *column(const Chunk &chunk) const { return (T *)column(chunk, columnIndex[component_id<T>()]); }
+};
+
+class World
+{
+  struct EntityRecord
+  {
+    Archetype *archetype = nullptr;
+    int chunk = 0;
+    int row = 0;
+    uint32_t generation = 0;
+  };
+  std::vector<EntityRecord> records;
+  std::vector<uint32_t> freeIndices;
+  std::unordered_map<ComponentMask, std::unique_ptr<Archetype>> archetypes;
+  std::vector<Archetype *> archetypeList; // creation order, queries iterate it
+  int entityCount = 0;
+
+  Archetype &get_archetype(ComponentMask mask);
+  Entity allocate_entity();
+  // finds free row for entity, components are constructed by the caller
+  EntityRecord &place(Entity entity, Archetype &archetype);
+  // fills the hole with the last entity of archetype, components of the row must be destroyed or moved out
+  void remove_row(Archetype &archetype, int chunk, int row);
+  void destroy_row(Archetype &archetype, int chunk, int row);
+  // moves entity to archetype of new_mask, components missing in it are destroyed
+  EntityRecord &change_archetype(Entity entity, ComponentMask new_mask);
+
+  template<typename... Ts>
+  void collect_chunks(FrameVector<std::pair<Archetype *, int>> &chunks) const
+  {
+    const ComponentMask mask = component_mask<Ts...>();
+    int count = 0;
+    for (Archetype *archetype : archetypeList)
+      if ((archetype->mask & mask) == mask)
+        count += archetype->chunks.size();
+    chunks.reserve(count);
+    for (Archetype *archetype : archetypeList)
+      if ((archetype->mask & mask) == mask)
+        for (size_t i = 0; i < archetype->chunks.size(); i++)
+          chunks.emplace_back(archetype, (int)i);
+  }
+
+public:
+  World() = default;
+  World(const World &) = delete;
+  World &operator=(const World &) = delete;
+  ~World();
+
+  template<typename... Ts>
+  Entity create(Ts &&... components)
+  {
+    Entity entity = allocate_entity();
+    EntityRecord &record = place(entity, get_archetype(component_mask<std::decay_t<Ts>...>()));
+    Archetype &archetype = *record.archetype;
+    const Archetype::Chunk &chunk = archetype.chunks[record.chunk];
+    (new (archetype.column<std::decay_t<Ts>>(chunk) + record.row) std::decay_t<Ts>(std::forward<Ts>(components)), ...);
+    return entity;
+  }
+  void destroy(Entity entity);
+  bool alive(Entity entity) const
+  {
+    return entity.index < records.size() && records[entity.index].generation == entity.generation && records[entity.index].archetype;
+  }
+  int size() const { return entityCount; }
+
+  // nullptr when entity is dead or has no such component, pointer is valid until next structural change
+  template<typename T>
+  T *get(Entity entity) const
+  {
+    if (!alive(entity))
+      return nullptr;
+    const EntityRecord &record = records[entity.index];
+    if (!record.archetype->has(component_id<T>()))
+      return nullptr;
+    return record.archetype->column<T>(record.archetype->chunks[record.chunk]) + record.row;
+  }
+
+  // replaces component when entity already has it
+  template<typename T>
+  void add(Entity entity, T &&component)
+  {
+    using C = std::decay_t<T>;
+    if (C *existing = get<C>(entity))
+    {
+      *existing = std::forward<T>(component);
+      return;
+    }
+    if (!alive(entity))
+      return;
+    EntityRecord &record = change_archetype(entity, records[entity.index].archetype->mask | component_mask<C>());
+    new (record.archetype->column<C>(record.archetype->chunks[record.chunk]) + record.row) C(std::forward<T>(component));
+  }
+
+  template<typename T>
+  void remove(Entity entity)
+  {
+    if (get<T>(entity))
+      change_archetype(entity, records[entity.index].archetype->mask & ~component_mask<T>());
+  }
+
+  // f(int count, int first_index, Ts *...arrays) for every chunk which has all Ts,
+  // first_index counts matched entities in iteration order, it is stable until the next structural change
+  template<typename... Ts, typename F>
+  void for_each_chunk(F &&f) const
+  {
+    int firstIndex = 0;
+    const ComponentMask mask = component_mask<Ts...>();
+    for (Archetype *archetype : archetypeList)
+      if ((archetype->mask & mask) == mask)
+        for (const Archetype::Chunk &chunk : archetype->chunks)
+        {
+          f(chunk.count, firstIndex, archetype->template column<Ts>(chunk)...);
+          firstIndex += chunk.count;
+        }
+  }
+
+  // the same as for_each_chunk, chunks are spread over the job system
+  template<typename... Ts, typename F>
+  void parallel_for_each_chunk(F &&f) const
+  {
+    FrameVector<std::pair<Archetype *, int>> chunks;
+    collect_chunks<Ts...>(chunks);
+    FrameVector<int> firstIndices(chunks.size());
+    int firstIndex = 0;
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+      firstIndices[i] = firstIndex;
+      firstIndex += chunks[i].first->chunks[chunks[i].second].count;
+    }
+    parallel_for_chunks((int)chunks.size(), [&](int i)
+    {
+      const Archetype &archetype = *chunks[i].first;
+      const Archetype::Chunk &chunk = archetype.chunks[chunks[i].second];
+      f(chunk.count, firstIndices[i], archetype.template column<Ts>(chunk)...);
+    });
+  }
+
+  // f(Ts &...) for every entity which has all Ts
+  template<typename... Ts, typename F>
+  void each(F &&f) const
+  {
+    for_each_chunk<Ts...>([&](int count, int, Ts *... arrays)
+    {
+      for (int i = 0; i < count; i++)
+        f(arrays[i]...);
+    });
+  }
+
+  template<typename... Ts>
+  int count() const
+  {
+    int result = 0;
+    const ComponentMask mask = component_mask<Ts...>();
+    for (Archetype *archetype : archetypeList)
+      if ((archetype->mask & mask) == mask)
+        for (const Archetype::Chunk &chunk : archetype->chunks)
+          result += chunk.count;
+    return result;
+  }
+
+private:
+  static void parallel_for_chunks(int count, const std::function<void(int)> &body);
+};
+
+// Systems declare components (or any other types of shared data) they read and write.
+// A system waits for earlier registered systems whose access conflicts with its own,
+// systems without conflicts run in parallel on the job system.
+class Scheduler
+{
+  struct System
+  {
+    const char *name;
+    ComponentMask reads, writes;
+    std::function<void(World &)> run;
+    std::vector<int> dependents;
+    int dependencyCount = 0;
+  };
+  std::vector<System> systems;
+  std::unique_ptr<std::atomic<int>[]> remaining;
+
+public:
+  // name must be a string literal, it labels the profiler scope
+  void add(const char *name, ComponentMask reads, ComponentMask writes, std::function<void(World &)> &&run);
+  // main thread, returns when every system is finished
+  void run(World &world);
+};
+}
@@ -0,0 +1,118 @@
+#include "file_watcher.h"
+#include <filesystem>
+#include <map>
+#include "log.h"
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+std::string normalize_path(const std::string &path)
+{
+  return std::filesystem::path(path).lexically_normal().generic_string();
+}
+
+#ifdef __linux__
+
+static int inotifyFd = -1;
+static std::map<int, std::string> watchDirectories;
+
+void add_watch_directory(const char *directory)
+{
+  if (inotifyFd < 0)
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotifyFd < 0)
+  {
+    debug_error("inotify_init failed, shader hot reload is disabled");
+    return;
+  }
+  int wd = inotify_add_watch(inotifyFd, directory, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+  if (wd < 0)
+    debug_error("can't watch directory %s", directory);
+  else
+    watchDirectories[wd] = normalize_path(directory);
+}
+
+void close_file_watcher()
+{
+  if (inotifyFd >= 0)
+    close(inotifyFd);
+  inotifyFd = -1;
+  watchDirectories.clear();
+}
+
+std::vector<std::string> poll_changed_files()
+{
+  std::vector<std::string> changed;
+  if (inotifyFd < 0)
+    return changed;
+  alignas(inotify_event) char buffer[4096];
+  while (true)
+  {
+    ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+    if (length <= 0)
+      break;
+    for (char *ptr = buffer; ptr < buffer + length;)
+    {
+      const inotify_event *event = (const inotify_event *)ptr;
+      auto it = watchDirectories.find(event->wd);
+      if (event->len > 0 && it != watchDirectories.end())
+      {
+        std::string path = it->second + "/" + event->name;
+        bool duplicate = false;
+        for (const std::string &p : changed)
+          duplicate |= p == path;
+        if (!duplicate)
+          changed.push_back(path);
+      }
+      ptr += sizeof(inotify_event) + event->len;
+    }
+  }
+  return changed;
+}
+
+#else
+
+static std::vector<std::string> watchDirectories;
+static std::map<std::string, std::filesystem::file_time_type> writeTimes;
+
+static void scan_directory(const std::string &directory, std::vector<std::string> *changed)
+{
+  std::error_code error;
+  for (const auto &entry : std::filesystem::directory_iterator(directory, error))
+  {
+    if (!entry.is_regular_file(error))
+      continue;
+    std::string path = normalize_path(entry.path().string());
+    auto time = entry.last_write_time(error);
+    auto it = writeTimes.find(path);
+    if (it == writeTimes.end() || it->second != time)
+    {
+      if (changed && it != writeTimes.end())
+        changed->push_back(path);
+      writeTimes[path] = time;
+    }
+  }
+}
+
+void add_watch_directory(const char *directory)
+{
+  watchDirectories.push_back(normalize_path(directory));
+  scan_directory(watchDirectories.back(), nullptr);
+}
+
+void close_file_watcher()
+{
+  watchDirectories.clear();
+  writeTimes.clear();
+}
+
+std::vector<std::string> poll_changed_files()
+{
+  std::vector<std::string> changed;
+  for (const std::string &directory : watchDirectories)
+    scan_directory(directory, &changed);
+  return changed;
+}
+
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Reports files modified in watched directories. Uses inotify on linux,
+// elsewhere compares modification times on every poll.
+void add_watch_directory(const char *directory);
+void close_file_watcher();
+
+// paths are lexically normalized and use '/' separators
+std::vector<std::string> poll_changed_files();
+
+std::string normalize_path(const std::string &path);
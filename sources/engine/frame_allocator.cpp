@@ -0,0 +1,107 @@
+#include "frame_allocator.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+void *LinearArena::allocate(size_t size, size_t alignment)
+{
+  while (true)
+  {
+    if (currentBlock < blocks.size())
+    {
+      Block &block = blocks[currentBlock];
+      uintptr_t base = (uintptr_t)block.data.get();
+      uintptr_t aligned = (base + blockOffset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+      if (aligned + size <= base + block.size)
+      {
+        blockOffset = aligned + size - base;
+        usedBytes += size;
+        return (void *)aligned;
+      }
+      if (blockOffset != 0)
+      {
+        currentBlock++;
+        blockOffset = 0;
+        continue;
+      }
+    }
+    // no blocks left or the empty one is too small for this allocation
+    size_t newBlockSize = std::max(blockSize, size + alignment);
+    blocks.insert(blocks.begin() + currentBlock, Block{std::unique_ptr<char[]>(new char[newBlockSize]), newBlockSize});
+  }
+}
+
+void LinearArena::reset()
+{
+#ifndef NDEBUG
+  for (size_t i = 0; i < blocks.size() && i <= currentBlock; i++)
+    memset(blocks[i].data.get(), 0xcd, i == currentBlock ? blockOffset : blocks[i].size);
+#endif
+  currentBlock = 0;
+  blockOffset = 0;
+  usedBytes = 0;
+}
+
+size_t LinearArena::capacity() const
+{
+  size_t result = 0;
+  for (const Block &block : blocks)
+    result += block.size;
+  return result;
+}
+
+
+struct ThreadFrameArena
+{
+  LinearArena arenas[2];
+  ThreadFrameArena *next = nullptr;
+};
+
+// every thread registers its arenas once, begin_frame_allocator walks this list
+static std::atomic<ThreadFrameArena *> threadArenas{nullptr};
+static std::atomic<int> frameBuffer{0};
+static FrameAllocatorStats stats;
+
+static ThreadFrameArena &thread_arena()
+{
+  thread_local ThreadFrameArena *arena = nullptr;
+  if (!arena)
+  {
+    arena = new ThreadFrameArena();
+    arena->next = threadArenas.load(std::memory_order_relaxed);
+    while (!threadArenas.compare_exchange_weak(arena->next, arena, std::memory_order_release, std::memory_order_relaxed))
+      ;
+  }
+  return *arena;
+}
+
+void *frame_alloc(size_t size, size_t alignment)
+{
+  return thread_arena().arenas[frameBuffer.load(std::memory_order_relaxed)].allocate(size, alignment);
+}
+
+void begin_frame_allocator()
+{
+  int finished = frameBuffer.load(std::memory_order_relaxed);
+  int next = finished ^ 1;
+  size_t used = 0, capacity = 0;
+  int threads = 0;
+  for (ThreadFrameArena *arena = threadArenas.load(std::memory_order_acquire); arena; arena = arena->next)
+  {
+    used += arena->arenas[finished].used_bytes();
+    arena->arenas[next].reset();
+    capacity += arena->arenas[0].capacity() + arena->arenas[1].capacity();
+    threads++;
+  }
+  stats.lastFrameBytes = used;
+  stats.peakFrameBytes = std::max(stats.peakFrameBytes, used);
+  stats.capacityBytes = capacity;
+  stats.threadCount = threads;
+  frameBuffer.store(next, std::memory_order_relaxed);
+}
+
+FrameAllocatorStats frame_allocator_stats()
+{
+  return stats;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Bump allocator over a list of blocks. Reset keeps the blocks, so after warm up
+// a frame allocates nothing from the heap. Blocks grow only when an allocation doesn't fit.
+class LinearArena
+{
+  struct Block
+  {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+  std::vector<Block> blocks;
+  size_t blockSize;
+  size_t currentBlock = 0;
+  size_t blockOffset = 0;
+  size_t usedBytes = 0;
+
+public:
+  static constexpr size_t DefaultBlockSize = 1 << 20;
+
+  explicit LinearArena(size_t block_size = DefaultBlockSize) : blockSize(block_size) {}
+  LinearArena(const LinearArena &) = delete;
+  LinearArena &operator=(const LinearArena &) = delete;
+
+  void *allocate(size_t size, size_t alignment);
+  // pattern fills used memory in debug builds, reads of stale data show up as 0xcd
+  void reset();
+
+  size_t used_bytes() const { return usedBytes; }
+  size_t capacity() const;
+};
+
+// Frame memory is double buffered: allocation made in frame N lives until the start of frame N + 2,
+// so the render thread may read data of the previous frame. Every thread allocates from its own arena.
+// Game and job threads only, the render thread runs concurrently with begin_frame_allocator.
+void *frame_alloc(size_t size, size_t alignment = 16);
+
+template<typename T>
+T *frame_alloc(size_t count)
+{
+  return (T *)frame_alloc(sizeof(T) * count, alignof(T) < 16 ? 16 : alignof(T));
+}
+
+// main thread at frame start while no jobs are running, resets memory of frame N - 2
+void begin_frame_allocator();
+
+struct FrameAllocatorStats
+{
+  size_t lastFrameBytes = 0; // all threads
+  size_t peakFrameBytes = 0;
+  size_t capacityBytes = 0; // blocks reserved by all threads in both buffers
+  int threadCount = 0;
+};
+FrameAllocatorStats frame_allocator_stats();
+
+// deallocate does nothing, memory returns with the frame
+template<typename T>
+struct FrameAllocator
+{
+  using value_type = T;
+
+  FrameAllocator() = default;
+  template<typename U>
+  FrameAllocator(const FrameAllocator<U> &) {}
+
+  T *allocate(size_t count) { return frame_alloc<T>(count); }
+  void deallocate(T *, size_t) {}
+
+  template<typename U>
+  bool operator==(const FrameAllocator<U> &) const { return true; }
+  template<typename U>
+  bool operator!=(const FrameAllocator<U> &) const { return false; }
+};
+
+template<typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
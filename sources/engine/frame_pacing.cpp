@@ -0,0 +1,130 @@
+#include "frame_pacing.h"
+#include <algorithm>
+#include <thread>
+#include <glad/glad.h>
+#include <imgui/imgui.h>
+#include <render/ring_buffer.h>
+#include "profiler.h"
+#include "frame_allocator.h"
+
+struct FrameFence
+{
+  GLsync fence = nullptr;
+  uint64_t inputTime = 0;
+};
+
+static FramePacingSettings settings;
+static FrameFence frames[RingBuffer::RegionCount];
+static int frameIndex = 0;
+static float latencyMs = 0.f;
+static uint64_t nextFrameTime = 0;
+
+FramePacingSettings &frame_pacing_settings()
+{
+  return settings;
+}
+
+static void retire_frame(FrameFence &frame)
+{
+  float latency = (profiler_time() - frame.inputTime) * 1e-6f;
+  // exponential average, a single frame value is too noisy to read
+  latencyMs = latencyMs == 0.f ? latency : latencyMs * 0.95f + latency * 0.05f;
+  glDeleteSync(frame.fence);
+  frame.fence = nullptr;
+}
+
+static bool wait_fence(FrameFence &frame, uint64_t timeout)
+{
+  if (!frame.fence)
+    return true;
+  GLenum result = glClientWaitSync(frame.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+  if (result == GL_TIMEOUT_EXPIRED)
+    return false;
+  retire_frame(frame);
+  return true;
+}
+
+// frames finished on their own are retired without blocking, it keeps latency measure fresh
+static void retire_finished_frames()
+{
+  for (FrameFence &frame : frames)
+    wait_fence(frame, 0);
+}
+
+void wait_frame_in_flight()
+{
+  settings.maxFramesInFlight = std::clamp(settings.maxFramesInFlight, 1, RingBuffer::RegionCount);
+  retire_finished_frames();
+
+  // the oldest frame that still may be in flight is maxFramesInFlight frames behind
+  const int count = RingBuffer::RegionCount;
+  FrameFence &oldest = frames[(frameIndex - settings.maxFramesInFlight + count) % count];
+  while (!wait_fence(oldest, 1000000))
+    ;
+}
+
+void end_frame_pacing(uint64_t input_time)
+{
+  FrameFence &frame = frames[frameIndex];
+  if (frame.fence)
+    glDeleteSync(frame.fence);
+  frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  frame.inputTime = input_time;
+  frameIndex = (frameIndex + 1) % RingBuffer::RegionCount;
+  // swap usually blocks until an older frame is presented, it is likely done by now
+  retire_finished_frames();
+}
+
+void limit_frame_rate()
+{
+  if (settings.targetFrameRate <= 0.f)
+  {
+    nextFrameTime = 0;
+    return;
+  }
+  const uint64_t period = 1e9 / settings.targetFrameRate;
+  uint64_t now = profiler_time();
+  // restart the schedule after a hitch instead of rushing to catch up
+  if (nextFrameTime == 0 || now > nextFrameTime + period)
+    nextFrameTime = now;
+  nextFrameTime += period;
+
+  PROFILE_SCOPE("frame_limiter");
+  // sleep is coarse, the last millisecond is spent yielding
+  const uint64_t spinTime = 1000000;
+  if (nextFrameTime > now + spinTime)
+    std::this_thread::sleep_for(std::chrono::nanoseconds(nextFrameTime - now - spinTime));
+  while (profiler_time() < nextFrameTime)
+    std::this_thread::yield();
+}
+
+void close_frame_pacing()
+{
+  for (FrameFence &frame : frames)
+  {
+    if (frame.fence)
+      glDeleteSync(frame.fence);
+    frame.fence = nullptr;
+  }
+}
+
+float get_input_latency_ms()
+{
+  return latencyMs;
+}
+
+void frame_pacing_menu()
+{
+  if (ImGui::BeginMenu("Frame"))
+  {
+    ImGui::SliderInt("frames in flight", &settings.maxFramesInFlight, 1, RingBuffer::RegionCount);
+    ImGui::SliderFloat("fps limit", &settings.targetFrameRate, 0.f, 240.f, settings.targetFrameRate > 0.f ? "%.0f" : "off");
+    int vsync = (int)settings.vsync;
+    if (ImGui::Combo("vsync", &vsync, "off\0on\0adaptive\0"))
+      settings.vsync = (VSyncMode)vsync;
+    ImGui::Text("input latency %.1f ms", latencyMs);
+    FrameAllocatorStats arena = frame_allocator_stats();
+    ImGui::Text("frame arena %.1f KB, peak %.1f KB", arena.lastFrameBytes / 1024.f, arena.peakFrameBytes / 1024.f);
+    ImGui::EndMenu();
+  }
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+
+enum class VSyncMode
+{
+  Off,
+  On,
+  Adaptive // swaps late frames immediately, falls back to On if the driver can't
+};
+
+struct FramePacingSettings
+{
+  // bounded by RingBuffer::RegionCount, the dynamic buffer can't hold more frames
+  int maxFramesInFlight = 2;
+  float targetFrameRate = 0.f; // 0 disables limiter
+  VSyncMode vsync = VSyncMode::Off; // uncapped by default, --vsync or the Frame menu turn it on
+};
+
+FramePacingSettings &frame_pacing_settings();
+
+// GL thread, blocks until the GPU has finished frame (current - maxFramesInFlight), call before touching frame GPU data
+void wait_frame_in_flight();
+// GL thread, call right after swap, input_time is when input of this frame was sampled
+void end_frame_pacing(uint64_t input_time);
+// game thread, sleeps until next frame deadline when targetFrameRate is set
+void limit_frame_rate();
+void close_frame_pacing();
+
+// input sample to GPU completion of the frame, observed by CPU so it is an upper bound
+float get_input_latency_ms();
+void frame_pacing_menu();
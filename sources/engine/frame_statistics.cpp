@@ -0,0 +1,69 @@
+#include "frame_statistics.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "log.h"
+
+struct TimerSummary
+{
+  float min, avg, p50, p95, p99, max;
+};
+
+static TimerSummary summarize(std::vector<float> samples)
+{
+  if (samples.empty())
+    return {};
+  std::sort(samples.begin(), samples.end());
+  auto percentile = [&](float p) { return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))]; };
+  double sum = 0.0;
+  for (float sample : samples)
+    sum += sample;
+  return {samples.front(), (float)(sum / samples.size()), percentile(0.5f), percentile(0.95f), percentile(0.99f), samples.back()};
+}
+
+void FrameStatistics::add(const char *name, float ms)
+{
+  for (Timer &timer : timers)
+    if (timer.name == name || !strcmp(timer.name, name))
+    {
+      timer.samples.push_back(ms);
+      return;
+    }
+  timers.push_back({name, {ms}});
+}
+
+void FrameStatistics::print() const
+{
+  debug_log("%-20s %7s %8s %8s %8s %8s %8s %8s", "timer, ms", "frames", "min", "avg", "p50", "p95", "p99", "max");
+  for (const Timer &timer : timers)
+  {
+    TimerSummary s = summarize(timer.samples);
+    debug_log("%-20s %7zu %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f", timer.name, timer.samples.size(), s.min, s.avg, s.p50, s.p95, s.p99, s.max);
+  }
+}
+
+bool FrameStatistics::save_json(const char *path) const
+{
+  FILE *file = fopen(path, "w");
+  if (!file)
+  {
+    debug_error("can't open %s to save frame statistics", path);
+    return false;
+  }
+  fprintf(file, "{\n");
+  for (size_t i = 0; i < timers.size(); i++)
+  {
+    TimerSummary s = summarize(timers[i].samples);
+    fprintf(file, "  \"%s\": {\"frames\": %zu, \"min\": %.4f, \"avg\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n",
+      timers[i].name, timers[i].samples.size(), s.min, s.avg, s.p50, s.p95, s.p99, s.max, i + 1 < timers.size() ? "," : "");
+  }
+  fprintf(file, "}\n");
+  fclose(file);
+  return true;
+}
+
+FrameStatistics &frame_statistics()
+{
+  static FrameStatistics statistics;
+  return statistics;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <vector>
+
+// Per frame samples of named timers, summarized at the end of benchmark runs.
+// Any system can add own timers, samples are kept for the whole run.
+class FrameStatistics
+{
+  struct Timer
+  {
+    const char *name;
+    std::vector<float> samples; // ms
+  };
+  std::vector<Timer> timers;
+
+public:
+  // main thread only, name must be a string literal
+  void add(const char *name, float ms);
+  bool empty() const { return timers.empty(); }
+
+  // min, avg, percentiles and max of every timer to the log
+  void print() const;
+  bool save_json(const char *path) const;
+};
+
+FrameStatistics &frame_statistics();
@@ -0,0 +1,126 @@
+#include "headless_context.h"
+#include "log.h"
+
+#if defined(__linux__)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstring>
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static EGLSurface surface = EGL_NO_SURFACE;
+
+static EGLDisplay get_display()
+{
+  // device platform doesn't need X11 or wayland, default display is a fallback
+  auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  if (getPlatformDisplay && extensions && strstr(extensions, "EGL_MESA_platform_surfaceless"))
+  {
+    EGLDisplay surfaceless = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (surfaceless != EGL_NO_DISPLAY)
+      return surfaceless;
+  }
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool create_headless_context(int width, int height)
+{
+  display = get_display();
+  EGLint major, minor;
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+  {
+    debug_error("failed to initialize EGL display");
+    return false;
+  }
+  if (!eglBindAPI(EGL_OPENGL_API))
+  {
+    debug_error("EGL %d.%d doesn't support desktop OpenGL", major, minor);
+    return false;
+  }
+
+  const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+  bool surfaceless = extensions && strstr(extensions, "EGL_KHR_surfaceless_context");
+  const EGLint configAttributes[] = {
+    EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_DEPTH_SIZE, 24,
+    EGL_NONE};
+  EGLConfig config = nullptr;
+  EGLint configCount = 0;
+  if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+  {
+    // surfaceless contexts may be created without config
+    if (!surfaceless)
+    {
+      debug_error("no suitable EGL config for pbuffer");
+      return false;
+    }
+    config = nullptr;
+  }
+
+  const EGLint contextAttributes[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 4,
+    EGL_CONTEXT_MINOR_VERSION, 5,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE};
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+  if (context == EGL_NO_CONTEXT)
+  {
+    debug_error("failed to create EGL GL 4.5 core context, error 0x%x", eglGetError());
+    return false;
+  }
+  if (!surfaceless)
+  {
+    const EGLint pbufferAttributes[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+    surface = eglCreatePbufferSurface(display, config, pbufferAttributes);
+  }
+  make_headless_context_current(true);
+  debug_log("headless EGL %d.%d context, %s", major, minor, surfaceless ? "surfaceless" : "pbuffer");
+  return true;
+}
+
+void destroy_headless_context()
+{
+  if (display == EGL_NO_DISPLAY)
+    return;
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (surface != EGL_NO_SURFACE)
+    eglDestroySurface(display, surface);
+  if (context != EGL_NO_CONTEXT)
+    eglDestroyContext(display, context);
+  eglTerminate(display);
+  display = EGL_NO_DISPLAY;
+  context = EGL_NO_CONTEXT;
+  surface = EGL_NO_SURFACE;
+}
+
+void make_headless_context_current(bool attach)
+{
+  if (attach)
+    eglMakeCurrent(display, surface, surface, context);
+  else
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+void *headless_get_proc_address(const char *name)
+{
+  return (void *)eglGetProcAddress(name);
+}
+
+#else
+
+bool create_headless_context(int, int)
+{
+  return false;
+}
+
+void destroy_headless_context() {}
+void make_headless_context_current(bool) {}
+
+void *headless_get_proc_address(const char *)
+{
+  return nullptr;
+}
+
+#endif
@@ -0,0 +1,10 @@
+#pragma once
+
+// Offscreen GL 4.5 core context without window and display server.
+// EGL surfaceless context on Linux (works with Mesa llvmpipe), pbuffer if surfaceless isn't supported.
+// Returns false where EGL is unavailable, caller falls back to a hidden window.
+bool create_headless_context(int width, int height);
+void destroy_headless_context();
+// attaches context to calling thread or detaches it
+void make_headless_context_current(bool attach);
+void *headless_get_proc_address(const char *name);
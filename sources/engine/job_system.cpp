@@ -0,0 +1,141 @@
+#include "job_system.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+#include <vector>
+
+struct Job
+{
+  std::function<void()> function;
+  JobHandle handle;
+};
+
+static std::mutex queueMutex;
+static std::condition_variable queueCondition;
+static std::deque<Job> jobQueue;
+static std::vector<std::thread> workers;
+static bool stopWorkers = false;
+static thread_local int threadIndex = 0;
+
+static bool pop_job(Job &job)
+{
+  if (jobQueue.empty())
+    return false;
+  job = std::move(jobQueue.front());
+  jobQueue.pop_front();
+  return true;
+}
+
+static void execute(Job &job)
+{
+  job.function();
+  job.handle->pending.fetch_sub(1, std::memory_order_release);
+}
+
+static void worker_loop(int index)
+{
+  threadIndex = index;
+  while (true)
+  {
+    Job job;
+    {
+      std::unique_lock lock(queueMutex);
+      queueCondition.wait(lock, [] { return stopWorkers || !jobQueue.empty(); });
+      if (!pop_job(job))
+        return;
+    }
+    execute(job);
+  }
+}
+
+void init_job_system(int worker_count)
+{
+  if (worker_count < 0)
+    worker_count = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+  stopWorkers = false;
+  for (int i = 0; i < worker_count; i++)
+    workers.emplace_back(worker_loop, i + 1);
+}
+
+void close_job_system()
+{
+  {
+    std::unique_lock lock(queueMutex);
+    stopWorkers = true;
+  }
+  queueCondition.notify_all();
+  for (std::thread &worker : workers)
+    worker.join();
+  workers.clear();
+}
+
+int get_worker_count()
+{
+  return (int)workers.size();
+}
+
+int get_job_thread_index()
+{
+  return threadIndex;
+}
+
+void add_job(const JobHandle &handle, std::function<void()> &&job)
+{
+  handle->pending.fetch_add(1, std::memory_order_relaxed);
+  if (workers.empty())
+  {
+    Job immediate{std::move(job), handle};
+    execute(immediate);
+    return;
+  }
+  {
+    std::unique_lock lock(queueMutex);
+    jobQueue.push_back({std::move(job), handle});
+  }
+  queueCondition.notify_one();
+}
+
+JobHandle add_job(std::function<void()> &&job)
+{
+  JobHandle handle = std::make_shared<JobCounter>();
+  add_job(handle, std::move(job));
+  return handle;
+}
+
+void wait_job(const JobHandle &handle)
+{
+  if (!handle)
+    return;
+  while (handle->pending.load(std::memory_order_acquire) > 0)
+  {
+    Job job;
+    bool found;
+    {
+      std::unique_lock lock(queueMutex);
+      found = pop_job(job);
+    }
+    if (found)
+      execute(job);
+    else
+      std::this_thread::yield();
+  }
+}
+
+void parallel_for(int count, int batch_size, const std::function<void(int, int)> &body)
+{
+  if (count <= batch_size || workers.empty())
+  {
+    body(0, count);
+    return;
+  }
+  JobHandle handle = std::make_shared<JobCounter>();
+  for (int begin = batch_size; begin < count; begin += batch_size)
+  {
+    int end = std::min(begin + batch_size, count);
+    add_job(handle, [&body, begin, end] { body(begin, end); });
+  }
+  body(0, batch_size);
+  wait_job(handle);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <atomic>
+
+struct JobCounter
+{
+  std::atomic<int> pending{0};
+};
+
+using JobHandle = std::shared_ptr<JobCounter>;
+
+void init_job_system(int worker_count = -1);
+void close_job_system();
+
+int get_worker_count();
+// 0 for the main thread, 1..get_worker_count() for workers
+int get_job_thread_index();
+
+JobHandle add_job(std::function<void()> &&job);
+void add_job(const JobHandle &handle, std::function<void()> &&job);
+// executes other jobs while waiting
+void wait_job(const JobHandle &handle);
+
+// calls body(begin, end) for batches of [0, count)
+void parallel_for(int count, int batch_size, const std::function<void(int, int)> &body);
@@ -1,67 +1,448 @@
 #include "log.h"
 #include <imgui/imgui.h>
-#include <imgui/imgui_internal.h>
-#include "application.h"
-#include <list>
-#include <stdarg.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
 #include <mutex>
+#include <thread>
+#include <vector>
+#include "profiler.h"
 
-const int MaxQueueSize = 32;
-struct Message
+// record is followed by its arguments and copies of string arguments, size 0 marks padding till the ring end
+struct LogRecord
 {
-  std::string message;
-  bool status;
+  uint32_t size;
+  LogLevel level;
+  uint8_t argCount;
+  uint64_t time;
+  const char *format;
 };
-static std::mutex m;
-std::list<Message> &messages_list()
+
+struct ThreadLogBuffer
+{
+  static constexpr size_t Capacity = 64 << 10;
+  alignas(8) char data[Capacity];
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> tail{0};
+  std::atomic<uint32_t> dropped{0};
+  ThreadLogBuffer *next = nullptr;
+};
+
+struct FormattedMessage
 {
-  static std::list<Message> q;
-  return q;
+  uint64_t time;
+  LogLevel level;
+  std::string text;
+};
+
+struct HistoryEntry
+{
+  char text[256];
+  bool error;
+};
+
+constexpr size_t MaxStringLength = 4096;
+constexpr int HistorySize = 64;
+
+static std::atomic<ThreadLogBuffer *> threadBuffers{nullptr};
+static std::once_flag logThreadStarted;
+static std::atomic<bool> logClosed{false};
+static std::thread logThread;
+static std::mutex logMutex;
+static std::condition_variable logCondition;
+static std::condition_variable flushCondition;
+static std::atomic<bool> wakeRequested{false};
+static bool stopLogThread = false;
+static uint64_t flushRequested = 0, flushDone = 0;
+static FILE *logFile = nullptr;
+static std::mutex outputMutex; // log thread and synchronous messages after close_log
+
+static std::mutex historyMutex;
+static HistoryEntry history[HistorySize];
+static int historyCount = 0, historyHead = 0;
+
+static void log_thread_loop();
+
+// messages of threads which are still running at exit aren't lost when close_log wasn't called
+struct LogShutdown
+{
+  ~LogShutdown() { close_log(); }
+};
+static LogShutdown logShutdown;
+
+static uint64_t log_start_time()
+{
+  static const uint64_t start = profiler_time();
+  return start;
 }
 
-constexpr int messageLen = 1024, timeLen = 20;
-char messageBuf[messageLen], timeBuf[timeLen];
+static size_t align8(size_t size)
+{
+  return (size + 7) & ~(size_t)7;
+}
+
+template<typename T>
+static void append_formatted(std::string &out, const char *spec, T value)
+{
+  char buffer[256];
+  int size = snprintf(buffer, sizeof(buffer), spec, value);
+  if (size < 0)
+    return;
+  if (size < (int)sizeof(buffer))
+  {
+    out.append(buffer, size);
+    return;
+  }
+  size_t offset = out.size();
+  out.resize(offset + size + 1);
+  snprintf(&out[offset], size + 1, spec, value);
+  out.resize(offset + size);
+}
 
-void debug_common(const char *fmt, int status, va_list args)
+static long long as_int(const LogArg &arg)
 {
-  vsnprintf(messageBuf, messageLen, fmt, args);
-  snprintf(timeBuf, timeLen, "[%.2f] ", get_time());
-  std::unique_lock read_write_lock(m);
-  auto &q = messages_list();
-  if (q.size() >= MaxQueueSize)
+  switch (arg.type)
   {
-    q.pop_front();
+    case LogArg::Unsigned: return (long long)arg.u;
+    case LogArg::Double: return (long long)arg.d;
+    case LogArg::Pointer: return (long long)(intptr_t)arg.p;
+    default: return arg.i;
   }
+}
 
-  q.push_back({std::string(timeBuf) + std::string(messageBuf), (bool)status});
+static double as_double(const LogArg &arg)
+{
+  switch (arg.type)
+  {
+    case LogArg::Int: return (double)arg.i;
+    case LogArg::Unsigned: return (double)arg.u;
+    default: return arg.d;
+  }
+}
 
-  if (!status)
+// printf subset, length modifiers are dropped because argument types are known
+static void format_message(std::string &out, const char *format, const LogArg *args, int count)
+{
+  int argIndex = 0;
+  for (const char *c = format; *c;)
   {
-    fprintf(stdout, "\033[31m%s%s\033[39m\n", timeBuf, messageBuf);
+    if (*c != '%')
+    {
+      const char *end = strchr(c, '%');
+      if (!end)
+        end = c + strlen(c);
+      out.append(c, end);
+      c = end;
+      continue;
+    }
+    if (c[1] == '%')
+    {
+      out += '%';
+      c += 2;
+      continue;
+    }
+    const char *start = c;
+    char spec[32] = "%";
+    size_t n = 1;
+    const char *p = c + 1;
+    while (*p && strchr("-+ #0123456789.", *p) && n < sizeof(spec) - 4)
+      spec[n++] = *p++;
+    while (*p && strchr("hlLqjzt", *p))
+      p++;
+    char conversion = *p;
+    if (!conversion)
+      break;
+    c = p + 1;
+    if (argIndex >= count)
+    {
+      out += "<missing>";
+      continue;
+    }
+    const LogArg &arg = args[argIndex++];
+    switch (conversion)
+    {
+      case 'd': case 'i':
+        memcpy(spec + n, "lld", 4);
+        append_formatted(out, spec, as_int(arg));
+        break;
+      case 'u': case 'x': case 'X': case 'o':
+        spec[n++] = 'l'; spec[n++] = 'l'; spec[n++] = conversion; spec[n] = 0;
+        append_formatted(out, spec, (unsigned long long)as_int(arg));
+        break;
+      case 'c':
+        memcpy(spec + n, "c", 2);
+        append_formatted(out, spec, (int)as_int(arg));
+        break;
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        spec[n++] = conversion; spec[n] = 0;
+        append_formatted(out, spec, as_double(arg));
+        break;
+      case 's':
+        memcpy(spec + n, "s", 2);
+        append_formatted(out, spec, arg.type != LogArg::String ? "<not a string>" : arg.s ? arg.s : "(null)");
+        break;
+      case 'p':
+        memcpy(spec + n, "p", 2);
+        append_formatted(out, spec, arg.p);
+        break;
+      default:
+        out.append(start, c);
+    }
   }
-  else
-    fprintf(stdout, "%s%s\n", timeBuf, messageBuf);
 }
 
-void debug_error(const char *fmt, ...)
+static void format_line(std::string &out, uint64_t time, const char *format, const LogArg *args, int count)
 {
-  va_list args;
-  va_start(args, fmt);
-  debug_common(fmt, 0, args);
-  va_end(args);
+  char timeText[32];
+  snprintf(timeText, sizeof(timeText), "[%.2f] ", (time - log_start_time()) * 1e-9);
+  out = timeText;
+  format_message(out, format, args, count);
 }
 
-void debug_log(const char *fmt, ...)
+static void write_messages(const std::vector<FormattedMessage> &messages)
 {
-  va_list args;
-  va_start(args, fmt);
-  debug_common(fmt, 1, args);
-  va_end(args);
+  {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    for (const FormattedMessage &message : messages)
+    {
+      if (message.level == LogLevel::Error)
+        fprintf(stdout, "\033[31m%s\033[39m\n", message.text.c_str());
+      else
+        fprintf(stdout, "%s\n", message.text.c_str());
+      if (logFile)
+        fprintf(logFile, "%s\n", message.text.c_str());
+    }
+    fflush(stdout);
+    if (logFile)
+      fflush(logFile);
+  }
+  std::lock_guard<std::mutex> lock(historyMutex);
+  for (const FormattedMessage &message : messages)
+  {
+    HistoryEntry &entry = history[historyHead];
+    snprintf(entry.text, sizeof(entry.text), "%s", message.text.c_str());
+    entry.error = message.level == LogLevel::Error;
+    historyHead = (historyHead + 1) % HistorySize;
+    historyCount = std::min(historyCount + 1, HistorySize);
+  }
+}
+
+// log thread only, moves records of every thread to output ordered by time
+static void drain_buffers(std::vector<FormattedMessage> &messages)
+{
+  messages.clear();
+  LogArg args[255];
+  for (ThreadLogBuffer *buffer = threadBuffers.load(std::memory_order_acquire); buffer; buffer = buffer->next)
+  {
+    uint64_t head = buffer->head.load(std::memory_order_acquire);
+    uint64_t tail = buffer->tail.load(std::memory_order_relaxed);
+    while (tail != head)
+    {
+      size_t offset = tail % ThreadLogBuffer::Capacity;
+      const char *data = buffer->data + offset;
+      uint32_t size;
+      memcpy(&size, data, sizeof(size));
+      if (size == 0)
+      {
+        tail += ThreadLogBuffer::Capacity - offset;
+        continue;
+      }
+      LogRecord record;
+      memcpy(&record, data, sizeof(record));
+      // string arguments keep offsets from the record start
+      memcpy(args, data + sizeof(LogRecord), record.argCount * sizeof(LogArg));
+      for (int i = 0; i < record.argCount; i++)
+        if (args[i].type == LogArg::String && args[i].u != 0)
+          args[i].s = data + args[i].u;
+      FormattedMessage &message = messages.emplace_back();
+      message.time = record.time;
+      message.level = record.level;
+      format_line(message.text, record.time, record.format, args, record.argCount);
+      tail += record.size;
+    }
+    buffer->tail.store(tail, std::memory_order_release);
+
+    if (uint32_t dropped = buffer->dropped.exchange(0, std::memory_order_relaxed))
+    {
+      LogArg arg = make_log_arg(dropped);
+      uint64_t time = profiler_time();
+      FormattedMessage &message = messages.emplace_back();
+      message.time = time;
+      message.level = LogLevel::Error;
+      format_line(message.text, time, "log buffer of a thread is full, %u messages dropped", &arg, 1);
+    }
+  }
+  std::stable_sort(messages.begin(), messages.end(), [](const FormattedMessage &a, const FormattedMessage &b) { return a.time < b.time; });
+  if (!messages.empty())
+    write_messages(messages);
+}
+
+static void log_thread_loop()
+{
+  std::vector<FormattedMessage> messages;
+  while (true)
+  {
+    uint64_t flushTarget;
+    bool stop;
+    {
+      std::unique_lock<std::mutex> lock(logMutex);
+      // messages are collected in batches, errors and flushes wake the thread earlier
+      logCondition.wait_for(lock, std::chrono::milliseconds(10), [] { return stopLogThread || wakeRequested.load(std::memory_order_relaxed); });
+      wakeRequested.store(false, std::memory_order_relaxed);
+      flushTarget = flushRequested;
+      stop = stopLogThread;
+    }
+    drain_buffers(messages);
+    {
+      std::lock_guard<std::mutex> lock(logMutex);
+      flushDone = flushTarget;
+    }
+    flushCondition.notify_all();
+    if (stop)
+      break;
+  }
+}
+
+static ThreadLogBuffer &thread_buffer()
+{
+  thread_local ThreadLogBuffer *buffer = nullptr;
+  if (!buffer)
+  {
+    std::call_once(logThreadStarted, [] { logThread = std::thread(log_thread_loop); });
+    buffer = new ThreadLogBuffer();
+    buffer->next = threadBuffers.load(std::memory_order_relaxed);
+    while (!threadBuffers.compare_exchange_weak(buffer->next, buffer, std::memory_order_release, std::memory_order_relaxed))
+      ;
+  }
+  return *buffer;
+}
+
+static void wake_log_thread()
+{
+  wakeRequested.store(true, std::memory_order_relaxed);
+  logCondition.notify_one();
+}
+
+void log_message(LogLevel level, const char *format, const LogArg *args, int count)
+{
+  log_start_time();
+  uint64_t time = profiler_time();
+  if (logClosed.load(std::memory_order_acquire))
+  {
+    std::vector<FormattedMessage> messages(1);
+    messages[0].level = level;
+    format_line(messages[0].text, time, format, args, count);
+    write_messages(messages);
+    return;
+  }
+
+  size_t stringLengths[255] = {};
+  count = std::min(count, 255);
+  size_t size = sizeof(LogRecord) + count * sizeof(LogArg);
+  for (int i = 0; i < count; i++)
+    if (args[i].type == LogArg::String && args[i].s)
+    {
+      stringLengths[i] = strnlen(args[i].s, MaxStringLength);
+      size += stringLengths[i] + 1;
+    }
+  size = align8(size);
+
+  ThreadLogBuffer &buffer = thread_buffer();
+  const size_t capacity = ThreadLogBuffer::Capacity;
+  uint64_t head = buffer.head.load(std::memory_order_relaxed);
+  size_t offset = head % capacity;
+  size_t contiguous = capacity - offset;
+  size_t padding = contiguous < size ? contiguous : 0;
+  uint64_t used = head - buffer.tail.load(std::memory_order_acquire);
+  if (size > capacity / 4 || used + padding + size > capacity)
+  {
+    // waking is a syscall, only the first dropped message pays for it
+    if (buffer.dropped.fetch_add(1, std::memory_order_relaxed) == 0)
+      wake_log_thread();
+    return;
+  }
+  if (padding)
+  {
+    memset(buffer.data + offset, 0, sizeof(uint32_t));
+    head += padding;
+    offset = 0;
+  }
+
+  char *data = buffer.data + offset;
+  LogRecord record{(uint32_t)size, level, (uint8_t)count, time, format};
+  memcpy(data, &record, sizeof(record));
+  LogArg *packed = (LogArg *)(data + sizeof(LogRecord));
+  size_t stringOffset = sizeof(LogRecord) + count * sizeof(LogArg);
+  for (int i = 0; i < count; i++)
+  {
+    packed[i] = args[i];
+    if (args[i].type == LogArg::String && args[i].s)
+    {
+      memcpy(data + stringOffset, args[i].s, stringLengths[i]);
+      data[stringOffset + stringLengths[i]] = 0;
+      packed[i].u = stringOffset;
+      stringOffset += stringLengths[i] + 1;
+    }
+    else if (args[i].type == LogArg::String)
+      packed[i].u = 0;
+  }
+  buffer.head.store(head + size, std::memory_order_release);
+  // errors are shown at once, a half full ring is drained before the next batch is due
+  bool halfFull = used < capacity / 2 && used + padding + size >= capacity / 2;
+  if (level == LogLevel::Error || halfFull)
+    wake_log_thread();
+}
+
+void init_log(const char *file_path)
+{
+  if (file_path)
+  {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    logFile = fopen(file_path, "w");
+    if (!logFile)
+      fprintf(stdout, "can't open log file %s\n", file_path);
+  }
+}
+
+void flush_log()
+{
+  if (!logThread.joinable())
+    return;
+  std::unique_lock<std::mutex> lock(logMutex);
+  uint64_t target = ++flushRequested;
+  wakeRequested.store(true, std::memory_order_relaxed);
+  logCondition.notify_one();
+  flushCondition.wait(lock, [target] { return flushDone >= target; });
+}
+
+void close_log()
+{
+  // messages logged concurrently with close may be lost, other threads are expected to be stopped
+  std::call_once(logThreadStarted, [] {});
+  logClosed.store(true, std::memory_order_release);
+  if (logThread.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lock(logMutex);
+      stopLogThread = true;
+    }
+    logCondition.notify_one();
+    logThread.join();
+  }
+  std::lock_guard<std::mutex> lock(outputMutex);
+  if (logFile)
+    fclose(logFile);
+  logFile = nullptr;
 }
 
 void debug_show()
 {
-  std::unique_lock read_write_lock(m);
-  for (const Message &m: messages_list())
-    ImGui::TextColored(m.status ? ImVec4(1,1,1,1) : ImVec4(1,0.1f,0.1f,1) , "%s", m.message.c_str());
-}
\ No newline at end of file
+  std::lock_guard<std::mutex> lock(historyMutex);
+  for (int i = 0; i < historyCount; i++)
+  {
+    const HistoryEntry &entry = history[(historyHead - historyCount + i + HistorySize) % HistorySize];
+    ImGui::TextColored(entry.error ? ImVec4(1, 0.1f, 0.1f, 1) : ImVec4(1, 1, 1, 1), "%s", entry.text);
+  }
+}
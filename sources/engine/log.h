@@ -2,10 +2,74 @@
 #include <iostream>
 #include <string>
 #include <memory>
+#include <cstdint>
+#include <type_traits>
 
-void debug_error(const char *format, ...);
-void debug_log(const char *format, ...);
+// Calls only capture format pointer and packed arguments into a ring of the calling thread,
+// formatting and output happen on the log thread. Format must be a string literal,
+// strings passed as %s are copied, other pointers are kept as values.
+struct LogArg
+{
+  enum Type : uint8_t { Int, Unsigned, Double, Pointer, String } type;
+  union
+  {
+    long long i;
+    unsigned long long u;
+    double d;
+    const void *p;
+    const char *s;
+  };
+};
 
+template<typename T>
+inline LogArg make_log_arg(T value)
+{
+  LogArg arg;
+  if constexpr (std::is_same_v<T, char *> || std::is_same_v<T, const char *>)
+    arg.type = LogArg::String, arg.s = value;
+  else if constexpr (std::is_same_v<T, unsigned char *> || std::is_same_v<T, const unsigned char *>)
+    arg.type = LogArg::String, arg.s = (const char *)value;
+  else if constexpr (std::is_floating_point_v<T>)
+    arg.type = LogArg::Double, arg.d = value;
+  else if constexpr (std::is_enum_v<T> || (std::is_integral_v<T> && std::is_signed_v<T>))
+    arg.type = LogArg::Int, arg.i = (long long)value;
+  else if constexpr (std::is_integral_v<T>)
+    arg.type = LogArg::Unsigned, arg.u = value;
+  else if constexpr (std::is_pointer_v<T> || std::is_null_pointer_v<T>)
+    arg.type = LogArg::Pointer, arg.p = value;
+  else
+    static_assert(!sizeof(T), "log argument must be a number, a pointer or a C string");
+  return arg;
+}
 
+enum class LogLevel : uint8_t
+{
+  Error,
+  Info
+};
 
+void log_message(LogLevel level, const char *format, const LogArg *args, int count);
 
+template<typename... Args>
+void debug_error(const char *format, Args... args)
+{
+  const LogArg packed[sizeof...(Args) + 1] = {make_log_arg(args)...};
+  log_message(LogLevel::Error, format, packed, sizeof...(Args));
+}
+
+template<typename... Args>
+void debug_log(const char *format, Args... args)
+{
+  const LogArg packed[sizeof...(Args) + 1] = {make_log_arg(args)...};
+  log_message(LogLevel::Info, format, packed, sizeof...(Args));
+}
+
+// log thread starts on first message, output goes to stdout and to file_path when it is set
+void init_log(const char *file_path = nullptr);
+// writes every pending message and stops log thread, later messages are written synchronously
+void close_log();
+// blocks until messages logged before the call are written
+void flush_log();
+
+// last messages, safe to call while other threads log
+void debug_show();
@@ -1,17 +1,21 @@
 #include "application.h"
 
 
-extern void init_application(const char *project_name, int width, int height, bool full_screen);
+extern void init_application(const ApplicationSettings &settings);
 extern void close_application();
-extern void main_loop();
+extern int main_loop();
 
-int main(int, char**)
+int main(int argc, char **argv)
 {
-  init_application("animations", 2048, 1024, true);
+  ApplicationSettings settings;
+  if (!parse_command_line(argc, argv, settings))
+    return 1;
 
-  main_loop();
+  init_application(settings);
+
+  int result = main_loop();
 
   close_application();
 
-  return 0;
-}
\ No newline at end of file
+  return result;
+}
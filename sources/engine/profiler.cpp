@@ -0,0 +1,417 @@
+#include "profiler.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#include <glad/glad.h>
+#include <imgui/imgui.h>
+#include "job_system.h"
+#include "log.h"
+
+struct ProfileEvent
+{
+  const char *name;
+  uint64_t start, end;
+  int depth;
+  int thread; // job thread index or GpuThread
+};
+
+constexpr int GpuThread = -1;
+constexpr uint32_t ThreadEventCapacity = 1 << 14;
+constexpr int HistorySize = 240;
+constexpr int ProfilerLatency = 4;
+constexpr int MaxGpuEvents = 256;
+
+// single producer ring, only the owner thread pushes, only profiler_end_frame pops
+struct ThreadEventBuffer
+{
+  ProfileEvent events[ThreadEventCapacity];
+  std::atomic<uint32_t> head{0};
+  std::atomic<uint32_t> tail{0};
+  int thread = 0;
+  int depth = 0;
+  ThreadEventBuffer *next = nullptr;
+};
+
+// buffers live until the process exits, thread_local pointers to them are never reset
+static std::atomic<ThreadEventBuffer *> threadBuffers{nullptr};
+static std::atomic<uint32_t> droppedEvents{0};
+
+static ThreadEventBuffer &thread_buffer()
+{
+  thread_local ThreadEventBuffer *buffer = nullptr;
+  if (!buffer)
+  {
+    buffer = new ThreadEventBuffer();
+    buffer->thread = get_job_thread_index();
+    buffer->next = threadBuffers.load(std::memory_order_relaxed);
+    while (!threadBuffers.compare_exchange_weak(buffer->next, buffer, std::memory_order_release, std::memory_order_relaxed))
+      ;
+  }
+  return *buffer;
+}
+
+uint64_t profiler_time()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ProfileScope::ProfileScope(const char *name) : name(name), start(profiler_time())
+{
+  thread_buffer().depth++;
+}
+
+ProfileScope::~ProfileScope()
+{
+  uint64_t end = profiler_time();
+  ThreadEventBuffer &buffer = thread_buffer();
+  buffer.depth--;
+  uint32_t head = buffer.head.load(std::memory_order_relaxed);
+  if (head - buffer.tail.load(std::memory_order_acquire) >= ThreadEventCapacity)
+  {
+    droppedEvents.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  buffer.events[head % ThreadEventCapacity] = ProfileEvent{name, start, end, buffer.depth, buffer.thread};
+  buffer.head.store(head + 1, std::memory_order_release);
+}
+
+
+struct ProfileFrame
+{
+  uint64_t number = 0;
+  uint64_t start = 0, end = 0;
+  std::vector<ProfileEvent> events;
+};
+
+struct GpuFrame
+{
+  GLuint queries[MaxGpuEvents * 2];
+  ProfileEvent events[MaxGpuEvents];
+  int count = 0;
+  uint64_t frame = 0;
+};
+
+static std::vector<ProfileFrame> history;
+static GpuFrame gpuFrames[ProfilerLatency];
+static uint64_t frameNumber = 0;
+static uint64_t viewFrameNumber = 0; // latest frame in history, stops while paused so the window keeps showing stored frames
+static uint64_t gpuFrameNumber = 0;
+static int gpuDepth = 0;
+// resolved gpu events wait here until main thread moves them to history
+static std::mutex gpuResultsMutex;
+static std::vector<std::pair<uint64_t, ProfileEvent>> gpuResults;
+static int64_t gpuClockOffset = 0; // cpu time - gpu time
+static std::thread::id glThread;
+static bool initialized = false;
+static bool paused = false;
+static bool showWindow = false;
+
+static void calibrate_gpu_clock()
+{
+  GLint64 gpuTime = 0;
+  glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+  gpuClockOffset = (int64_t)profiler_time() - gpuTime;
+}
+
+void init_profiler()
+{
+  history.resize(HistorySize);
+  for (GpuFrame &frame : gpuFrames)
+  {
+    glGenQueries(MaxGpuEvents * 2, frame.queries);
+    frame.count = 0;
+  }
+  glThread = std::this_thread::get_id();
+  calibrate_gpu_clock();
+  initialized = true;
+}
+
+void close_profiler()
+{
+  if (!initialized)
+    return;
+  initialized = false;
+  for (GpuFrame &frame : gpuFrames)
+    glDeleteQueries(MaxGpuEvents * 2, frame.queries);
+  history.clear();
+  // pending events are dropped, scopes still running on other threads keep writing to their buffers
+  for (ThreadEventBuffer *buffer = threadBuffers.load(std::memory_order_acquire); buffer; buffer = buffer->next)
+    buffer->tail.store(buffer->head.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+void profiler_set_gpu_thread()
+{
+  glThread = std::this_thread::get_id();
+}
+
+void profiler_set_thread_index(int index)
+{
+  thread_buffer().thread = index;
+}
+
+int gpu_profile_begin(const char *name)
+{
+  if (!initialized || std::this_thread::get_id() != glThread)
+    return -1;
+  GpuFrame &frame = gpuFrames[gpuFrameNumber % ProfilerLatency];
+  if (frame.count == MaxGpuEvents)
+    return -1;
+  int event = frame.count++;
+  frame.events[event] = ProfileEvent{name, 0, 0, gpuDepth++, GpuThread};
+  glQueryCounter(frame.queries[event * 2], GL_TIMESTAMP);
+  return event;
+}
+
+void gpu_profile_end(int event)
+{
+  if (event < 0)
+    return;
+  gpuDepth--;
+  glQueryCounter(gpuFrames[gpuFrameNumber % ProfilerLatency].queries[event * 2 + 1], GL_TIMESTAMP);
+}
+
+static ProfileFrame *find_frame(uint64_t number)
+{
+  if (history.empty())
+    return nullptr;
+  ProfileFrame &frame = history[number % HistorySize];
+  return frame.number == number ? &frame : nullptr;
+}
+
+// queries of this slot were issued ProfilerLatency frames ago
+static void read_gpu_frame(GpuFrame &gpuFrame)
+{
+  if (gpuFrame.count == 0)
+    return;
+  GLint available = 0;
+  glGetQueryObjectiv(gpuFrame.queries[gpuFrame.count * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (available)
+  {
+    std::lock_guard<std::mutex> lock(gpuResultsMutex);
+    for (int i = 0; i < gpuFrame.count; i++)
+    {
+      GLuint64 start, end;
+      glGetQueryObjectui64v(gpuFrame.queries[i * 2], GL_QUERY_RESULT, &start);
+      glGetQueryObjectui64v(gpuFrame.queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+      ProfileEvent event = gpuFrame.events[i];
+      event.start = start + gpuClockOffset;
+      event.end = end + gpuClockOffset;
+      gpuResults.emplace_back(gpuFrame.frame, event);
+    }
+  }
+  else
+    droppedEvents.fetch_add(gpuFrame.count, std::memory_order_relaxed);
+  gpuFrame.count = 0;
+}
+
+void profiler_begin_frame()
+{
+  if (!initialized)
+    return;
+  frameNumber++;
+  if (!paused)
+  {
+    viewFrameNumber = frameNumber;
+    ProfileFrame &frame = history[frameNumber % HistorySize];
+    frame.number = frameNumber;
+    frame.start = profiler_time();
+    frame.end = frame.start;
+    frame.events.clear();
+  }
+}
+
+uint64_t profiler_frame_number()
+{
+  return frameNumber;
+}
+
+void profiler_begin_gpu_frame(uint64_t frame_number)
+{
+  if (!initialized)
+    return;
+  gpuFrameNumber = frame_number;
+  if (frame_number % 256 == 0)
+    calibrate_gpu_clock();
+  GpuFrame &gpuFrame = gpuFrames[frame_number % ProfilerLatency];
+  read_gpu_frame(gpuFrame);
+  gpuFrame.frame = frame_number;
+  gpuDepth = 0;
+}
+
+void profiler_end_frame()
+{
+  if (!initialized)
+    return;
+  // a frame begun before pause is still finished, frames begun while paused are not stored
+  ProfileFrame *frame = find_frame(frameNumber);
+  if (frame)
+    frame->end = profiler_time();
+  for (ThreadEventBuffer *buffer = threadBuffers.load(std::memory_order_acquire); buffer; buffer = buffer->next)
+  {
+    uint32_t head = buffer->head.load(std::memory_order_acquire);
+    uint32_t tail = buffer->tail.load(std::memory_order_relaxed);
+    if (frame)
+      for (uint32_t i = tail; i != head; i++)
+        frame->events.push_back(buffer->events[i % ThreadEventCapacity]);
+    buffer->tail.store(head, std::memory_order_release);
+  }
+
+  std::lock_guard<std::mutex> lock(gpuResultsMutex);
+  for (const auto &result : gpuResults)
+    if (ProfileFrame *gpuFrame = find_frame(result.first))
+      gpuFrame->events.push_back(result.second);
+  gpuResults.clear();
+}
+
+
+static ImU32 event_color(const char *name)
+{
+  uint32_t hash = 2166136261u;
+  for (const char *c = name; *c; c++)
+    hash = (hash ^ (uint8_t)*c) * 16777619u;
+  return IM_COL32(80 + hash % 150, 80 + (hash >> 8) % 150, 80 + (hash >> 16) % 150, 255);
+}
+
+static float frame_duration_ms(const ProfileFrame &frame)
+{
+  return (frame.end - frame.start) * 1e-6f;
+}
+
+void profiler_menu()
+{
+  if (ImGui::BeginMenu("Profiler"))
+  {
+    ImGui::Checkbox("Timeline", &showWindow);
+    ImGui::Checkbox("Pause", &paused);
+    if (ImGui::MenuItem("Save chrome trace"))
+      save_chrome_trace("profile_trace.json");
+    ImGui::EndMenu();
+  }
+  if (const ProfileFrame *frame = find_frame(viewFrameNumber - 1))
+    ImGui::Text("%.2f ms", frame_duration_ms(*frame));
+}
+
+static void draw_timeline(const ProfileFrame &frame, float zoom)
+{
+  uint64_t rangeStart = frame.start, rangeEnd = frame.end;
+  std::vector<int> threads;
+  for (const ProfileEvent &event : frame.events)
+  {
+    rangeStart = std::min(rangeStart, event.start);
+    rangeEnd = std::max(rangeEnd, event.end);
+    if (std::find(threads.begin(), threads.end(), event.thread) == threads.end())
+      threads.push_back(event.thread);
+  }
+  std::sort(threads.begin(), threads.end());
+  if (rangeEnd <= rangeStart)
+    return;
+
+  const float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+  const float labelWidth = 70.f;
+  ImGui::BeginChild("timeline", ImVec2(0, 0), true, ImGuiWindowFlags_HorizontalScrollbar);
+  const float width = std::max(100.f, (ImGui::GetWindowContentRegionWidth() - labelWidth) * zoom);
+  const float nsToPixels = width / (rangeEnd - rangeStart);
+  ImDrawList *drawList = ImGui::GetWindowDrawList();
+  ImVec2 origin = ImGui::GetCursorScreenPos();
+  float y = origin.y;
+  for (int thread : threads)
+  {
+    char label[32];
+    if (thread == GpuThread)
+      snprintf(label, sizeof(label), "gpu");
+    else if (thread == RenderThreadIndex)
+      snprintf(label, sizeof(label), "render");
+    else if (thread == 0)
+      snprintf(label, sizeof(label), "main");
+    else
+      snprintf(label, sizeof(label), "worker %d", thread);
+    drawList->AddText(ImVec2(origin.x, y), IM_COL32(255, 255, 255, 255), label);
+
+    int maxDepth = 0;
+    for (const ProfileEvent &event : frame.events)
+    {
+      if (event.thread != thread)
+        continue;
+      maxDepth = std::max(maxDepth, event.depth);
+      ImVec2 a(origin.x + labelWidth + (event.start - rangeStart) * nsToPixels, y + event.depth * rowHeight);
+      ImVec2 b(std::max(a.x + 1.f, origin.x + labelWidth + (event.end - rangeStart) * nsToPixels), a.y + rowHeight - 1.f);
+      drawList->AddRectFilled(a, b, event_color(event.name));
+      if (b.x - a.x > ImGui::CalcTextSize(event.name).x)
+        drawList->AddText(ImVec2(a.x + 2.f, a.y), IM_COL32(0, 0, 0, 255), event.name);
+      if (ImGui::IsMouseHoveringRect(a, b))
+        ImGui::SetTooltip("%s %.3f ms", event.name, (event.end - event.start) * 1e-6f);
+    }
+    y += (maxDepth + 1) * rowHeight + 4.f;
+  }
+  ImGui::Dummy(ImVec2(labelWidth + width, y - origin.y));
+  ImGui::EndChild();
+}
+
+void profiler_window()
+{
+  if (!showWindow)
+    return;
+  if (!ImGui::Begin("Profiler", &showWindow))
+  {
+    ImGui::End();
+    return;
+  }
+  static float frameTimes[HistorySize];
+  for (int i = 0; i < HistorySize; i++)
+  {
+    const ProfileFrame *frame = viewFrameNumber >= (uint64_t)(HistorySize - i) ? find_frame(viewFrameNumber - HistorySize + i) : nullptr;
+    frameTimes[i] = frame ? frame_duration_ms(*frame) : 0.f;
+  }
+  ImGui::PlotHistogram("##frames", frameTimes, HistorySize, 0, "frame ms", 0.f, 33.f, ImVec2(0, 50));
+
+  // gpu results of the latest frames are still in flight
+  static int framesAgo = ProfilerLatency;
+  static float zoom = 1.f;
+  ImGui::SliderInt("frames ago", &framesAgo, ProfilerLatency, HistorySize - 1);
+  ImGui::SliderFloat("zoom", &zoom, 1.f, 50.f, "%.1f", ImGuiSliderFlags_Logarithmic);
+  ImGui::Text("dropped events %u", droppedEvents.load(std::memory_order_relaxed));
+
+  if (viewFrameNumber > (uint64_t)framesAgo)
+    if (const ProfileFrame *frame = find_frame(viewFrameNumber - framesAgo))
+      draw_timeline(*frame, zoom);
+  ImGui::End();
+}
+
+bool save_chrome_trace(const char *path)
+{
+  FILE *file = fopen(path, "w");
+  if (!file)
+  {
+    debug_error("can't open %s to save trace", path);
+    return false;
+  }
+  std::vector<const ProfileFrame *> frames;
+  for (const ProfileFrame &frame : history)
+    if (frame.number != 0)
+      frames.push_back(&frame);
+  std::sort(frames.begin(), frames.end(), [](const ProfileFrame *a, const ProfileFrame *b) { return a->number < b->number; });
+  uint64_t origin = frames.empty() ? 0 : frames[0]->start;
+
+  // chrome trace expects tid to be non negative, gpu and render thread get their own ones
+  const int gpuTid = 1000, renderTid = 1001;
+  fprintf(file, "{\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"gpu\"}},\n", gpuTid);
+  fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"render\"}}", renderTid);
+  for (const ProfileFrame *frame : frames)
+  {
+    fprintf(file, ",\n{\"name\":\"frame %llu\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}",
+      (unsigned long long)frame->number, (frame->start - origin) * 1e-3, (frame->end - frame->start) * 1e-3);
+    for (const ProfileEvent &event : frame->events)
+      fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+        event.name, event.thread == GpuThread ? gpuTid : event.thread == RenderThreadIndex ? renderTid : event.thread,
+        ((int64_t)event.start - (int64_t)origin) * 1e-3, (event.end - event.start) * 1e-3);
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+  debug_log("profiler trace of %zu frames saved to %s", frames.size(), path);
+  return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+
+// nanoseconds of steady clock, the same time base for cpu and gpu events
+uint64_t profiler_time();
+
+// name must be a string literal or otherwise live for the whole run
+struct ProfileScope
+{
+  const char *name;
+  uint64_t start;
+
+  explicit ProfileScope(const char *name);
+  ~ProfileScope();
+};
+
+// GL thread only, returns -1 when query pool of the frame is exhausted
+int gpu_profile_begin(const char *name);
+void gpu_profile_end(int event);
+
+// timestamps are written by the GPU, results are read back ProfilerLatency frames later
+struct GpuProfileScope
+{
+  int event;
+
+  explicit GpuProfileScope(const char *name) : event(gpu_profile_begin(name)) {}
+  ~GpuProfileScope() { gpu_profile_end(event); }
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define GPU_PROFILE_SCOPE(name) GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
+
+void init_profiler();
+void close_profiler();
+
+// main thread only, collects events of all threads and finished gpu queries
+void profiler_begin_frame();
+void profiler_end_frame();
+uint64_t profiler_frame_number();
+
+// GL thread only, reads back queries of an old frame, following gpu events belong to frame_number
+void profiler_begin_gpu_frame(uint64_t frame_number);
+// thread that owns GL context, gpu scopes on other threads are ignored
+void profiler_set_gpu_thread();
+
+// threads outside of job system are labeled by index, 0 is main, 1..N are job workers
+constexpr int RenderThreadIndex = -2;
+void profiler_set_thread_index(int index);
+
+// items of main menu bar and timeline window
+void profiler_menu();
+void profiler_window();
+
+// chrome://tracing and perfetto format of every frame in history
+bool save_chrome_trace(const char *path);
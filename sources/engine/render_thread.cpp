@@ -0,0 +1,149 @@
+#include "render_thread.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "profiler.h"
+
+void CommandStream::execute()
+{
+  for (Command *command = head; command; command = command->next)
+  {
+    command->execute(command->payload);
+    command->destroy(command->payload);
+  }
+  head = tail = nullptr;
+  reset();
+}
+
+void CommandStream::reset()
+{
+  for (Command *command = head; command; command = command->next)
+    command->destroy(command->payload);
+  head = tail = nullptr;
+  commandCount = 0;
+  arena.reset();
+}
+
+
+static CommandStream streams[2];
+static int recordStream = 0;
+static std::thread renderThread;
+static std::function<void(bool)> makeCurrent;
+static std::mutex renderMutex;
+static std::condition_variable renderCondition;
+static CommandStream *pendingStream = nullptr;
+static bool renderBusy = false;
+static bool stopRenderThread = false;
+
+static void render_thread_loop()
+{
+  makeCurrent(true);
+  profiler_set_gpu_thread();
+  profiler_set_thread_index(RenderThreadIndex);
+  while (true)
+  {
+    CommandStream *stream;
+    {
+      std::unique_lock<std::mutex> lock(renderMutex);
+      renderCondition.wait(lock, [] { return pendingStream || stopRenderThread; });
+      if (!pendingStream)
+        break;
+      stream = pendingStream;
+      pendingStream = nullptr;
+    }
+    {
+      PROFILE_SCOPE("render_thread");
+      stream->execute();
+    }
+    {
+      std::lock_guard<std::mutex> lock(renderMutex);
+      renderBusy = false;
+    }
+    renderCondition.notify_all();
+  }
+  makeCurrent(false);
+}
+
+void init_render_thread(bool separate_thread, std::function<void(bool)> &&make_current)
+{
+  makeCurrent = std::move(make_current);
+  if (!separate_thread)
+    return;
+  makeCurrent(false);
+  stopRenderThread = false;
+  renderThread = std::thread(render_thread_loop);
+}
+
+void close_render_thread()
+{
+  if (renderThread.joinable())
+  {
+    flush_render_thread();
+    {
+      std::lock_guard<std::mutex> lock(renderMutex);
+      stopRenderThread = true;
+    }
+    renderCondition.notify_all();
+    renderThread.join();
+    makeCurrent(true);
+    profiler_set_gpu_thread();
+  }
+  // commands recorded after the last submit own resources, they are released without replay
+  for (CommandStream &stream : streams)
+    stream.reset();
+}
+
+bool is_render_thread_mode()
+{
+  return renderThread.joinable();
+}
+
+CommandStream &render_command_stream()
+{
+  return streams[recordStream];
+}
+
+void flush_render_thread()
+{
+  std::unique_lock<std::mutex> lock(renderMutex);
+  renderCondition.wait(lock, [] { return !renderBusy && !pendingStream; });
+}
+
+void submit_render_frame()
+{
+  CommandStream &stream = streams[recordStream];
+  if (!renderThread.joinable())
+  {
+    stream.execute();
+    return;
+  }
+  {
+    PROFILE_SCOPE("wait_render_thread");
+    flush_render_thread();
+  }
+  {
+    std::lock_guard<std::mutex> lock(renderMutex);
+    pendingStream = &stream;
+    renderBusy = true;
+  }
+  renderCondition.notify_all();
+  recordStream ^= 1;
+}
+
+
+// begin and end are recorded, queries are issued when the render thread replays them
+static std::vector<int> renderScopeStack;
+
+RenderProfileScope::RenderProfileScope(const char *name)
+{
+  enqueue_render_command([name]() { renderScopeStack.push_back(gpu_profile_begin(name)); });
+}
+
+RenderProfileScope::~RenderProfileScope()
+{
+  enqueue_render_command([]()
+  {
+    gpu_profile_end(renderScopeStack.back());
+    renderScopeStack.pop_back();
+  });
+}
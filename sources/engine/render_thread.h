@@ -0,0 +1,101 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include "profiler.h"
+#include "frame_allocator.h"
+
+// Commands are type erased callables placed in a linear arena together with their data.
+// Memory is reused every frame, nothing is freed until the stream is destroyed.
+class CommandStream
+{
+  struct Command
+  {
+    void (*execute)(void *);
+    void (*destroy)(void *);
+    void *payload;
+    Command *next;
+  };
+
+  LinearArena arena;
+  Command *head = nullptr;
+  Command *tail = nullptr;
+  int commandCount = 0;
+
+public:
+  CommandStream() = default;
+  CommandStream(const CommandStream &) = delete;
+  CommandStream &operator=(const CommandStream &) = delete;
+  ~CommandStream() { reset(); }
+
+  void *allocate(size_t size, size_t alignment) { return arena.allocate(size, alignment); }
+
+  template<typename F>
+  void push(F &&function)
+  {
+    using T = std::decay_t<F>;
+    Command *command = new (allocate(sizeof(Command), alignof(Command))) Command();
+    command->payload = new (allocate(sizeof(T), alignof(T))) T(std::forward<F>(function));
+    command->execute = [](void *payload) { (*(T *)payload)(); };
+    command->destroy = [](void *payload) { ((T *)payload)->~T(); };
+    if (tail)
+      tail->next = command;
+    else
+      head = command;
+    tail = command;
+    commandCount++;
+  }
+
+  // runs every command in recorded order and resets the stream
+  void execute();
+  void reset();
+
+  int size() const { return commandCount; }
+  size_t used_bytes() const { return arena.used_bytes(); }
+};
+
+// GL work is recorded on the game thread and replayed on the thread which owns the context.
+// In render thread mode replay of frame N overlaps with update and recording of frame N+1,
+// otherwise submit_render_frame replays the stream in place.
+// make_current(true) attaches the GL context to calling thread, make_current(false) detaches it.
+void init_render_thread(bool separate_thread, std::function<void(bool)> &&make_current);
+void close_render_thread();
+bool is_render_thread_mode();
+
+CommandStream &render_command_stream();
+
+// game thread only, callable runs on the render thread
+template<typename F>
+void enqueue_render_command(F &&command)
+{
+  render_command_stream().push(std::forward<F>(command));
+}
+
+// game thread only, memory lives until the recorded frame is replayed
+inline void *allocate_render_data(size_t size, size_t alignment = 16)
+{
+  return render_command_stream().allocate(size, alignment);
+}
+template<typename T>
+T *allocate_render_data(size_t count)
+{
+  return (T *)allocate_render_data(sizeof(T) * count, alignof(T) < 16 ? 16 : alignof(T));
+}
+
+// hands recorded frame to the render thread, waits while previous one is still being replayed
+void submit_render_frame();
+// blocks until every submitted frame is replayed
+void flush_render_thread();
+
+// GPU timestamps around recorded commands, see GPU_PROFILE_SCOPE for code running on the render thread
+struct RenderProfileScope
+{
+  explicit RenderProfileScope(const char *name);
+  ~RenderProfileScope();
+};
+
+#define RENDER_PROFILE_SCOPE(name) RenderProfileScope PROFILE_CONCAT(renderProfileScope, __LINE__)(name)
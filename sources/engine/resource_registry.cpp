@@ -0,0 +1,61 @@
+#include "resource_registry.h"
+#include <imgui/imgui.h>
+#include "render_thread.h"
+#include "log.h"
+
+static std::vector<ResourcePoolBase *> &resource_pools()
+{
+  // pools are function statics of other modules, the list must exist before the first of them
+  static std::vector<ResourcePoolBase *> pools;
+  return pools;
+}
+
+static uint64_t frameNumber = 0;
+
+void register_resource_pool(ResourcePoolBase *pool)
+{
+  resource_pools().push_back(pool);
+}
+
+uint64_t resource_frame()
+{
+  return frameNumber;
+}
+
+void update_resources()
+{
+  frameNumber++;
+  for (ResourcePoolBase *pool : resource_pools())
+    pool->collect(frameNumber);
+}
+
+void close_resources()
+{
+  for (ResourcePoolBase *pool : resource_pools())
+  {
+    ResourceStats stats = pool->stats();
+    if (int referenced = pool->destroy_all())
+      debug_log("%d of %d %s are still referenced at exit", referenced, stats.count, stats.name);
+  }
+  // destroy functions recorded GL deletes
+  submit_render_frame();
+}
+
+std::vector<ResourceStats> resource_stats()
+{
+  std::vector<ResourceStats> result;
+  for (const ResourcePoolBase *pool : resource_pools())
+    result.push_back(pool->stats());
+  return result;
+}
+
+void resources_menu()
+{
+  if (ImGui::BeginMenu("Resources"))
+  {
+    for (const ResourceStats &stats : resource_stats())
+      ImGui::Text("%-9s %4d alive, %3d pending, %8.1f KB, peak %8.1f KB, %d of %d loads shared",
+        stats.name, stats.count, stats.pending, stats.bytes / 1024.f, stats.peakBytes / 1024.f, stats.deduplicated, stats.loads);
+    ImGui::EndMenu();
+  }
+}
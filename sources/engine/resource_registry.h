@@ -0,0 +1,273 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 32 bit reference to a pooled resource: 20 bits of slot index and 12 bits of slot generation.
+// A slot gets the next generation when its resource is destroyed, so stale handles resolve to nullptr.
+template<typename T>
+struct Handle
+{
+  static constexpr uint32_t IndexBits = 20;
+  static constexpr uint32_t IndexMask = (1u << IndexBits) - 1;
+  static constexpr uint32_t MaxGeneration = (1u << (32 - IndexBits)) - 1;
+
+  uint32_t value = 0; // generations start from 1, so 0 is never valid
+
+  Handle() = default;
+  Handle(uint32_t index, uint32_t generation) : value(index | generation << IndexBits) {}
+
+  uint32_t index() const { return value & IndexMask; }
+  uint32_t generation() const { return value >> IndexBits; }
+  explicit operator bool() const { return value != 0; }
+  bool operator==(const Handle &other) const { return value == other.value; }
+  bool operator!=(const Handle &other) const { return value != other.value; }
+};
+
+// frames recorded before a release may still be replayed, destruction waits for them
+constexpr uint64_t ResourceFramesInFlight = 2;
+
+struct ResourceStats
+{
+  const char *name = nullptr;
+  int count = 0; // including released ones waiting for destruction
+  int pending = 0;
+  size_t bytes = 0;
+  size_t peakBytes = 0;
+  int loads = 0; // requests by key
+  int deduplicated = 0; // requests answered with already loaded resource
+};
+
+class ResourcePoolBase
+{
+public:
+  virtual ~ResourcePoolBase() = default;
+  // destroys released resources which no recorded frame can use anymore
+  virtual void collect(uint64_t frame) = 0;
+  // destroys everything, returns how many resources were still referenced
+  virtual int destroy_all() = 0;
+  virtual ResourceStats stats() const = 0;
+};
+
+void register_resource_pool(ResourcePoolBase *pool);
+// counts update_resources calls
+uint64_t resource_frame();
+
+// Resources are reference counted by hand: create and find give the caller one reference,
+// release_resource gives it back. The last release schedules destruction after ResourceFramesInFlight frames,
+// until then a request with the same key takes the resource back.
+// Everything except get is game thread only, get is also valid on the render thread for resources
+// alive in the replayed frame. Slots are paged and never move, pointers from get live until destruction.
+template<typename T>
+class ResourcePool final : public ResourcePoolBase
+{
+  struct Slot
+  {
+    std::optional<T> resource;
+    uint32_t generation = 1;
+    int refCount = 0;
+    uint64_t releaseFrame = 0;
+    bool queued = false; // index is in released list
+    size_t bytes = 0;
+    std::string key;
+  };
+  static constexpr uint32_t PageSize = 256;
+  static constexpr uint32_t PageCount = (Handle<T>::IndexMask + 1) / PageSize;
+
+  std::unique_ptr<std::unique_ptr<Slot[]>[]> pages;
+  uint32_t slotCount = 0;
+  std::vector<uint32_t> freeSlots;
+  std::unordered_map<std::string, uint32_t> keys;
+  std::vector<uint32_t> released;
+  void (*destroyResource)(T &resource);
+  ResourceStats statistics;
+
+  Slot &slot(uint32_t index) const { return pages[index / PageSize][index % PageSize]; }
+
+  Slot *find_slot(Handle<T> handle) const
+  {
+    if (!handle || handle.index() >= slotCount)
+      return nullptr;
+    Slot &s = slot(handle.index());
+    return s.generation == handle.generation() && s.resource ? &s : nullptr;
+  }
+
+  void destroy_slot(uint32_t index)
+  {
+    Slot &s = slot(index);
+    destroyResource(*s.resource);
+    s.resource.reset();
+    if (!s.key.empty())
+      keys.erase(s.key);
+    s.key.clear();
+    s.refCount = 0;
+    s.queued = false;
+    s.generation = s.generation == Handle<T>::MaxGeneration ? 1 : s.generation + 1;
+    statistics.bytes -= s.bytes;
+    statistics.count--;
+    freeSlots.push_back(index);
+  }
+
+public:
+  // destroy releases what resource owns, GL objects are deleted with a render command
+  ResourcePool(const char *name, void (*destroy)(T &resource)) :
+    pages(new std::unique_ptr<Slot[]>[PageCount]), destroyResource(destroy)
+  {
+    statistics.name = name;
+    register_resource_pool(this);
+  }
+  ResourcePool(const ResourcePool &) = delete;
+  ResourcePool &operator=(const ResourcePool &) = delete;
+
+  // takes a reference to resource loaded with this key, invalid handle when there is none
+  Handle<T> find(const std::string &key)
+  {
+    auto it = keys.find(key);
+    count_load(it != keys.end());
+    if (it == keys.end())
+      return {};
+    Slot &s = slot(it->second);
+    s.refCount++;
+    return Handle<T>(it->second, s.generation);
+  }
+
+  // for types with their own caches
+  void count_load(bool deduplicated)
+  {
+    statistics.loads++;
+    statistics.deduplicated += deduplicated;
+  }
+
+  // bytes is memory owned by resource, empty key adds resource which can't be found
+  Handle<T> add(T &&resource, size_t bytes, const std::string &key = {})
+  {
+    uint32_t index;
+    if (!freeSlots.empty())
+    {
+      index = freeSlots.back();
+      freeSlots.pop_back();
+    }
+    else
+    {
+      if (slotCount > Handle<T>::IndexMask)
+        throw std::runtime_error{std::string("too many resources in pool ") + statistics.name};
+      index = slotCount++;
+      if (!pages[index / PageSize])
+        pages[index / PageSize].reset(new Slot[PageSize]);
+    }
+    Slot &s = slot(index);
+    s.resource.emplace(std::move(resource));
+    s.refCount = 1;
+    s.bytes = bytes;
+    s.key = key;
+    if (!key.empty())
+      keys[key] = index;
+    statistics.count++;
+    statistics.bytes += bytes;
+    statistics.peakBytes = std::max(statistics.peakBytes, statistics.bytes);
+    return Handle<T>(index, s.generation);
+  }
+
+  T *get(Handle<T> handle) const
+  {
+    Slot *s = find_slot(handle);
+    return s ? &*s->resource : nullptr;
+  }
+
+  void acquire(Handle<T> handle)
+  {
+    if (Slot *s = find_slot(handle))
+      s->refCount++;
+  }
+
+  void release(Handle<T> handle)
+  {
+    Slot *s = find_slot(handle);
+    if (!s || s->refCount == 0)
+      return;
+    if (--s->refCount == 0)
+    {
+      s->releaseFrame = resource_frame();
+      if (!s->queued)
+        released.push_back(handle.index());
+      s->queued = true;
+    }
+  }
+
+  void collect(uint64_t frame) override
+  {
+    for (size_t i = 0; i < released.size();)
+    {
+      Slot &s = slot(released[i]);
+      // taken back by find
+      bool dropped = s.refCount > 0;
+      bool expired = !dropped && s.releaseFrame + ResourceFramesInFlight <= frame;
+      if (expired)
+        destroy_slot(released[i]);
+      if (dropped || expired)
+      {
+        s.queued = false;
+        released[i] = released.back();
+        released.pop_back();
+      }
+      else
+        i++;
+    }
+  }
+
+  int destroy_all() override
+  {
+    int referenced = 0;
+    for (uint32_t index = 0; index < slotCount; index++)
+      if (slot(index).resource)
+      {
+        referenced += slot(index).refCount > 0;
+        destroy_slot(index);
+      }
+    released.clear();
+    return referenced;
+  }
+
+  ResourceStats stats() const override
+  {
+    ResourceStats result = statistics;
+    for (uint32_t index : released)
+      result.pending += slot(index).refCount == 0;
+    return result;
+  }
+};
+
+// every resource type specializes it next to its loading functions
+template<typename T>
+ResourcePool<T> &resource_pool();
+
+template<typename T>
+T *get_resource(Handle<T> handle)
+{
+  return resource_pool<T>().get(handle);
+}
+
+template<typename T>
+void acquire_resource(Handle<T> handle)
+{
+  resource_pool<T>().acquire(handle);
+}
+
+template<typename T>
+void release_resource(Handle<T> handle)
+{
+  resource_pool<T>().release(handle);
+}
+
+// game thread at frame start, destroys resources released ResourceFramesInFlight frames ago
+void update_resources();
+// after the render thread is stopped, destroys every resource and replays their GL cleanup
+void close_resources();
+std::vector<ResourceStats> resource_stats();
+void resources_menu();
@@ -5,6 +5,13 @@ using time_point = std::chrono::high_resolution_clock::time_point;
 
 static time_point startTime, curTime;
 static float savedTime, deltaTime; // in seconds
+static float fixedDeltaTime = 0.f;
+
+// deterministic simulation step for benchmarks, 0 returns to wall clock
+void set_fixed_delta_time(float delta_time)
+{
+  fixedDeltaTime = delta_time;
+}
 
 void start_time()
 {
@@ -14,6 +21,12 @@ void start_time()
 
 void update_time()
 {
+  if (fixedDeltaTime > 0.f)
+  {
+    deltaTime = fixedDeltaTime;
+    savedTime += fixedDeltaTime;
+    return;
+  }
   time_point newTime = std::chrono::high_resolution_clock::now();
   std::chrono::duration<float> d = newTime - curTime;
   deltaTime = d.count();
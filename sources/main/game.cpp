@@ -2,8 +2,25 @@
 #include <render/direction_light.h>
 #include <render/material.h>
 #include <render/mesh.h>
+#include <render/ring_buffer.h>
+#include <render/render_device.h>
+#include <render/global_render_data.h>
+#include <render/frustum_culling.h>
+#include <render/occlusion_culling.h>
+#include <render/debug_arrow.h>
+#include <render/animation_texture.h>
+#include <animation/state_machine.h>
+#include <animation/animation_lod.h>
+#include <animation/motion_matching.h>
 #include "camera.h"
 #include <application.h>
+#include <job_system.h>
+#include <profiler.h>
+#include <frame_statistics.h>
+#include <render_thread.h>
+#include <ecs.h>
+#include <imgui/imgui.h>
+#include <algorithm>
 
 struct UserCamera
 {
@@ -12,11 +29,53 @@ struct UserCamera
   ArcballCamera arcballCamera;
 };
 
-struct Character
+// character components, every character has all of them
+struct Transform
 {
-  glm::mat4 transform;
-  MeshPtr mesh;
-  MaterialPtr material;
+  mat4 matrix;
+};
+
+// owns one reference of each resource
+struct MeshRenderer
+{
+  MeshHandle mesh;
+  MaterialHandle material;
+};
+
+// model space bone transforms, empty for meshes without skeleton
+struct BonePose
+{
+  std::vector<mat4> modelPose;
+  bool simpleShading = false; // set by animation LOD
+};
+
+// index of the character in the state machine batch
+struct Animator
+{
+  int index = -1;
+  int lod = 0;
+  bool updated = false; // pose was evaluated this frame
+  int framesSinceUpdate = 0;
+  // model poses of the last two updates, reduced rate LODs interpolate between them
+  std::vector<mat4> previousPose;
+  std::vector<mat4> nextPose;
+};
+
+// character driven by motion matching instead of the state machine batch
+struct MotionMatchedCharacter
+{
+  MotionMatcher matcher;
+  std::vector<BoneTransform> pose;
+};
+
+struct Bounds
+{
+  BoundingBox box;
+};
+
+struct Visibility
+{
+  bool visible = true;
 };
 
 struct Scene
@@ -25,11 +84,173 @@ struct Scene
 
   UserCamera userCamera;
 
-  std::vector<Character> characters;
+  ecs::World world;
+  ecs::Scheduler updateSystems;
+  mat4 viewProjection;
+
+  CullingSpheres cullingSpheres;
+  std::vector<uint8_t> visibility;
+
+  bool occlusionCulling = true;
+  bool showSkeletons = false;
+  OcclusionBuffer occlusionBuffer;
+  OccluderMesh ground;
+  mat4 groundTransform;
+  std::vector<mat4> occluderHulls;
+  JobHandle occlusionJob;
 
+  StateMachine locomotion;
+  std::unique_ptr<StateMachineBatch> animators;
+  int speedParameter = -1;
+  int breathingParameter = -1;
+  std::vector<AnimationLodLevel> animationLods;
+  BoneMask reducedBones; // fingers and face are skipped by far LODs
+  MaterialHandle simpleMaterial; // LOD1 variant of the character material, for poses with simpleShading
+  PoseCache poseCache;
+  float animationMs = 0.f;
+  int animationFrames = 0;
+  int evaluatedPoses = 0; // sum over frames
+  StateMachineStats animationStats; // sum over frames
+  std::unique_ptr<MotionDatabase> motionDatabase; // locomotion clips, only with motion matching
+  MotionKdTree motionTree;
+
+  // background crowd, skinned in the vertex shader from baked clips
+  AnimationTexture crowdAnimation;
+  MeshHandle crowdMesh;
+  MaterialHandle crowdMaterial;
+  CrowdBuffers crowd;
 };
 
 static std::unique_ptr<Scene> scene;
+static void register_update_systems();
+
+// stand-in for characters without animations in the file, bones swing around their bind pose
+static AnimationClipHandle make_procedural_clip(const char *name, const Skeleton &skeleton, float duration, float amplitude)
+{
+  const float sampleRate = 30.f;
+  int frameCount = (int)(duration * sampleRate) + 1;
+  int boneCount = skeleton.size();
+  std::vector<BoneTransform> samples(frameCount * boneCount);
+  for (int frame = 0; frame < frameCount; frame++)
+    for (int bone = 0; bone < boneCount; bone++)
+    {
+      float phase = PITWO * frame / (frameCount - 1) + bone;
+      BoneTransform &transform = samples[frame * boneCount + bone];
+      transform = to_bone_transform(skeleton.localBindPose[bone]);
+      transform.rotation = transform.rotation * glm::angleAxis(amplitude * std::sin(phase), vec3(1.f, 0.f, 0.f));
+    }
+  return make_animation_clip(name, boneCount, frameCount, sampleRate, std::move(samples));
+}
+
+// idle and a walk/run blend space, switched by the speed parameter
+static void create_locomotion(const char *path, const Skeleton &skeleton, TransitionMode mode)
+{
+  std::vector<AnimationClipHandle> clips = load_animation_clips(path, skeleton);
+  if (clips.size() < 3)
+  {
+    for (AnimationClipHandle clip : clips)
+      release_resource(clip);
+    clips = {
+      make_procedural_clip("idle", skeleton, 3.f, 0.02f),
+      make_procedural_clip("walk", skeleton, 1.2f, 0.15f),
+      make_procedural_clip("run", skeleton, 0.8f, 0.3f)};
+  }
+  StateMachine &machine = scene->locomotion;
+  BlendTree &tree = machine.tree;
+  int speed = scene->speedParameter = tree.add_parameter("speed");
+  int idle = tree.add_clip(clips[0]);
+  int move = tree.add_blend_space_1d(speed, {tree.add_clip(clips[1]), tree.add_clip(clips[2])}, {1.f, 4.f});
+  if (application_settings().crowdCount > 0)
+    scene->crowdAnimation = bake_animation_texture(skeleton, clips, application_settings().crowdHalfPrecision);
+  if (application_settings().motionMatching || application_settings().motionMatchingBenchmark > 0)
+  {
+    auto database = std::make_unique<MotionDatabase>(skeleton, MotionFeatureSettings());
+    for (AnimationClipHandle clip : clips)
+      database->add_clip(clip);
+    database->build();
+    if (application_settings().motionMatchingBenchmark > 0)
+      benchmark_motion_search(*database, application_settings().motionMatchingBenchmark);
+    if (application_settings().motionMatching && database->size() > 0)
+    {
+      scene->motionTree.build(*database);
+      scene->motionDatabase = std::move(database);
+    }
+  }
+  for (AnimationClipHandle clip : clips)
+    release_resource(clip);
+
+  int group = machine.add_group("locomotion");
+  int idleState = machine.add_state("idle", idle, group);
+  int moveState = machine.add_state("move", move, group);
+  machine.add_transition(idleState, moveState, 0.25f, {{speed, ConditionType::Greater, 0.1f}}, -1.f, mode);
+  machine.add_transition(moveState, idleState, 0.25f, {{speed, ConditionType::Less, 0.1f}}, -1.f, mode);
+
+  std::vector<BoneTransform> bindPose(skeleton.size());
+  for (int i = 0; i < skeleton.size(); i++)
+    bindPose[i] = to_bone_transform(skeleton.localBindPose[i]);
+
+  // additive breathing over the upper body, it fades out while moving
+  auto spine = std::find_if(skeleton.names.begin(), skeleton.names.end(), [](const std::string &name) { return name.find("Spine") != std::string::npos; });
+  if (spine != skeleton.names.end())
+  {
+    AnimationClipHandle breathe = make_procedural_clip("breathe", skeleton, 4.f, 0.05f);
+    AnimationClipHandle additive = make_additive_clip(*get_resource(breathe), bindPose.data());
+    scene->breathingParameter = tree.add_parameter("breathing");
+    machine.add_layer("breathing", tree.add_clip(additive), LayerBlend::Additive, make_bone_mask(skeleton, {{*spine, 1.f}}), scene->breathingParameter);
+    release_resource(breathe);
+    release_resource(additive);
+  }
+  machine.build();
+  scene->animators = std::make_unique<StateMachineBatch>(machine, skeleton.size());
+  scene->animators->restPose = std::move(bindPose);
+  if (application_settings().poseCacheStep >= 0.f)
+  {
+    scene->poseCache.timeStep = application_settings().poseCacheStep;
+    scene->animators->poseCache = &scene->poseCache;
+  }
+
+  if (application_settings().animationLod)
+    scene->animationLods = {{0.f, 1, false, false}, {5.f, 2, false, false}, {15.f, 4, true, true}, {30.f, 8, true, true}};
+  else
+    scene->animationLods = {{0.f, 1, false, false}};
+  scene->reducedBones = make_reduced_bone_mask(skeleton,
+    {"Finger", "Thumb", "Index", "Middle", "Ring", "Pinky", "Eye", "Jaw", "Lip", "Brow", "Cheek", "Tongue"});
+}
+
+// instances stand on a grid behind the characters, each plays a clip from its own time
+static void create_crowd(MeshHandle mesh, Texture2DHandle texture, float characters_extent)
+{
+  const AnimationTexture &animation = scene->crowdAnimation;
+  const int count = application_settings().crowdCount;
+  if (count <= 0 || !animation.texture)
+    return;
+  register_crowd_layouts();
+  scene->crowdMaterial = make_material("sources/shaders/crowd.glsl");
+  Material *material = get_resource(scene->crowdMaterial);
+  material->set_property("mainTex", texture);
+  material->set_property("AnimationTexture", animation.texture);
+  acquire_resource(mesh);
+  scene->crowdMesh = mesh;
+
+  const int gridSize = (int)std::ceil(std::sqrt((float)count));
+  const float spacing = 1.2f;
+  const float back = characters_extent * 0.5f + 2.f;
+  std::vector<CrowdInstance> instances(count);
+  for (int i = 0; i < count; i++)
+  {
+    // cheap hash, so the crowd doesn't move in lockstep
+    uint32_t h = (uint32_t)i * 2654435761u;
+    float yaw = (h >> 8 & 0xff) / 255.f * PITWO;
+    vec3 position = vec3(i % gridSize - (gridSize - 1) * 0.5f, 0.f, -back - i / gridSize) * spacing;
+    mat4 transform = glm::rotate(glm::translate(glm::mat4(1.f), position), yaw, vec3(0.f, 1.f, 0.f));
+    CrowdInstance &instance = instances[i];
+    for (int j = 0; j < 3; j++)
+      instance.rows[j] = vec4(transform[0][j], transform[1][j], transform[2][j], transform[3][j]);
+    instance.clip = (h >> 16) % animation.clips.size();
+    instance.startTime = (h >> 4 & 0xfff) / 4095.f * animation.clips[instance.clip].duration;
+  }
+  scene->crowd = create_crowd_buffers(animation, instances.data(), count);
+}
 
 void game_init()
 {
@@ -53,23 +274,355 @@ void game_init()
 
   scene->userCamera.transform = calculate_transform(scene->userCamera.arcballCamera);
 
+  scene->ground = make_plane_occluder();
+  scene->groundTransform = glm::scale(glm::mat4(1.f), glm::vec3(100.f, 1.f, 100.f));
+
   input.onMouseButtonEvent += [](const SDL_MouseButtonEvent &e) { arccam_mouse_click_handler(e, scene->userCamera.arcballCamera); };
   input.onMouseMotionEvent += [](const SDL_MouseMotionEvent &e) { arccam_mouse_move_handler(e, scene->userCamera.arcballCamera); };
   input.onMouseWheelEvent += [](const SDL_MouseWheelEvent &e) { arccam_mouse_wheel_handler(e, scene->userCamera.arcballCamera); };
 
 
-  auto material = make_material("character", "sources/shaders/character_vs.glsl", "sources/shaders/character_ps.glsl");
+  MaterialHandle material = make_material("sources/shaders/character.glsl", {"SKINNING"});
   std::fflush(stdout);
-  material->set_property("mainTex", create_texture2d("resources/MotusMan_v55/MCG_diff.jpg"));
+  Texture2DHandle texture = create_texture2d("resources/MotusMan_v55/MCG_diff.jpg");
+  get_resource(material)->set_property("mainTex", texture);
+  get_resource(material)->set_property("Shininess", 1.3f);
+  get_resource(material)->set_property("Metallness", 0.4f);
+  scene->simpleMaterial = make_material("sources/shaders/character.glsl", {"SKINNING", "LOD1"});
+  get_resource(scene->simpleMaterial)->set_property("mainTex", texture);
+  get_resource(scene->simpleMaterial)->set_property("Shininess", 1.3f);
+  get_resource(scene->simpleMaterial)->set_property("Metallness", 0.4f);
 
-  scene->characters.emplace_back(Character{
-    glm::identity<glm::mat4>(),
-    load_mesh("resources/MotusMan_v55/MotusMan_v55.fbx", 0),
-    std::move(material)
-  });
+  MeshHandle mesh = load_mesh("resources/MotusMan_v55/MotusMan_v55.fbx", 0);
+  const Skeleton *skeleton = get_resource(mesh)->skeleton.get();
+  if (skeleton)
+    create_locomotion("resources/MotusMan_v55/MotusMan_v55.fbx", *skeleton,
+      application_settings().crossfadeTransitions ? TransitionMode::Crossfade : TransitionMode::Inertialization);
+
+  // characters stand on a square grid around the origin, each of them owns references to mesh and material
+  const int characterCount = max(application_settings().characterCount, 1);
+  const int gridSize = (int)std::ceil(std::sqrt((float)characterCount));
+  const float spacing = 1.5f;
+  for (int i = 0; i < characterCount; i++)
+  {
+    if (i > 0)
+    {
+      acquire_resource(mesh);
+      acquire_resource(material);
+    }
+    vec3 position = vec3(i % gridSize - (gridSize - 1) * 0.5f, 0.f, i / gridSize - (gridSize - 1) * 0.5f) * spacing;
+    Transform transform{glm::translate(glm::mat4(1.f), position)};
+    BonePose pose;
+    if (skeleton)
+    {
+      pose.modelPose.resize(skeleton->size());
+      calculate_model_pose(*skeleton, skeleton->localBindPose.data(), pose.modelPose.data());
+      Animator animator;
+      animator.index = scene->animators->add_character();
+      scene->world.create(transform, MeshRenderer{mesh, material}, std::move(pose), Bounds{}, Visibility{}, std::move(animator));
+    }
+    else
+      scene->world.create(transform, MeshRenderer{mesh, material}, std::move(pose), Bounds{}, Visibility{});
+  }
+  if (scene->motionDatabase)
+  {
+    acquire_resource(mesh);
+    acquire_resource(material);
+    Transform transform{glm::translate(glm::mat4(1.f), vec3(0.f, 0.f, (gridSize + 1) * 0.5f * spacing))};
+    BonePose pose;
+    pose.modelPose.resize(skeleton->size());
+    calculate_model_pose(*skeleton, skeleton->localBindPose.data(), pose.modelPose.data());
+    MotionMatchedCharacter character;
+    character.matcher.database = scene->motionDatabase.get();
+    character.matcher.tree = &scene->motionTree;
+    character.pose.resize(skeleton->size());
+    scene->world.create(transform, MeshRenderer{mesh, material}, std::move(pose), Bounds{}, Visibility{}, std::move(character));
+  }
+  create_crowd(mesh, texture, gridSize * spacing);
+  release_resource(texture);
+  register_update_systems();
   std::fflush(stdout);
 }
 
+void game_close()
+{
+  if (scene->animationFrames > 0 && scene->animators)
+  {
+    const StateMachineStats &stats = scene->animationStats;
+    float characterFrames = (float)scene->animationFrames * max(scene->animators->count, 1);
+    debug_log("animation: %d characters, %s transitions, %.2f clips sampled per character frame, %d transitions, %.1f%% crossfading, %.1f%% inertializing, %.1f layer bones per character frame, %.1f%% poses evaluated",
+      scene->animators->count, application_settings().crossfadeTransitions ? "crossfade" : "inertialization",
+      stats.tree.sampledClips / characterFrames, stats.transitions,
+      stats.crossfades * 100.f / characterFrames, stats.inertializations * 100.f / characterFrames, stats.layerBones / characterFrames,
+      scene->evaluatedPoses * 100.f / characterFrames);
+    scene->world.each<const MotionMatchedCharacter>([](const MotionMatchedCharacter &character)
+    {
+      debug_log("motion matching: %d searches, %d jumps", character.matcher.searches, character.matcher.jumps);
+    });
+    PoseCacheStats cache = scene->poseCache.stats();
+    if (cache.hits + cache.misses > 0)
+      debug_log("pose cache: %.3f s step, %lld hits, %lld misses, %.1f%% hit rate", scene->poseCache.timeStep,
+        (long long)cache.hits, (long long)cache.misses, cache.hits * 100.0 / (cache.hits + cache.misses));
+  }
+  scene->world.each<const MeshRenderer>([](const MeshRenderer &renderer)
+  {
+    release_resource(renderer.mesh);
+    release_resource(renderer.material);
+  });
+  release_resource(scene->crowdMesh);
+  release_resource(scene->crowdMaterial);
+  release_resource(scene->simpleMaterial);
+  release_crowd_buffers(scene->crowd);
+  release_animation_texture(scene->crowdAnimation);
+  scene.reset();
+}
+
+
+// inner boxes of the biggest bones, they hold no vertex of their bone, so they stay inside the character
+static void gather_occluder_hulls(const mat4 &transform, const Skeleton &skeleton, const mat4 *model_pose, std::vector<mat4> &hulls)
+{
+  const float minRadiusRatio = 0.5f;
+  if ((int)skeleton.boneInnerBoxes.size() != skeleton.size())
+    return;
+  float maxRadius = 0.f;
+  for (const vec4 &sphere : skeleton.boneBounds)
+    maxRadius = max(maxRadius, sphere.w);
+  for (int i = 0; i < skeleton.size(); i++)
+  {
+    const vec4 &sphere = skeleton.boneBounds[i];
+    const BoundingBox &box = skeleton.boneInnerBoxes[i];
+    if (sphere.w > 0.f && sphere.w >= maxRadius * minRadiusRatio)
+      hulls.push_back(transform * model_pose[i] *
+        glm::scale(glm::translate(glm::mat4(1.f), (box.minPoint + box.maxPoint) * 0.5f), (box.maxPoint - box.minPoint) * 0.5f));
+  }
+}
+
+// rasterizes occluders on a worker while the main thread updates animation
+static void start_occlusion_culling(const mat4 &view_projection)
+{
+  scene->occluderHulls.clear();
+  scene->world.each<const Transform, const MeshRenderer, const BonePose, const Visibility>(
+    [](const Transform &transform, const MeshRenderer &renderer, const BonePose &pose, const Visibility &visibility)
+  {
+    const Skeleton *skeleton = get_resource(renderer.mesh)->skeleton.get();
+    if (visibility.visible && skeleton)
+      gather_occluder_hulls(transform.matrix, *skeleton, pose.modelPose.data(), scene->occluderHulls);
+  });
+
+  scene->occlusionJob = add_job([view_projection]()
+  {
+    PROFILE_SCOPE("occlusion_rasterize");
+    OcclusionBuffer &buffer = scene->occlusionBuffer;
+    buffer.begin(view_projection);
+    const OccluderMesh &ground = scene->ground;
+    buffer.rasterize(ground.vertices.data(), ground.indices.data(), ground.indices.size(), scene->groundTransform);
+    for (const mat4 &hull : scene->occluderHulls)
+      buffer.rasterize_box(hull);
+    buffer.build_hierarchy();
+  });
+}
+
+// shared scene data is declared in read and write sets the same way as components
+static void register_update_systems()
+{
+  ecs::Scheduler &systems = scene->updateSystems;
+
+  // All characters are stepped in one pass. Poses are evaluated for characters due by their LOD,
+  // lists of one bone set are split into ranges with clip reads grouped inside a range.
+  systems.add("animation", ecs::component_mask<Transform, MeshRenderer, UserCamera>(), ecs::component_mask<Animator, BonePose, StateMachineBatch>(),
+    [](ecs::World &world)
+  {
+    StateMachineBatch *animators = scene->animators.get();
+    if (!animators)
+      return;
+    uint64_t start = profiler_time();
+    scene->poseCache.begin_frame();
+    float time = get_time();
+    for (int i = 0; i < animators->count; i++)
+    {
+      float *parameters = animators->character_parameters(i);
+      parameters[scene->speedParameter] = 2.f + 2.f * std::sin(time * 0.5f + i);
+      if (scene->breathingParameter >= 0)
+        parameters[scene->breathingParameter] = 1.f - parameters[scene->speedParameter] * 0.5f;
+    }
+    StateMachineStats &stats = scene->animationStats;
+    update_state_machines(*animators, get_delta_time(), &stats);
+
+    const vec3 cameraPosition = vec3(scene->userCamera.transform[3]);
+    const uint64_t frame = profiler_frame_number();
+    FrameVector<int> fullBones, reducedBones;
+    world.for_each_chunk<const Transform, Animator>([&](int count, int, const Transform *transforms, Animator *animator)
+    {
+      for (int i = 0; i < count; i++)
+      {
+        Animator &a = animator[i];
+        a.lod = select_animation_lod(scene->animationLods, length(vec3(transforms[i].matrix[3]) - cameraPosition));
+        const AnimationLodLevel &level = scene->animationLods[a.lod];
+        a.updated = animation_update_due(level.updateInterval, a.index, frame);
+        if (a.updated)
+          (level.reducedBones ? reducedBones : fullBones).push_back(a.index);
+      }
+    });
+
+    const int batchSize = 16;
+    auto evaluate = [&](const FrameVector<int> &characters, const BoneMask *mask)
+    {
+      if (characters.empty())
+        return;
+      FrameVector<StateMachineStats> rangeStats((characters.size() + batchSize - 1) / batchSize);
+      parallel_for(characters.size(), batchSize, [&](int begin, int end)
+      {
+        PROFILE_SCOPE("evaluate_state_machines");
+        evaluate_state_machines(*animators, characters.data() + begin, end - begin, mask, &rangeStats[begin / batchSize]);
+      });
+      for (const StateMachineStats &range : rangeStats)
+      {
+        stats.crossfades += range.crossfades;
+        stats.inertializations += range.inertializations;
+        stats.tree.sampledClips += range.tree.sampledClips;
+        stats.tree.skippedNodes += range.tree.skippedNodes;
+        stats.layerBones += range.layerBones;
+      }
+    };
+    evaluate(fullBones, nullptr);
+    evaluate(reducedBones, &scene->reducedBones);
+    scene->evaluatedPoses += fullBones.size() + reducedBones.size();
+
+    world.parallel_for_each_chunk<const MeshRenderer, Animator, BonePose>(
+      [animators](int count, int, const MeshRenderer *renderers, Animator *animator, BonePose *poses)
+    {
+      for (int i = 0; i < count; i++)
+      {
+        const Skeleton &skeleton = *get_resource(renderers[i].mesh)->skeleton;
+        Animator &a = animator[i];
+        mat4 *modelPose = poses[i].modelPose.data();
+        poses[i].simpleShading = scene->animationLods[a.lod].simpleShading;
+        int interval = scene->animationLods[a.lod].updateInterval;
+        if (interval <= 1)
+        {
+          calculate_model_pose(skeleton, animators->pose(a.index), modelPose);
+          a.nextPose.clear();
+          continue;
+        }
+        if (a.updated)
+        {
+          std::swap(a.previousPose, a.nextPose);
+          a.nextPose.resize(skeleton.size());
+          calculate_model_pose(skeleton, animators->pose(a.index), a.nextPose.data());
+          if (a.previousPose.size() != a.nextPose.size())
+            a.previousPose = a.nextPose;
+          a.framesSinceUpdate = 0;
+        }
+        else if (a.nextPose.empty())
+          continue; // keeps the last full rate pose until the first update
+        else
+          a.framesSinceUpdate++;
+        // the in-between runs one interval behind, it reaches the newest pose right before the next update
+        float t = min((a.framesSinceUpdate + 1.f) / interval, 1.f);
+        interpolate_model_pose(modelPose, a.previousPose.data(), a.nextPose.data(), t, skeleton.size());
+      }
+    });
+    scene->animationMs = (profiler_time() - start) * 1e-6f;
+    scene->animationFrames++;
+  });
+
+  // the desired trajectory turns at a constant rate, speed changes the same way as for the state machine characters
+  systems.add("motion_matching", ecs::component_mask<MeshRenderer, MotionKdTree>(), ecs::component_mask<MotionMatchedCharacter, BonePose>(),
+    [](ecs::World &world)
+  {
+    if (!scene->motionDatabase)
+      return;
+    const float time = get_time();
+    const float speed = 2.f + 2.f * std::sin(time * 0.5f);
+    const float turnRate = 0.5f; // radians per second
+    vec2 positions[MotionTrajectorySamples], directions[MotionTrajectorySamples];
+    for (int s = 0; s < MotionTrajectorySamples; s++)
+    {
+      float t = scene->motionDatabase->settings.trajectoryTimes[s];
+      float angle = turnRate * t;
+      directions[s] = vec2(std::sin(angle), std::cos(angle));
+      // chord of the arc, its length is close to the arc length for small angles
+      positions[s] = vec2(std::sin(angle * 0.5f), std::cos(angle * 0.5f)) * speed * t;
+    }
+    world.each<const MeshRenderer, MotionMatchedCharacter, BonePose>(
+      [&](const MeshRenderer &renderer, MotionMatchedCharacter &character, BonePose &pose)
+    {
+      character.matcher.update(get_delta_time(), positions, directions);
+      character.matcher.sample(character.pose.data());
+      calculate_model_pose(*get_resource(renderer.mesh)->skeleton, character.pose.data(), pose.modelPose.data());
+    });
+  });
+
+  systems.add("skinned_bounds", ecs::component_mask<Transform, MeshRenderer, BonePose>(), ecs::component_mask<Bounds>(), [](ecs::World &world)
+  {
+    world.parallel_for_each_chunk<const Transform, const MeshRenderer, const BonePose, Bounds>(
+      [](int count, int, const Transform *transforms, const MeshRenderer *renderers, const BonePose *poses, Bounds *bounds)
+    {
+      for (int i = 0; i < count; i++)
+      {
+        const mat4 &transform = transforms[i].matrix;
+        if (const Skeleton *skeleton = get_resource(renderers[i].mesh)->skeleton.get())
+          bounds[i].box = calculate_skinned_bounds(*skeleton, transform, poses[i].modelPose.data());
+        else
+          bounds[i].box = {vec3(transform[3]), vec3(transform[3])};
+      }
+    });
+  });
+
+  systems.add("frustum_culling", ecs::component_mask<Bounds>(), ecs::component_mask<Visibility, CullingSpheres>(), [](ecs::World &world)
+  {
+    CullingSpheres &spheres = scene->cullingSpheres;
+    spheres.resize(world.count<Bounds, Visibility>());
+    world.for_each_chunk<const Bounds, Visibility>([&](int count, int first_index, const Bounds *bounds, Visibility *)
+    {
+      for (int i = 0; i < count; i++)
+      {
+        const BoundingBox &box = bounds[i].box;
+        vec3 center = (box.minPoint + box.maxPoint) * 0.5f;
+        spheres.set(first_index + i, center, length(box.maxPoint - center));
+      }
+    });
+    frustum_cull(extract_frustum(scene->viewProjection), spheres, scene->visibility);
+    world.for_each_chunk<const Bounds, Visibility>([](int count, int first_index, const Bounds *, Visibility *visibility)
+    {
+      for (int i = 0; i < count; i++)
+        visibility[i].visible = scene->visibility[first_index + i];
+    });
+  });
+
+  systems.add("occlusion_culling", ecs::component_mask<Bounds, OcclusionBuffer>(), ecs::component_mask<Visibility>(), [](ecs::World &world)
+  {
+    {
+      PROFILE_SCOPE("wait_occlusion");
+      wait_job(scene->occlusionJob);
+    }
+    if (!scene->occlusionCulling)
+      return;
+    world.parallel_for_each_chunk<const Bounds, Visibility>([](int count, int, const Bounds *bounds, Visibility *visibility)
+    {
+      PROFILE_SCOPE("occlusion_test");
+      for (int i = 0; i < count; i++)
+        if (visibility[i].visible && !scene->occlusionBuffer.is_visible(bounds[i].box))
+          visibility[i].visible = false;
+    });
+  });
+
+  systems.add("draw_skeletons", ecs::component_mask<Transform, MeshRenderer, BonePose, Visibility>(), 0, [](ecs::World &world)
+  {
+    if (!scene->showSkeletons)
+      return;
+    world.parallel_for_each_chunk<const Transform, const MeshRenderer, const BonePose, const Visibility>(
+      [](int count, int, const Transform *transforms, const MeshRenderer *renderers, const BonePose *poses, const Visibility *visibility)
+    {
+      for (int i = 0; i < count; i++)
+      {
+        const Skeleton *skeleton = get_resource(renderers[i].mesh)->skeleton.get();
+        if (visibility[i].visible && skeleton)
+          draw_skeleton(*skeleton, transforms[i].matrix, poses[i].modelPose.data(), vec3(1.f, 0.8f, 0.2f));
+      }
+    });
+  });
+}
 
 void game_update()
 {
@@ -77,38 +630,104 @@ void game_update()
     scene->userCamera.arcballCamera,
     scene->userCamera.transform,
     get_delta_time());
+
+  scene->viewProjection = scene->userCamera.projection * inverse(scene->userCamera.transform);
+  if (scene->occlusionCulling)
+    start_occlusion_culling(scene->viewProjection);
+
+  scene->updateSystems.run(scene->world);
+  scene->occlusionJob = nullptr;
+  if (application_settings().frameCount > 0 && scene->animators)
+    frame_statistics().add("animation", scene->animationMs);
 }
 
-void render_character(const Character &character, const mat4 &cameraProjView, vec3 cameraPosition, const DirectionLight &light)
+void game_imgui()
 {
-  const Material &material = *character.material;
-  const Shader &shader = material.get_shader();
+  if (ImGui::BeginMenu("Debug"))
+  {
+    ImGui::Checkbox("Show skeletons", &scene->showSkeletons);
+    ImGui::Checkbox("Occlusion culling", &scene->occlusionCulling);
+    ImGui::EndMenu();
+  }
+}
 
-  shader.use();
-  material.bind_uniforms_to_shader();
-  shader.set_mat4x4("Transform", character.transform);
-  shader.set_mat4x4("ViewProjection", cameraProjView);
-  shader.set_vec3("CameraPosition", cameraPosition);
-  shader.set_vec3("LightDirection", glm::normalize(light.lightDirection));
-  shader.set_vec3("AmbientLight", light.ambient);
-  shader.set_vec3("SunLight", light.lightColor);
+// game thread part of character drawing, palette and draw data are written here and copied to the ring buffer on replay
+// resources can't be destroyed before the frame is replayed, so the command keeps plain pointers
+static void render_character(const mat4 &transform, const MeshRenderer &renderer, const BonePose &pose)
+{
+  const Mesh *mesh = get_resource(renderer.mesh);
+  const Material *material = get_resource(pose.simpleShading ? scene->simpleMaterial : renderer.material);
+  const mat4 *palette = nullptr;
+  int boneCount = 0;
+  if (const Skeleton *skeleton = mesh->skeleton.get())
+  {
+    boneCount = skeleton->size();
+    mat4 *data = allocate_render_data<mat4>(boneCount);
+    calculate_skinning_palette(*skeleton, pose.modelPose.data(), data);
+    palette = data;
+  }
+  const Shader &shader = material->get_shader();
+  char *drawData = nullptr;
+  const int drawDataSize = shader.drawDataSize;
+  if (drawDataSize > 0)
+  {
+    drawData = (char *)allocate_render_data(drawDataSize);
+    memset(drawData, 0, drawDataSize);
+    shader.drawTransform.write(drawData, transform);
+  }
 
-  render(character.mesh);
+  enqueue_render_command([material, mesh, palette, boneCount, drawData, drawDataSize]()
+  {
+    if (palette && !upload_storage_block(SkinningPaletteBinding, palette, sizeof(mat4) * boneCount))
+      return;
+    if (drawData && !upload_uniform_block(DrawDataBinding, drawData, drawDataSize))
+      return;
+    const Shader &shader = material->get_shader();
+    shader.use();
+    material->bind_uniforms_to_shader();
+    render(*mesh);
+  });
 }
 
 void game_render()
 {
-  glEnable(GL_DEPTH_TEST);
-  glDisable(GL_BLEND);
-  const float grayColor = 0.3f;
-  glClearColor(grayColor, grayColor, grayColor, 1.f);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-
   const mat4 &projection = scene->userCamera.projection;
   const glm::mat4 &transform = scene->userCamera.transform;
-  mat4 projView = projection * inverse(transform);
+  const DirectionLight &light = scene->light;
+
+  GlobalRenderData globalData;
+  globalData.viewProjection = projection * inverse(transform);
+  globalData.cameraPosition = glm::vec3(transform[3]);
+  globalData.lightDirection = glm::normalize(light.lightDirection);
+  globalData.ambientLight = light.ambient;
+  globalData.sunLight = light.lightColor;
 
-  for (const Character &character : scene->characters)
-    render_character(character, projView, glm::vec3(transform[3]), scene->light);
-}
\ No newline at end of file
+  enqueue_render_command([globalData]()
+  {
+    RenderDevice &device = render_device();
+    device.set_depth_state(true, GL_LESS, true);
+    device.set_blend(false);
+    const float grayColor = 0.3f;
+    device.clear(vec4(grayColor, grayColor, grayColor, 1.f), GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    upload_uniform_block(GlobalRenderDataBinding, &globalData, sizeof(globalData));
+  });
+
+  {
+    RENDER_PROFILE_SCOPE("characters");
+    scene->world.each<const Transform, const MeshRenderer, const BonePose, const Visibility>(
+      [](const Transform &transform, const MeshRenderer &renderer, const BonePose &pose, const Visibility &visibility)
+    {
+      if (visibility.visible)
+        render_character(transform.matrix, renderer, pose);
+    });
+  }
+  if (scene->crowd.count > 0)
+  {
+    RENDER_PROFILE_SCOPE("crowd");
+    render_crowd(*get_resource(scene->crowdMesh), *get_resource(scene->crowdMaterial), scene->crowd, get_time());
+  }
+  {
+    RENDER_PROFILE_SCOPE("debug_primitives");
+    render_debug_primitives();
+  }
+}
@@ -0,0 +1,134 @@
+#include "animation_texture.h"
+#include "global_render_data.h"
+#include "render_device.h"
+#include "shader.h"
+#include <cstring>
+#include <log.h>
+#include <render_thread.h>
+
+int AnimationTexture::find_clip(const char *name) const
+{
+  for (int i = 0, n = clips.size(); i < n; i++)
+    if (clips[i].name == name)
+      return i;
+  return -1;
+}
+
+AnimationTexture bake_animation_texture(const Skeleton &skeleton, const std::vector<AnimationClipHandle> &clips, bool half_precision)
+{
+  AnimationTexture result;
+  result.boneCount = skeleton.size();
+  for (AnimationClipHandle handle : clips)
+  {
+    const AnimationClip &clip = *get_resource(handle);
+    if (clip.boneCount != result.boneCount)
+    {
+      debug_error("clip %s has %d bones, skeleton has %d, it isn't baked", clip.name.c_str(), clip.boneCount, result.boneCount);
+      continue;
+    }
+    result.clips.push_back({clip.name, result.frameCount, clip.frameCount, clip.sampleRate, clip.duration});
+    result.frameCount += clip.frameCount;
+  }
+  if (result.frameCount == 0)
+    return result;
+
+  const int rowSize = result.boneCount * 3;
+  std::vector<vec4> texels((size_t)rowSize * result.frameCount);
+  std::vector<mat4> modelPose(result.boneCount), palette(result.boneCount);
+  int row = 0;
+  for (AnimationClipHandle handle : clips)
+  {
+    const AnimationClip &clip = *get_resource(handle);
+    if (clip.boneCount != result.boneCount)
+      continue;
+    for (int frame = 0; frame < clip.frameCount; frame++, row++)
+    {
+      calculate_model_pose(skeleton, clip.frame(frame), modelPose.data());
+      calculate_skinning_palette(skeleton, modelPose.data(), palette.data());
+      vec4 *dst = texels.data() + (size_t)row * rowSize;
+      for (const mat4 &m : palette)
+        for (int i = 0; i < 3; i++)
+          *dst++ = vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    }
+  }
+  result.texture = create_float_texture2d(rowSize, result.frameCount, &texels[0].x, half_precision);
+  debug_log("baked %d clips, %d frames of %d bones to %dx%d %s texture", (int)result.clips.size(), result.frameCount,
+    result.boneCount, rowSize, result.frameCount, half_precision ? "half" : "float");
+  return result;
+}
+
+void release_animation_texture(AnimationTexture &animation)
+{
+  release_resource(animation.texture);
+  animation = AnimationTexture();
+}
+
+void register_crowd_layouts()
+{
+  register_block_layout({"CrowdInstances", 0, sizeof(CrowdInstance), {
+    BlockLayoutField{"instances[0].Rows[0]", GL_FLOAT_VEC4, offsetof(CrowdInstance, rows)},
+    BlockLayoutField{"instances[0].Clip", GL_INT, offsetof(CrowdInstance, clip)},
+    BlockLayoutField{"instances[0].StartTime", GL_FLOAT, offsetof(CrowdInstance, startTime)}}});
+  register_block_layout({"BakedClips", 0, sizeof(BakedClipData), {
+    BlockLayoutField{"clips[0].FirstFrame", GL_INT, offsetof(BakedClipData, firstFrame)},
+    BlockLayoutField{"clips[0].FrameCount", GL_INT, offsetof(BakedClipData, frameCount)},
+    BlockLayoutField{"clips[0].SampleRate", GL_FLOAT, offsetof(BakedClipData, sampleRate)},
+    BlockLayoutField{"clips[0].Duration", GL_FLOAT, offsetof(BakedClipData, duration)}}});
+}
+
+static GLuint create_storage_buffer(const void *data, size_t size)
+{
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_STATIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  return buffer;
+}
+
+CrowdBuffers create_crowd_buffers(const AnimationTexture &animation, const CrowdInstance *instances, int count)
+{
+  CrowdBuffers buffers;
+  int clipCount = animation.clips.size();
+  if (count == 0 || clipCount == 0)
+    return buffers;
+  std::vector<BakedClipData> clips(clipCount);
+  for (int i = 0; i < clipCount; i++)
+  {
+    const BakedClip &clip = animation.clips[i];
+    clips[i] = {clip.firstFrame, clip.frameCount, clip.sampleRate, clip.duration};
+  }
+  buffers.instances = create_storage_buffer(instances, sizeof(CrowdInstance) * count);
+  buffers.clips = create_storage_buffer(clips.data(), sizeof(BakedClipData) * clipCount);
+  buffers.count = count;
+  buffers.clipCount = clipCount;
+  return buffers;
+}
+
+void release_crowd_buffers(CrowdBuffers &buffers)
+{
+  if (buffers.count > 0)
+    enqueue_render_command([instances = buffers.instances, clips = buffers.clips]()
+    {
+      GLuint names[] = {instances, clips};
+      glDeleteBuffers(2, names);
+    });
+  buffers = CrowdBuffers();
+}
+
+void render_crowd(const Mesh &mesh, const Material &material, const CrowdBuffers &buffers, float time)
+{
+  if (buffers.count == 0)
+    return;
+  enqueue_render_command([mesh = &mesh, material = &material, buffers, time]()
+  {
+    RenderDevice &device = render_device();
+    device.bind_buffer_range(GL_SHADER_STORAGE_BUFFER, CrowdInstanceBinding, buffers.instances, 0, sizeof(CrowdInstance) * buffers.count);
+    device.bind_buffer_range(GL_SHADER_STORAGE_BUFFER, BakedClipBinding, buffers.clips, 0, sizeof(BakedClipData) * buffers.clipCount);
+    const Shader &shader = material->get_shader();
+    shader.use();
+    shader.set_float("CrowdTime", time);
+    material->bind_uniforms_to_shader();
+    render_instances(*mesh, buffers.count);
+  });
+}
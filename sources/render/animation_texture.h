@@ -0,0 +1,68 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <animation/animation_clip.h>
+#include "texture2d.h"
+#include "material.h"
+#include "mesh.h"
+
+// frames of a clip are texture rows firstFrame .. firstFrame + frameCount - 1
+struct BakedClip
+{
+  std::string name;
+  int firstFrame;
+  int frameCount;
+  float sampleRate;
+  float duration;
+};
+
+// Skinning palettes of clips baked for one skeleton: every row is a frame,
+// bone i takes texels 3i .. 3i + 2 with the rows of its affine matrix.
+struct AnimationTexture
+{
+  Texture2DHandle texture; // owns one reference
+  int boneCount = 0;
+  int frameCount = 0;
+  std::vector<BakedClip> clips;
+
+  int find_clip(const char *name) const;
+};
+
+// frames are taken at the rate of each clip, half precision keeps about three significant digits of translations
+AnimationTexture bake_animation_texture(const Skeleton &skeleton, const std::vector<AnimationClipHandle> &clips, bool half_precision = false);
+void release_animation_texture(AnimationTexture &animation);
+
+// std430 layout of Instance in crowd shader, affine transform stored by rows
+struct CrowdInstance
+{
+  vec4 rows[3];
+  int clip;
+  float startTime; // seconds added to CrowdTime, looped clips wrap the sum on the GPU
+  float pad[2];
+};
+
+// std430 layout of BakedClip in crowd shader
+struct BakedClipData
+{
+  int firstFrame;
+  int frameCount;
+  float sampleRate;
+  float duration;
+};
+
+// instances and clip table of a crowd in static storage buffers, they are uploaded once
+struct CrowdBuffers
+{
+  GLuint instances = 0;
+  GLuint clips = 0;
+  int count = 0;
+  int clipCount = 0;
+};
+
+// register before crowd shader is loaded
+void register_crowd_layouts();
+CrowdBuffers create_crowd_buffers(const AnimationTexture &animation, const CrowdInstance *instances, int count);
+void release_crowd_buffers(CrowdBuffers &buffers);
+// One instanced draw for the whole crowd, the material has to be made from crowd shader with the texture bound as AnimationTexture.
+// time is the only per frame data, it goes to CrowdTime uniform.
+void render_crowd(const Mesh &mesh, const Material &material, const CrowdBuffers &buffers, float time);
@@ -1,30 +1,138 @@
-/* #include <vector>
+#include <vector>
+#include <atomic>
+#include <cstring>
 #include "debug_arrow.h"
-#include "shader/shader.h"
-#include "resources/resources.h"
+#include "shader.h"
+#include "mesh.h"
+#include "ring_buffer.h"
+#include "render_device.h"
+#include "global_render_data.h"
+#include <render_thread.h>
+
+enum DebugPrimitive
+{
+  ArrowPrimitive,
+  BonePrimitive,
+  SpherePrimitive,
+  LinePrimitive,
+  PrimitiveCount
+};
+
+// std430 layout of Instance in debug shader, affine transform stored by rows
+struct DebugInstance
+{
+  vec4 rows[3];
+  vec4 color;
+};
+
+struct DebugThreadBuffer
+{
+  std::vector<DebugInstance> instances[PrimitiveCount][2];
+  DebugThreadBuffer *next = nullptr;
+};
+
+// every thread registers its buffer once, render walks this list
+// buffers live until the process exits, thread_local pointers to them are never reset
+static std::atomic<DebugThreadBuffer *> threadBuffers{nullptr};
+
+static DebugThreadBuffer &thread_buffer()
+{
+  thread_local DebugThreadBuffer *buffer = nullptr;
+  if (!buffer)
+  {
+    buffer = new DebugThreadBuffer();
+    buffer->next = threadBuffers.load(std::memory_order_relaxed);
+    while (!threadBuffers.compare_exchange_weak(buffer->next, buffer, std::memory_order_release, std::memory_order_relaxed))
+      ;
+  }
+  return *buffer;
+}
+
+static void add_instance(DebugPrimitive primitive, const mat4 &transform, const vec3 &color, bool depth_ignore)
+{
+  DebugInstance instance;
+  for (int i = 0; i < 3; i++)
+    instance.rows[i] = vec4(transform[0][i], transform[1][i], transform[2][i], transform[3][i]);
+  instance.color = vec4(color, 1.f);
+  thread_buffer().instances[primitive][depth_ignore].push_back(instance);
+}
+
+// maps segment (0,0,0)-(0,1,0) to from-to with given width
+static bool segment_transform(const vec3 &from, const vec3 &to, float size, mat4 &transform)
+{
+  vec3 d = to - from;
+  float len = length(d);
+  if (len < 1e-4f)
+    return false;
+  mat3 rotation = toMat3(quat(vec3(0, 1, 0), d / len));
+  transform = mat4(vec4(rotation[0] * size, 0.f), vec4(rotation[1] * len, 0.f), vec4(rotation[2] * size, 0.f), vec4(from, 1.f));
+  return true;
+}
 
 void draw_arrow(const mat4 &transform, const vec3 &from, const vec3 &to, vec3 color, float size, bool depth_ignore)
 {
-  ecs::get_singleton<DebugArrow>()->add_arrow(transform * vec4(from, 1), transform * vec4(to, 1), color, size, depth_ignore);
+  draw_arrow(vec3(transform * vec4(from, 1)), vec3(transform * vec4(to, 1)), color, size, depth_ignore);
 }
+
 void draw_arrow(const vec3 &from, const vec3 &to, vec3 color, float size, bool depth_ignore)
 {
-  ecs::get_singleton<DebugArrow>()->add_arrow(from, to, color, size, depth_ignore);
+  mat4 transform;
+  if (segment_transform(from, to, size, transform))
+    add_instance(ArrowPrimitive, transform, color, depth_ignore);
 }
-void draw_transform(const Transform &transform)
+
+void draw_bone(const vec3 &from, const vec3 &to, vec3 color, float size, bool depth_ignore)
 {
-  vec3 p = transform.get_position();
-  mat3 rotation = transform.get_rotation();
+  mat4 transform;
+  if (segment_transform(from, to, size, transform))
+    add_instance(BonePrimitive, transform, color, depth_ignore);
+}
+
+void draw_sphere(const vec3 &center, float radius, vec3 color, bool depth_ignore)
+{
+  mat4 transform = mat4(vec4(radius, 0, 0, 0), vec4(0, radius, 0, 0), vec4(0, 0, radius, 0), vec4(center, 1.f));
+  add_instance(SpherePrimitive, transform, color, depth_ignore);
+}
+
+void draw_line(const vec3 &from, const vec3 &to, vec3 color, bool depth_ignore)
+{
+  mat4 transform;
+  if (segment_transform(from, to, 1.f, transform))
+    add_instance(LinePrimitive, transform, color, depth_ignore);
+}
+
+void draw_transform(const mat4 &transform, float size)
+{
+  vec3 p = vec3(transform[3]);
   for (int i = 0; i < 3; i++)
   {
     vec3 n(0.f);
     n[i] = 1.f;
-    draw_arrow(p, p + rotation * n * 0.3f, n, 0.03f, false);
+    draw_arrow(p, p + normalize(vec3(transform[i])) * size, n, size * 0.1f, false);
   }
 }
-void DebugArrow::add_triangle(vec3 a, vec3 b, vec3 c, std::vector<uint> &indices, std::vector<vec3> &vert, std::vector<vec3> &normal)
+
+void draw_skeleton(const Skeleton &skeleton, const mat4 &transform, const mat4 *model_pose, vec3 color, bool depth_ignore)
 {
-  uint k = vert.size();
+  for (int i = 0, n = skeleton.size(); i < n; i++)
+  {
+    int parent = skeleton.parents[i];
+    if (parent < 0)
+      continue;
+    vec3 from = vec3(transform * model_pose[parent][3]);
+    vec3 to = vec3(transform * model_pose[i][3]);
+    draw_bone(from, to, color, length(to - from) * 0.1f, depth_ignore);
+  }
+}
+
+
+static ShaderHandle debugShader;
+static MeshHandle primitiveMeshes[PrimitiveCount];
+static const GLenum primitiveTopology[PrimitiveCount] = {GL_TRIANGLES, GL_TRIANGLES, GL_TRIANGLES, GL_LINES};
+
+static void add_triangle(vec3 a, vec3 b, vec3 c, std::vector<uint32_t> &indices, std::vector<vec3> &vert, std::vector<vec3> &normal)
+{
+  uint32_t k = vert.size();
   vec3 n = normalize(cross(b - a, c - a));
   indices.push_back(k);
   indices.push_back(k + 2);
@@ -36,78 +144,147 @@ void DebugArrow::add_triangle(vec3 a, vec3 b, vec3 c, std::vector<uint> &indices
   normal.push_back(n);
   normal.push_back(n);
 }
-DebugArrow::DebugArrow()
+
+static MeshHandle make_pyramid(float base_height, bool double_sided)
 {
-  arrowMaterial = Material("arrows");
-  std::vector<uint> indices;
+  std::vector<uint32_t> indices;
   std::vector<vec3> vert;
   std::vector<vec3> normal;
-  vec3 c = vec3(0, 1, 0);
+  vec3 top = vec3(0, 1, 0), bottom = vec3(0, 0, 0);
   const int N = 4;
   vec3 p[N];
   for (int i = 0; i < N; i++)
   {
     float a1 = ((float)(i) / N) * 2 * PI;
     float a2 = ((float)(i + 1) / N) * 2 * PI;
-    vec3 p1 = p[i] = vec3(cos(a1), 0, sin(a1));
-    vec3 p2 = vec3(cos(a2), 0, sin(a2));
-    add_triangle(p2, p1, c, indices, vert, normal);
+    vec3 p1 = p[i] = vec3(cos(a1), base_height, sin(a1));
+    vec3 p2 = vec3(cos(a2), base_height, sin(a2));
+    add_triangle(p2, p1, top, indices, vert, normal);
+    if (double_sided)
+      add_triangle(p1, p2, bottom, indices, vert, normal);
+  }
+  if (!double_sided)
+  {
+    add_triangle(p[0], p[1], p[2], indices, vert, normal);
+    add_triangle(p[0], p[2], p[3], indices, vert, normal);
   }
+  return make_mesh(indices, vert, normal);
+}
 
-  add_triangle(p[0], p[1], p[2], indices, vert, normal);
-  add_triangle(p[0], p[2], p[3], indices, vert, normal);
-  arrow = Mesh(indices, vert, normal);
+static MeshHandle make_sphere()
+{
+  std::vector<uint32_t> indices;
+  std::vector<vec3> vert;
+  const int rings = 8, segments = 12;
+  for (int r = 0; r <= rings; r++)
+    for (int s = 0; s <= segments; s++)
+    {
+      float theta = PI * r / rings, phi = PITWO * s / segments;
+      vert.push_back(vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi)));
+    }
+  for (int r = 0; r < rings; r++)
+    for (int s = 0; s < segments; s++)
+    {
+      uint32_t a = r * (segments + 1) + s, b = a + segments + 1;
+      indices.insert(indices.end(), {a, a + 1, b, a + 1, b + 1, b});
+    }
+  return make_mesh(indices, vert, vert);
 }
 
-mat4 directionMatrix(vec3 from, vec3 to)
+static MeshHandle make_line()
 {
+  // zero normal marks unlit geometry in the shader
+  return make_mesh({0, 1}, {vec3(0, 0, 0), vec3(0, 1, 0)}, {vec3(0.f), vec3(0.f)});
+}
 
-  from = normalize(from);
-  to = normalize(to);
-  quat q(from, to);
-  return toMat4(q);
+void init_debug_render()
+{
+  register_block_layout({"InstanceData", 0, sizeof(DebugInstance), {
+    BlockLayoutField{"instances[0].Rows[0]", GL_FLOAT_VEC4, offsetof(DebugInstance, rows)},
+    BlockLayoutField{"instances[0].Color", GL_FLOAT_VEC4, offsetof(DebugInstance, color)}}});
+  debugShader = get_shader("sources/shaders/bones.glsl");
+  primitiveMeshes[ArrowPrimitive] = make_pyramid(0.f, false);
+  primitiveMeshes[BonePrimitive] = make_pyramid(0.15f, true);
+  primitiveMeshes[SpherePrimitive] = make_sphere();
+  primitiveMeshes[LinePrimitive] = make_line();
 }
-void DebugArrow::add_arrow(const vec3 &from, const vec3 &to, vec3 color, float size, bool depth_ignore)
+
+void close_debug_render()
 {
-  vec3 d = to - from;
-  mat4 t = translate(mat4(1.f), from);
-  float len = length(d);
-  if (len < 0.01f)
-    return;
-  mat4 s = scale(mat4(1.f), vec3(size, len, size));
+  for (DebugThreadBuffer *buffer = threadBuffers.load(std::memory_order_acquire); buffer; buffer = buffer->next)
+    for (auto &primitiveInstances : buffer->instances)
+      for (std::vector<DebugInstance> &instances : primitiveInstances)
+        std::vector<DebugInstance>().swap(instances);
+  release_resource(debugShader);
+  debugShader = {};
+  for (MeshHandle &mesh : primitiveMeshes)
+  {
+    release_resource(mesh);
+    mesh = {};
+  }
+}
+
+struct DebugBatch
+{
+  const DebugInstance *instances = nullptr;
+  int count = 0;
+};
 
-  mat4 r = directionMatrix(vec3(0, 1, 0), d);
-  if (depth_ignore)
-    depthIgnore.emplace_back(Arrow{t * r * s, vec4(color, 1.f)});
-  else
-    depthNotIgnore.emplace_back(Arrow{t * r * s, vec4(color, 1.f)});
+// instances of every thread are copied to render data, so buffers can be filled again while it is drawn
+static DebugBatch gather_primitives(DebugPrimitive primitive, bool depth_ignore, DebugThreadBuffer *buffers)
+{
+  size_t count = 0;
+  for (DebugThreadBuffer *buffer = buffers; buffer; buffer = buffer->next)
+    count += buffer->instances[primitive][depth_ignore].size();
+  if (count == 0)
+    return {};
+
+  DebugInstance *data = allocate_render_data<DebugInstance>(count);
+  DebugInstance *dst = data;
+  for (DebugThreadBuffer *buffer = buffers; buffer; buffer = buffer->next)
+  {
+    std::vector<DebugInstance> &instances = buffer->instances[primitive][depth_ignore];
+    memcpy(dst, instances.data(), instances.size() * sizeof(DebugInstance));
+    dst += instances.size();
+    instances.clear();
+  }
+  return {data, (int)count};
 }
-void DebugArrow::render_depth_case(UniformBuffer &instanceData, std::vector<Arrow> &arrows, bool ignoreDepth, bool wire_frame)
+
+static void render_primitives(DebugPrimitive primitive, const DebugBatch &batch)
 {
-  uint instanceCount = arrows.size(), instanceSize = 0;
-  if (instanceCount == 0)
+  if (batch.count == 0)
     return;
-  char *data = instanceData.get_buffer(0, (instanceCount + 1) * instanceSize);
-  // i don't know why need to +1, but it din't work without it
-  memcpy(data, arrows.data(), instanceCount * instanceSize);
-  instanceData.flush_buffer(instanceCount * instanceSize);
-
-  glDepthFunc(ignoreDepth ? GL_ALWAYS : GL_LESS);
-  glDepthMask(ignoreDepth ? GL_FALSE : GL_TRUE);
-  arrow.render_instances(instanceCount, wire_frame);
+  if (!upload_storage_block(DebugInstanceBinding, batch.instances, batch.count * sizeof(DebugInstance)))
+    return;
+  render_instances(*get_resource(primitiveMeshes[primitive]), batch.count, primitiveTopology[primitive]);
 }
-void DebugArrow::render(UniformBuffer &instanceData, bool wire_frame)
+
+void render_debug_primitives(bool wire_frame)
 {
-  if (instanceData.size() && arrowMaterial.get_shader())
+  DebugThreadBuffer *buffers = threadBuffers.load(std::memory_order_acquire);
+  if (!debugShader || !buffers)
+    return;
+
+  DebugBatch batches[2][PrimitiveCount];
+  for (bool depthIgnore : {false, true})
+    for (int primitive = 0; primitive < PrimitiveCount; primitive++)
+      batches[depthIgnore][primitive] = gather_primitives((DebugPrimitive)primitive, depthIgnore, buffers);
+
+  enqueue_render_command([batches, wire_frame]()
   {
-    const Shader &arrowShader = arrowMaterial.get_shader();
-    arrowShader.use();
-    render_depth_case(instanceData, depthIgnore, true, wire_frame);
-    render_depth_case(instanceData, depthNotIgnore, false, wire_frame);
-  }
-  depthIgnore.clear();
-  depthNotIgnore.clear();
-  glDepthFunc(GL_LESS);
-  glDepthMask(GL_TRUE);
+    RenderDevice &device = render_device();
+    get_resource(debugShader)->use();
+    if (wire_frame)
+      device.set_polygon_mode(GL_LINE);
+    for (bool depthIgnore : {false, true})
+    {
+      device.set_depth_state(true, depthIgnore ? GL_ALWAYS : GL_LESS, !depthIgnore);
+      for (int primitive = 0; primitive < PrimitiveCount; primitive++)
+        render_primitives((DebugPrimitive)primitive, batches[depthIgnore][primitive]);
+    }
+    if (wire_frame)
+      device.set_polygon_mode(GL_FILL);
+    device.set_depth_state(true, GL_LESS, true);
+  });
 }
- */
\ No newline at end of file
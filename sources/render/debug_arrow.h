@@ -1,29 +1,19 @@
-/* #pragma once
+#pragma once
 #include "3dmath.h"
-#include "material.h"
-#include "mesh.h"
-class DebugArrow : ecs::Singleton
-{
-private:
-  struct Arrow
-  {
-    mat4 transform;
-    vec4 color;
-  };
-  Material arrowMaterial;
-  Mesh arrow;
-  std::vector<Arrow> depthIgnore;
-  std::vector<Arrow> depthNotIgnore;
-  void add_triangle(vec3 a, vec3 b, vec3 c, std::vector<uint> &indices, std::vector<vec3> &vert, std::vector<vec3> &normal);
-  void render_depth_case(UniformBuffer &instanceData, std::vector<Arrow> &arrows, bool ignoreDepth, bool wire_frame);
+#include <animation/skeleton.h>
 
-public:
-  DebugArrow();
-  void add_arrow(const vec3 &from, const vec3 &to, vec3 color, float size, bool depth_ignore);
-
-  void render(UniformBuffer &instanceData, bool wire_frame = false);
-};
+// Immediate mode debug drawing. Safe to call from any thread, primitives are collected
+// in per-thread buffers and merged in render_debug_primitives, which must not run
+// concurrently with the draw_* calls.
 void draw_arrow(const mat4 &transform, const vec3 &from, const vec3 &to, vec3 color, float size, bool depth_ignore = true);
 void draw_arrow(const vec3 &from, const vec3 &to, vec3 color, float size, bool depth_ignore = true);
-void draw_transform(const Transform &transform);
- */
\ No newline at end of file
+void draw_bone(const vec3 &from, const vec3 &to, vec3 color, float size, bool depth_ignore = true);
+void draw_sphere(const vec3 &center, float radius, vec3 color, bool depth_ignore = false);
+void draw_line(const vec3 &from, const vec3 &to, vec3 color, bool depth_ignore = true);
+void draw_transform(const mat4 &transform, float size = 0.3f);
+void draw_skeleton(const Skeleton &skeleton, const mat4 &transform, const mat4 *model_pose, vec3 color, bool depth_ignore = true);
+
+void init_debug_render();
+void close_debug_render();
+// game thread, records drawing of everything added since previous call
+void render_debug_primitives(bool wire_frame = false);
@@ -0,0 +1,85 @@
+#include "frustum_culling.h"
+#include <cfloat>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CULLING_SSE
+#endif
+
+Frustum extract_frustum(const mat4 &view_projection)
+{
+  const mat4 m = transpose(view_projection);
+  Frustum frustum;
+  frustum.planes[0] = m[3] + m[0];
+  frustum.planes[1] = m[3] - m[0];
+  frustum.planes[2] = m[3] + m[1];
+  frustum.planes[3] = m[3] - m[1];
+  frustum.planes[4] = m[3] + m[2];
+  frustum.planes[5] = m[3] - m[2];
+  for (vec4 &plane : frustum.planes)
+    plane /= length(vec3(plane));
+  return frustum;
+}
+
+void CullingSpheres::resize(int sphere_count)
+{
+  count = sphere_count;
+  int padded = (sphere_count + BatchSize - 1) / BatchSize * BatchSize;
+  x.assign(padded, 0.f);
+  y.assign(padded, 0.f);
+  z.assign(padded, 0.f);
+  // padding spheres can't pass the test
+  radius.assign(padded, -FLT_MAX);
+}
+
+void frustum_cull(const Frustum &frustum, const CullingSpheres &spheres, std::vector<uint8_t> &visibility)
+{
+  const int n = spheres.padded_count();
+  visibility.resize(n);
+  const float *px = spheres.x.data(), *py = spheres.y.data(), *pz = spheres.z.data(), *pr = spheres.radius.data();
+
+#if defined(__AVX__)
+  for (int i = 0; i < n; i += CullingSpheres::BatchSize)
+  {
+    __m256 x = _mm256_loadu_ps(px + i), y = _mm256_loadu_ps(py + i), z = _mm256_loadu_ps(pz + i), r = _mm256_loadu_ps(pr + i);
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (const vec4 &plane : frustum.planes)
+    {
+      __m256 d = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(plane.x)), _mm256_mul_ps(y, _mm256_set1_ps(plane.y)));
+      d = _mm256_add_ps(d, _mm256_mul_ps(z, _mm256_set1_ps(plane.z)));
+      d = _mm256_add_ps(d, _mm256_add_ps(r, _mm256_set1_ps(plane.w)));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ));
+    }
+    int mask = _mm256_movemask_ps(inside);
+    for (int j = 0; j < CullingSpheres::BatchSize; j++)
+      visibility[i + j] = (mask >> j) & 1;
+  }
+#elif defined(CULLING_SSE)
+  for (int i = 0; i < n; i += CullingSpheres::BatchSize)
+  {
+    __m128 x0 = _mm_loadu_ps(px + i), y0 = _mm_loadu_ps(py + i), z0 = _mm_loadu_ps(pz + i), r0 = _mm_loadu_ps(pr + i);
+    __m128 x1 = _mm_loadu_ps(px + i + 4), y1 = _mm_loadu_ps(py + i + 4), z1 = _mm_loadu_ps(pz + i + 4), r1 = _mm_loadu_ps(pr + i + 4);
+    __m128 inside0 = _mm_castsi128_ps(_mm_set1_epi32(-1)), inside1 = inside0;
+    for (const vec4 &plane : frustum.planes)
+    {
+      __m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z), w = _mm_set1_ps(plane.w);
+      __m128 d0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x0, nx), _mm_mul_ps(y0, ny)), _mm_add_ps(_mm_mul_ps(z0, nz), _mm_add_ps(r0, w)));
+      __m128 d1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x1, nx), _mm_mul_ps(y1, ny)), _mm_add_ps(_mm_mul_ps(z1, nz), _mm_add_ps(r1, w)));
+      inside0 = _mm_and_ps(inside0, _mm_cmpge_ps(d0, _mm_setzero_ps()));
+      inside1 = _mm_and_ps(inside1, _mm_cmpge_ps(d1, _mm_setzero_ps()));
+    }
+    int mask = _mm_movemask_ps(inside0) | (_mm_movemask_ps(inside1) << 4);
+    for (int j = 0; j < CullingSpheres::BatchSize; j++)
+      visibility[i + j] = (mask >> j) & 1;
+  }
+#else
+  for (int i = 0; i < n; i++)
+  {
+    bool inside = true;
+    for (const vec4 &plane : frustum.planes)
+      inside &= px[i] * plane.x + py[i] * plane.y + pz[i] * plane.z + pr[i] + plane.w >= 0.f;
+    visibility[i] = inside;
+  }
+#endif
+}
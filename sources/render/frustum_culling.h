@@ -0,0 +1,33 @@
+#pragma once
+#include "3dmath.h"
+#include <vector>
+#include <cstdint>
+
+// planes are normalized, point is inside when dot(plane.xyz, p) + plane.w >= 0
+struct Frustum
+{
+  vec4 planes[6];
+};
+
+Frustum extract_frustum(const mat4 &view_projection);
+
+// bounding spheres in SoA layout, padded to whole batches so the SIMD loop has no tail
+struct CullingSpheres
+{
+  static constexpr int BatchSize = 8;
+  std::vector<float> x, y, z, radius;
+  int count = 0;
+
+  void resize(int sphere_count);
+  void set(int i, const vec3 &center, float r)
+  {
+    x[i] = center.x;
+    y[i] = center.y;
+    z[i] = center.z;
+    radius[i] = r;
+  }
+  int padded_count() const { return (int)x.size(); }
+};
+
+// writes 1 for visible spheres, visibility is resized to padded_count
+void frustum_cull(const Frustum &frustum, const CullingSpheres &spheres, std::vector<uint8_t> &visibility);
@@ -0,0 +1,15 @@
+#include "global_render_data.h"
+#include "shader.h"
+
+void register_render_data_layouts()
+{
+  register_block_layout({"GlobalRenderData", sizeof(GlobalRenderData), 0, {
+    BLOCK_LAYOUT_FIELD(GlobalRenderData, viewProjection, "ViewProjection"),
+    BLOCK_LAYOUT_FIELD(GlobalRenderData, cameraPosition, "CameraPosition"),
+    BLOCK_LAYOUT_FIELD(GlobalRenderData, lightDirection, "LightDirection"),
+    BLOCK_LAYOUT_FIELD(GlobalRenderData, ambientLight, "AmbientLight"),
+    BLOCK_LAYOUT_FIELD(GlobalRenderData, sunLight, "SunLight")}});
+
+  register_block_layout({"SkinningPalette", 0, sizeof(mat4), {
+    BlockLayoutField{"Bones[0]", GL_FLOAT_MAT4, 0}}});
+}
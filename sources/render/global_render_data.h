@@ -0,0 +1,27 @@
+#pragma once
+#include "3dmath.h"
+
+constexpr int GlobalRenderDataBinding = 0;
+constexpr int SkinningPaletteBinding = 1;
+constexpr int DebugInstanceBinding = 2;
+constexpr int MaterialDataBinding = 3;
+constexpr int CrowdInstanceBinding = 4;
+constexpr int BakedClipBinding = 5;
+constexpr int DrawDataBinding = 6;
+
+// std140 mirror of the GlobalRenderData uniform block
+struct GlobalRenderData
+{
+  mat4 viewProjection;
+  vec3 cameraPosition;
+  float pad0;
+  vec3 lightDirection;
+  float pad1;
+  vec3 ambientLight;
+  float pad2;
+  vec3 sunLight;
+  float pad3;
+};
+
+// validates GlobalRenderData and SkinningPalette of every loaded shader against C++ side
+void register_render_data_layouts();
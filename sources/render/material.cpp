@@ -1,34 +1,123 @@
 #include "material.h"
+#include "ring_buffer.h"
 
+void destroy_material(Material &material)
+{
+  for (const Material::Property &property : material.properties)
+    Material::release_texture(property.value);
+  release_resource(material.shader);
+}
+
+template<>
+ResourcePool<Material> &resource_pool<Material>()
+{
+  static ResourcePool<Material> pool("materials", destroy_material);
+  return pool;
+}
+
+static MaterialHandle add_material(ShaderHandle shader)
+{
+  return shader ? resource_pool<Material>().add(Material(shader), sizeof(Material)) : MaterialHandle();
+}
+
+MaterialHandle make_material(const char *name, const char *vs_file, const char *ps_file)
+{
+  return add_material(compile_shader(name, vs_file, ps_file));
+}
+
+MaterialHandle make_material(const char *path, const std::vector<std::string> &keywords)
+{
+  return add_material(get_shader(path, keywords));
+}
+
+static GLenum property_type(const std::variant<float, glm::vec2, glm::vec3, glm::vec4, Texture2DHandle> &value)
+{
+  return std::visit([](const auto &v) { return ShaderType<std::decay_t<decltype(v)>>::value; }, value);
+}
+
+void Material::resolve_properties() const
+{
+  const Shader &shader = get_shader();
+  resolvedProgram = shader.program;
+  const ShaderBlock *block = shader.find_block("MaterialData");
+  blockData.assign(block ? block->dataSize : 0, 0);
+  blockBinding = block ? block->binding : -1;
+  for (Property &property : properties)
+    if (!resolve_property(property))
+      debug_error("property %s in shader %s didn't found", property.name.c_str(), shader.name.c_str());
+}
+
+bool Material::resolve_property(Property &property) const
+{
+  const Shader &shader = get_shader();
+  GLenum type = property_type(property.value);
+  property.shaderUniformIdx = -1;
+  property.blockOffset = -1;
+
+  const auto &uniforms = shader.uniforms;
+  for (size_t i = 0; i < uniforms.size(); i++)
+  {
+    if (uniforms[i].name == property.name)
+    {
+      if (uniforms[i].type != type)
+      {
+        debug_error("property %s in shader %s has type 0x%x, material sets 0x%x", property.name.c_str(), shader.name.c_str(), uniforms[i].type, type);
+        return false;
+      }
+      property.shaderUniformIdx = i;
+      return true;
+    }
+  }
+
+  if (const ShaderBlock *block = shader.find_block("MaterialData"))
+  {
+    property.blockOffset = find_block_offset(*block, property.name.c_str(), type);
+    write_block_value(property);
+  }
+  return property.blockOffset >= 0;
+}
+
+void Material::write_block_value(const Property &property) const
+{
+  if (property.blockOffset < 0)
+    return;
+  std::visit([&](const auto &v)
+  {
+    using T = std::decay_t<decltype(v)>;
+    if constexpr (!std::is_same_v<T, Texture2DHandle>)
+      memcpy(blockData.data() + property.blockOffset, &v, sizeof(T));
+  }, property.value);
+}
 
 void Material::bind_uniforms_to_shader() const
 {
-  const auto &uniforms = shader->uniforms;
+  const Shader &shader = get_shader();
+  if (resolvedProgram != shader.program)
+    resolve_properties();
+  const auto &uniforms = shader.uniforms;
 
   int textureBinding = 0;
   for (const Property &property : properties)
   {
-
+    if (property.shaderUniformIdx < 0)
+      continue;
     int location = uniforms[property.shaderUniformIdx].shaderLocation;
     if (const auto *v = std::get_if<float>(&property.value))
-      shader->set_float(location, *v);
+      shader.set_float(location, *v);
     else if (const auto *v = std::get_if<glm::vec2>(&property.value))
-      shader->set_vec2(location, *v);
+      shader.set_vec2(location, *v);
     else if (const auto *v = std::get_if<glm::vec3>(&property.value))
-      shader->set_vec3(location, *v);
+      shader.set_vec3(location, *v);
     else if (const auto *v = std::get_if<glm::vec4>(&property.value))
-      shader->set_vec4(location, *v);
-    else if (const auto *v = std::get_if<Texture2DPtr>(&property.value))
+      shader.set_vec4(location, *v);
+    else if (const auto *v = std::get_if<Texture2DHandle>(&property.value))
     {
-      unsigned textureObject = (*v)->textureObject;
-      glActiveTexture(GL_TEXTURE0 + textureBinding);
-      glBindTexture(GL_TEXTURE_2D, textureObject);
-      glUniform1i(location, textureBinding);
+      const Texture2D *texture = get_resource(*v);
+      render_device().bind_texture(textureBinding, GL_TEXTURE_2D, texture ? texture->textureObject : 0);
+      shader.set_int(location, textureBinding);
       textureBinding++;
     }
   }
+  if (!blockData.empty())
+    upload_uniform_block(blockBinding, blockData.data(), blockData.size());
 }
-
-
-
-
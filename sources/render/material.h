@@ -6,61 +6,94 @@
 #include "texture2d.h"
 
 #define TYPES \
-  TYPE(float, GL_FLOAT) TYPE(vec2, GL_FLOAT_VEC2) TYPE(vec3, GL_FLOAT_VEC3) TYPE(vec4, GL_FLOAT_VEC4) TYPE(Texture2DPtr, GL_SAMPLER_2D)\
+  TYPE(float, GL_FLOAT) TYPE(vec2, GL_FLOAT_VEC2) TYPE(vec3, GL_FLOAT_VEC3) TYPE(vec4, GL_FLOAT_VEC4) TYPE(Texture2DHandle, GL_SAMPLER_2D)\
 
 
+template<> struct ShaderType<Texture2DHandle> { static constexpr GLenum value = GL_SAMPLER_2D; };
+
 class Material
 {
 private:
-  ShaderPtr shader;
-  using MaterialProperty = std::variant<float, glm::vec2, glm::vec3, glm::vec4, Texture2DPtr>;
+  ShaderHandle shader;
+  using MaterialProperty = std::variant<float, glm::vec2, glm::vec3, glm::vec4, Texture2DHandle>;
 
   struct Property
   {
     std::string name;
-    int shaderUniformIdx;
     MaterialProperty value;
+    int shaderUniformIdx = -1; // plain uniform, textures
+    int blockOffset = -1; // member of MaterialData block
   };
-  std::vector<Property> properties;
+  // resolved against shader->program, hot reload can change the layout
+  mutable std::vector<Property> properties;
+  // image of MaterialData block, uploaded with one copy on bind
+  mutable std::vector<char> blockData;
+  mutable int blockBinding = -1;
+  mutable GLuint resolvedProgram = 0;
+
+  void resolve_properties() const;
+  bool resolve_property(Property &property) const;
+  void write_block_value(const Property &property) const;
+
+  // material keeps its own references to textures
+  static void acquire_texture(const MaterialProperty &value)
+  {
+    if (const Texture2DHandle *texture = std::get_if<Texture2DHandle>(&value))
+      acquire_resource(*texture);
+  }
+  static void release_texture(const MaterialProperty &value)
+  {
+    if (const Texture2DHandle *texture = std::get_if<Texture2DHandle>(&value))
+      release_resource(*texture);
+  }
+  friend void destroy_material(Material &material);
 
 public:
 
-  Material(ShaderPtr &&shader) : shader(std::move(shader)) {}
+  // takes the shader reference of the caller
+  Material(ShaderHandle shader) : shader(shader) {}
 
-  const Shader &get_shader() const { return *shader; }
+  const Shader &get_shader() const { return *get_resource(shader); }
   void bind_uniforms_to_shader() const;
 
   template<typename T>
   bool set_property(const char *name, T &&value)
   {
+    const Shader &shader = get_shader();
+    if (resolvedProgram != shader.program)
+      resolve_properties();
+    MaterialProperty newValue{std::forward<T>(value)};
     for (Property &p : properties)
     {
       if (p.name == name)
       {
-        p.value = std::move(value);
+        if (p.value.index() != newValue.index())
+        {
+          debug_error("property %s in shader %s was set with another type", name, shader.name.c_str());
+          return false;
+        }
+        acquire_texture(newValue);
+        release_texture(p.value);
+        p.value = std::move(newValue);
+        write_block_value(p);
         return true;
       }
     }
 
-    int i = 0;
-    for (const ShaderUniform &sampler : shader->uniforms)
+    properties.emplace_back(Property{std::string(name), std::move(newValue)});
+    if (resolve_property(properties.back()))
     {
-      if (sampler.name == name)
-      {
-        properties.emplace_back(Property{std::string(name), i, MaterialProperty{std::move(value)}});
-        return true;
-      }
-      i++;
+      acquire_texture(properties.back().value);
+      return true;
     }
-    debug_error("property %s in shader %s didn't found", name, shader->name.c_str());
+    properties.pop_back();
+    debug_error("property %s in shader %s didn't found", name, shader.name.c_str());
     return false;
   }
 };
 
-using MaterialPtr = std::shared_ptr<Material>;
+using MaterialHandle = Handle<Material>;
+template<> ResourcePool<Material> &resource_pool<Material>();
 
-inline MaterialPtr make_material(const char *name, const char *vs_file, const char *ps_file)
-{
-  ShaderPtr shader = compile_shader(name, vs_file, ps_file);
-  return shader ? std::make_shared<Material>(std::move(shader)) : nullptr;
-}
\ No newline at end of file
+MaterialHandle make_material(const char *name, const char *vs_file, const char *ps_file);
+MaterialHandle make_material(const char *path, const std::vector<std::string> &keywords = {});
@@ -1,23 +1,44 @@
 #include "mesh.h"
 #include <vector>
+#include <cfloat>
 #include <3dmath.h>
 #include <assimp/scene.h>
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <log.h>
+#include <file_watcher.h>
+#include <render_thread.h>
 #include "glad/glad.h"
+#include "render_device.h"
 
 
-static void create_indices(const std::vector<unsigned int> &indices)
+static void destroy_mesh(Mesh &mesh)
+{
+  enqueue_render_command([vertexArray = mesh.vertexArrayBufferObject, buffers = std::move(mesh.buffers)]()
+  {
+    glDeleteVertexArrays(1, &vertexArray);
+    glDeleteBuffers((GLsizei)buffers.size(), buffers.data());
+  });
+}
+
+template<>
+ResourcePool<Mesh> &resource_pool<Mesh>()
+{
+  static ResourcePool<Mesh> pool("meshes", destroy_mesh);
+  return pool;
+}
+
+static GLuint create_indices(const std::vector<unsigned int> &indices)
 {
   GLuint arrayIndexBuffer;
   glGenBuffers(1, &arrayIndexBuffer);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arrayIndexBuffer);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0]) * indices.size(), indices.data(), GL_STATIC_DRAW);
   glBindVertexArray(0);
+  return arrayIndexBuffer;
 }
 
-static void init_channel(int index, size_t data_size, const void *data_ptr, int component_count, bool is_float)
+static GLuint init_channel(int index, size_t data_size, const void *data_ptr, int component_count, bool is_float)
 {
   GLuint arrayBuffer;
   glGenBuffers(1, &arrayBuffer);
@@ -29,37 +50,163 @@ static void init_channel(int index, size_t data_size, const void *data_ptr, int
     glVertexAttribPointer(index, component_count, GL_FLOAT, GL_FALSE, 0, 0);
   else
     glVertexAttribIPointer(index, component_count, GL_UNSIGNED_INT, 0, 0);
+  return arrayBuffer;
 }
 
 
 template<int i>
-static void InitChannel() { }
+static void InitChannel(Mesh &, size_t &) { }
 
 template<int i, typename T, typename... Channel>
-static void InitChannel(const std::vector<T> &channel, const Channel&... channels)
+static void InitChannel(Mesh &mesh, size_t &bytes, const std::vector<T> &channel, const Channel&... channels)
 {
   if (channel.size() > 0)
   {
     const int size = sizeof(T) / sizeof(channel[0][0]);
-    init_channel(i, sizeof(T) * channel.size(), channel.data(), size, !(std::is_same<T, uvec4>::value));
+    mesh.buffers.push_back(init_channel(i, sizeof(T) * channel.size(), channel.data(), size, !(std::is_same<T, uvec4>::value)));
+    bytes += sizeof(T) * channel.size();
   }
-  InitChannel<i + 1>(channels...);
+  InitChannel<i + 1>(mesh, bytes, channels...);
 }
 
 
 template<typename... Channel>
-MeshPtr create_mesh(const std::vector<unsigned int> &indices, const Channel&... channels)
+static MeshHandle create_mesh(SkeletonPtr skeleton, const std::string &key, const std::vector<unsigned int> &indices, const Channel&... channels)
 {
   uint32_t vertexArrayBufferObject;
   glGenVertexArrays(1, &vertexArrayBufferObject);
   glBindVertexArray(vertexArrayBufferObject);
-  InitChannel<0>(channels...);
-  create_indices(indices);
-  return std::make_shared<Mesh>(vertexArrayBufferObject, indices.size());
+  Mesh mesh(vertexArrayBufferObject, indices.size());
+  size_t bytes = sizeof(indices[0]) * indices.size();
+  InitChannel<0>(mesh, bytes, channels...);
+  mesh.buffers.push_back(create_indices(indices));
+  mesh.skeleton = std::move(skeleton);
+  return resource_pool<Mesh>().add(std::move(mesh), bytes, key);
+}
+
+
+static mat4 to_mat4(const aiMatrix4x4 &m)
+{
+  return transpose(make_mat4(&m.a1));
+}
+
+static const aiNode *find_mesh_node(const aiNode *node, unsigned mesh_idx)
+{
+  for (unsigned i = 0; i < node->mNumMeshes; i++)
+    if (node->mMeshes[i] == mesh_idx)
+      return node;
+  for (unsigned i = 0; i < node->mNumChildren; i++)
+    if (const aiNode *meshNode = find_mesh_node(node->mChildren[i], mesh_idx))
+      return meshNode;
+  return nullptr;
+}
+
+static mat4 node_global_transform(const aiNode *node)
+{
+  mat4 transform(1.f);
+  for (; node; node = node->mParent)
+    transform = to_mat4(node->mTransformation) * transform;
+  return transform;
+}
+
+static void add_skeleton_nodes(const aiNode *node, int parent, const std::map<std::string, int> &used_nodes, Skeleton &skeleton)
+{
+  int index = parent;
+  if (used_nodes.count(node->mName.C_Str()))
+  {
+    index = skeleton.size();
+    skeleton.names.emplace_back(node->mName.C_Str());
+    skeleton.parents.push_back(parent);
+    skeleton.localBindPose.push_back(to_mat4(node->mTransformation));
+    skeleton.invBindPose.push_back(mat4(1.f));
+    skeleton.boneBounds.push_back(vec4(0.f));
+    skeleton.boneInnerBoxes.push_back({vec3(0.f), vec3(0.f)});
+  }
+  for (unsigned i = 0; i < node->mNumChildren; i++)
+    add_skeleton_nodes(node->mChildren[i], index, used_nodes, skeleton);
+}
+
+// takes mesh bones with all their ancestors, bone_remap maps aiMesh bone index to skeleton index
+static SkeletonPtr create_skeleton(const aiScene *scene, unsigned mesh_idx, std::vector<int> &bone_remap)
+{
+  const aiMesh *mesh = scene->mMeshes[mesh_idx];
+  if (!mesh->HasBones())
+    return nullptr;
+
+  std::map<std::string, int> usedNodes;
+  for (unsigned i = 0; i < mesh->mNumBones; i++)
+    for (const aiNode *node = scene->mRootNode->FindNode(mesh->mBones[i]->mName); node; node = node->mParent)
+      usedNodes[node->mName.C_Str()] = 0;
+
+  auto skeleton = std::make_shared<Skeleton>();
+  add_skeleton_nodes(scene->mRootNode, -1, usedNodes, *skeleton);
+
+  const aiNode *meshNode = find_mesh_node(scene->mRootNode, mesh_idx);
+  skeleton->rootTransform = inverse(node_global_transform(meshNode));
+
+  bone_remap.resize(mesh->mNumBones);
+  for (unsigned i = 0; i < mesh->mNumBones; i++)
+  {
+    int bone = skeleton->find_bone(mesh->mBones[i]->mName.C_Str());
+    bone_remap[i] = bone;
+    skeleton->invBindPose[bone] = to_mat4(mesh->mBones[i]->mOffsetMatrix);
+  }
+  return skeleton;
 }
 
+static void calculate_bone_bounds(Skeleton &skeleton, const std::vector<vec3> &vertices,
+  const std::vector<vec4> &weights, const std::vector<uvec4> &weights_index)
+{
+  const float minWeight = 0.1f;
+  int numBones = skeleton.size();
+  std::vector<vec3> minPoint(numBones, vec3(FLT_MAX)), maxPoint(numBones, vec3(-FLT_MAX));
+  for (size_t i = 0; i < vertices.size(); i++)
+    for (int j = 0; j < 4; j++)
+      if (weights[i][j] >= minWeight)
+      {
+        int bone = weights_index[i][j];
+        vec3 p = vec3(skeleton.invBindPose[bone] * vec4(vertices[i], 1.f));
+        minPoint[bone] = min(minPoint[bone], p);
+        maxPoint[bone] = max(maxPoint[bone], p);
+      }
+
+  for (int bone = 0; bone < numBones; bone++)
+    if (minPoint[bone].x <= maxPoint[bone].x)
+      skeleton.boneBounds[bone] = vec4((minPoint[bone] + maxPoint[bone]) * 0.5f, 0.f);
+
+  for (size_t i = 0; i < vertices.size(); i++)
+    for (int j = 0; j < 4; j++)
+      if (weights[i][j] >= minWeight)
+      {
+        vec4 &sphere = skeleton.boneBounds[weights_index[i][j]];
+        vec3 p = vec3(skeleton.invBindPose[weights_index[i][j]] * vec4(vertices[i], 1.f));
+        sphere.w = max(sphere.w, length(p - vec3(sphere)));
+      }
+
+  // Inner box has the proportions of the bounds and grows from their center until it touches a vertex,
+  // for a limb it ends up inside the tube of its vertices. Triangles cut corners between vertices, so it is shrunk a bit.
+  const float innerMargin = 0.8f;
+  std::vector<float> innerScale(numBones, 1.f);
+  for (size_t i = 0; i < vertices.size(); i++)
+    for (int j = 0; j < 4; j++)
+      if (weights[i][j] >= minWeight)
+      {
+        int bone = weights_index[i][j];
+        vec3 halfSize = max((maxPoint[bone] - minPoint[bone]) * 0.5f, vec3(1e-6f));
+        vec3 p = vec3(skeleton.invBindPose[bone] * vec4(vertices[i], 1.f));
+        vec3 d = abs(p - vec3(skeleton.boneBounds[bone])) / halfSize;
+        innerScale[bone] = min(innerScale[bone], max(d.x, max(d.y, d.z)));
+      }
+  for (int bone = 0; bone < numBones; bone++)
+    if (minPoint[bone].x <= maxPoint[bone].x)
+    {
+      vec3 center = vec3(skeleton.boneBounds[bone]);
+      vec3 halfSize = (maxPoint[bone] - minPoint[bone]) * (0.5f * innerScale[bone] * innerMargin);
+      skeleton.boneInnerBoxes[bone] = {center - halfSize, center + halfSize};
+    }
+}
 
-MeshPtr create_mesh(const aiMesh *mesh)
+static MeshHandle create_mesh(const aiMesh *mesh, SkeletonPtr skeleton, const std::vector<int> &bone_remap, const std::string &key)
 {
   std::vector<uint32_t> indices;
   std::vector<vec3> vertices;
@@ -119,7 +266,7 @@ MeshPtr create_mesh(const aiMesh *mesh)
         int vertex = bone->mWeights[j].mVertexId;
         int offset = weightsOffset[vertex]++;
         weights[vertex][offset] = bone->mWeights[j].mWeight;
-        weightsIndex[vertex][offset] = i;
+        weightsIndex[vertex][offset] = bone_remap[i];
       }
     }
     //the sum of weights not 1
@@ -129,12 +276,16 @@ MeshPtr create_mesh(const aiMesh *mesh)
       float s = w.x + w.y + w.z + w.w;
       weights[i] *= 1.f / s;
     }
+    calculate_bone_bounds(*skeleton, vertices, weights, weightsIndex);
   }
-  return create_mesh(indices, vertices, normals, uv, weights, weightsIndex);
+  return create_mesh(std::move(skeleton), key, indices, vertices, normals, uv, weights, weightsIndex);
 }
 
-MeshPtr load_mesh(const char *path, int idx)
+MeshHandle load_mesh(const char *path, int idx)
 {
+  std::string key = normalize_path(path) + ":" + std::to_string(idx);
+  if (MeshHandle loaded = resource_pool<Mesh>().find(key))
+    return loaded;
 
   Assimp::Importer importer;
   importer.SetPropertyBool(AI_CONFIG_IMPORT_FBX_PRESERVE_PIVOTS, false);
@@ -147,23 +298,42 @@ MeshPtr load_mesh(const char *path, int idx)
   if (!scene)
   {
     debug_error("no asset in %s", path);
-    return nullptr;
+    return {};
   }
 
-  return create_mesh(scene->mMeshes[idx]);
+  std::vector<int> boneRemap;
+  SkeletonPtr skeleton = create_skeleton(scene, idx, boneRemap);
+  return create_mesh(scene->mMeshes[idx], std::move(skeleton), boneRemap, key);
+}
+
+void render(const Mesh &mesh)
+{
+  render_device().draw_indexed(mesh.vertexArrayBufferObject, GL_TRIANGLES, mesh.numIndices, 1);
+}
+
+void render_instances(const Mesh &mesh, int instance_count, GLenum primitive)
+{
+  render_device().draw_indexed(mesh.vertexArrayBufferObject, primitive, mesh.numIndices, instance_count);
 }
 
-void render(const MeshPtr &mesh)
+MeshHandle make_mesh(const std::vector<uint32_t> &indices, const std::vector<vec3> &vertices, const std::vector<vec3> &normals)
 {
-  glBindVertexArray(mesh->vertexArrayBufferObject);
-  glDrawElementsBaseVertex(GL_TRIANGLES, mesh->numIndices, GL_UNSIGNED_INT, 0, 0);
+  return create_mesh(nullptr, {}, indices, vertices, normals);
 }
 
-MeshPtr make_plane_mesh()
+static const std::vector<uint32_t> planeIndices = {0,1,2,0,2,3};
+static const std::vector<vec3> planeVertices = {vec3(-1,0,-1), vec3(1,0,-1), vec3(1,0,1), vec3(-1,0,1)};
+
+MeshHandle make_plane_mesh()
 {
-  std::vector<uint32_t> indices = {0,1,2,0,2,3};
-  std::vector<vec3> vertices = {vec3(-1,0,-1), vec3(1,0,-1), vec3(1,0,1), vec3(-1,0,1)};
+  const std::vector<uint32_t> &indices = planeIndices;
+  const std::vector<vec3> &vertices = planeVertices;
   std::vector<vec3> normals(4, vec3(0,1,0));
   std::vector<vec2> uv = {vec2(0,0), vec2(1,0), vec2(1,1), vec2(0,1)};
-  return create_mesh(indices, vertices, normals, uv);
+  return create_mesh(nullptr, {}, indices, vertices, normals, uv);
+}
+
+OccluderMesh make_plane_occluder()
+{
+  return OccluderMesh{planeVertices, planeIndices};
 }
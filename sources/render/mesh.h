@@ -1,12 +1,18 @@
 #pragma once
 #include <map>
 #include <memory>
+#include <vector>
+#include <animation/skeleton.h>
+#include <resource_registry.h>
+#include "glad/glad.h"
 
 
 struct Mesh
 {
   const uint32_t vertexArrayBufferObject;
   const int numIndices;
+  std::vector<uint32_t> buffers; // vertex channels and indices, deleted with the mesh
+  SkeletonPtr skeleton;
 
   Mesh(uint32_t vertexArrayBufferObject, int numIndices) :
     vertexArrayBufferObject(vertexArrayBufferObject),
@@ -14,9 +20,21 @@ struct Mesh
     {}
 };
 
-using MeshPtr = std::shared_ptr<Mesh>;
+using MeshHandle = Handle<Mesh>;
+template<> ResourcePool<Mesh> &resource_pool<Mesh>();
 
-MeshPtr load_mesh(const char *path, int idx);
-MeshPtr make_plane_mesh();
+// cpu side copy of geometry for software occlusion
+struct OccluderMesh
+{
+  std::vector<vec3> vertices;
+  std::vector<uint32_t> indices;
+};
+
+// loads of the same mesh of a file share one mesh
+MeshHandle load_mesh(const char *path, int idx);
+MeshHandle make_mesh(const std::vector<uint32_t> &indices, const std::vector<vec3> &vertices, const std::vector<vec3> &normals);
+MeshHandle make_plane_mesh();
+OccluderMesh make_plane_occluder();
 
-void render(const MeshPtr &mesh);
\ No newline at end of file
+void render(const Mesh &mesh);
+void render_instances(const Mesh &mesh, int instance_count, GLenum primitive = GL_TRIANGLES);
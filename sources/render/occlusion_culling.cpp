@@ -0,0 +1,240 @@
+#include "occlusion_culling.h"
+#include <algorithm>
+#include <cfloat>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_SSE
+#endif
+
+OcclusionBuffer::OcclusionBuffer() : depth(Width * Height, 1.f), viewProjection(1.f)
+{
+  int w = Width / TileSize, h = Height / TileSize;
+  while (true)
+  {
+    levels.push_back({w, h, std::vector<DepthRange>(w * h, {1.f, 1.f})});
+    if (w == 1 && h == 1)
+      break;
+    w = std::max(1, w / 2);
+    h = std::max(1, h / 2);
+  }
+}
+
+void OcclusionBuffer::begin(const mat4 &view_projection)
+{
+  viewProjection = view_projection;
+  std::fill(depth.begin(), depth.end(), 1.f);
+}
+
+static vec4 to_screen(const vec4 &clip)
+{
+  float invW = 1.f / clip.w;
+  return vec4(
+    (clip.x * invW * 0.5f + 0.5f) * OcclusionBuffer::Width,
+    (clip.y * invW * 0.5f + 0.5f) * OcclusionBuffer::Height,
+    clip.z * invW * 0.5f + 0.5f,
+    1.f);
+}
+
+void OcclusionBuffer::rasterize(const vec3 *vertices, const uint32_t *indices, int index_count, const mat4 &transform)
+{
+  const mat4 clipTransform = viewProjection * transform;
+  for (int i = 0; i + 2 < index_count; i += 3)
+  {
+    vec4 clip[3] = {
+      clipTransform * vec4(vertices[indices[i]], 1.f),
+      clipTransform * vec4(vertices[indices[i + 1]], 1.f),
+      clipTransform * vec4(vertices[indices[i + 2]], 1.f)};
+
+    // clip by the near plane (z = -w), a triangle becomes a polygon of up to 4 vertices
+    vec4 polygon[4];
+    int count = 0;
+    for (int j = 0; j < 3; j++)
+    {
+      const vec4 &a = clip[j], &b = clip[(j + 1) % 3];
+      float da = a.z + a.w, db = b.z + b.w;
+      if (da >= 0.f)
+        polygon[count++] = a;
+      if ((da >= 0.f) != (db >= 0.f))
+        polygon[count++] = mix(a, b, da / (da - db));
+    }
+    for (int j = 0; j < count; j++)
+      polygon[j] = to_screen(polygon[j]);
+    for (int j = 2; j < count; j++)
+      rasterize_triangle(polygon[0], polygon[j - 1], polygon[j]);
+  }
+}
+
+void OcclusionBuffer::rasterize_triangle(const vec4 &a, const vec4 &b_, const vec4 &c_)
+{
+  vec4 b = b_, c = c_;
+  float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+  if (fabsf(area) < 1e-6f)
+    return;
+  if (area < 0.f)
+  {
+    std::swap(b, c);
+    area = -area;
+  }
+
+  int minX = std::max(0, (int)floorf(std::min({a.x, b.x, c.x})));
+  int maxX = std::min(Width - 1, (int)ceilf(std::max({a.x, b.x, c.x})));
+  int minY = std::max(0, (int)floorf(std::min({a.y, b.y, c.y})));
+  int maxY = std::min(Height - 1, (int)ceilf(std::max({a.y, b.y, c.y})));
+  if (minX > maxX || minY > maxY)
+    return;
+  minX &= ~3;
+
+  // edge functions and depth are linear in screen space: value = dx * x + dy * y + c
+  const vec2 v[3] = {vec2(a), vec2(b), vec2(c)};
+  vec3 edgeDx, edgeDy, edgeC;
+  for (int i = 0; i < 3; i++)
+  {
+    const vec2 &p0 = v[(i + 1) % 3], &p1 = v[(i + 2) % 3];
+    edgeDx[i] = p0.y - p1.y;
+    edgeDy[i] = p1.x - p0.x;
+    edgeC[i] = p0.x * p1.y - p0.y * p1.x;
+  }
+  const float invArea = 1.f / area;
+  const float depthDx = (edgeDx[1] * (b.z - a.z) + edgeDx[2] * (c.z - a.z)) * invArea;
+  const float depthDy = (edgeDy[1] * (b.z - a.z) + edgeDy[2] * (c.z - a.z)) * invArea;
+  const float depthC = a.z + (edgeC[1] * (b.z - a.z) + edgeC[2] * (c.z - a.z)) * invArea;
+
+  for (int y = minY; y <= maxY; y++)
+  {
+    float py = y + 0.5f;
+    float *row = depth.data() + y * Width;
+#if defined(OCCLUSION_SSE)
+    const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    for (int x = minX; x <= maxX; x += 4)
+    {
+      __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+      __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+      for (int i = 0; i < 3; i++)
+      {
+        __m128 e = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(edgeDx[i])), _mm_set1_ps(edgeDy[i] * py + edgeC[i]));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(e, zero));
+      }
+      if (_mm_movemask_ps(inside) == 0)
+        continue;
+      __m128 z = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(depthDx)), _mm_set1_ps(depthDy * py + depthC));
+      __m128 old = _mm_loadu_ps(row + x);
+      __m128 nearest = _mm_min_ps(old, _mm_max_ps(z, zero));
+      _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+    }
+#else
+    for (int x = minX; x <= maxX; x++)
+    {
+      vec3 e = edgeDx * (x + 0.5f) + edgeDy * py + edgeC;
+      if (e.x >= 0.f && e.y >= 0.f && e.z >= 0.f)
+        row[x] = std::min(row[x], std::max(0.f, depthDx * (x + 0.5f) + depthDy * py + depthC));
+    }
+#endif
+  }
+}
+
+void OcclusionBuffer::rasterize_box(const mat4 &transform)
+{
+  static const vec3 vertices[8] = {
+    vec3(-1, -1, -1), vec3(1, -1, -1), vec3(1, 1, -1), vec3(-1, 1, -1),
+    vec3(-1, -1, 1), vec3(1, -1, 1), vec3(1, 1, 1), vec3(-1, 1, 1)};
+  static const uint32_t indices[36] = {
+    0, 1, 2, 0, 2, 3, 4, 6, 5, 4, 7, 6,
+    0, 4, 5, 0, 5, 1, 3, 2, 6, 3, 6, 7,
+    0, 3, 7, 0, 7, 4, 1, 5, 6, 1, 6, 2};
+  rasterize(vertices, indices, 36, transform);
+}
+
+void OcclusionBuffer::build_hierarchy()
+{
+  Level &base = levels[0];
+  for (int ty = 0; ty < base.height; ty++)
+    for (int tx = 0; tx < base.width; tx++)
+    {
+      DepthRange range{FLT_MAX, -FLT_MAX};
+      for (int y = ty * TileSize; y < (ty + 1) * TileSize; y++)
+        for (int x = tx * TileSize; x < (tx + 1) * TileSize; x++)
+        {
+          float d = depth[y * Width + x];
+          range.minDepth = std::min(range.minDepth, d);
+          range.maxDepth = std::max(range.maxDepth, d);
+        }
+      base.tiles[ty * base.width + tx] = range;
+    }
+
+  for (size_t l = 1; l < levels.size(); l++)
+  {
+    const Level &src = levels[l - 1];
+    Level &dst = levels[l];
+    for (int ty = 0; ty < dst.height; ty++)
+      for (int tx = 0; tx < dst.width; tx++)
+      {
+        DepthRange range{FLT_MAX, -FLT_MAX};
+        for (int y = ty * 2; y < std::min(ty * 2 + 2, src.height); y++)
+          for (int x = tx * 2; x < std::min(tx * 2 + 2, src.width); x++)
+          {
+            const DepthRange &child = src.tiles[y * src.width + x];
+            range.minDepth = std::min(range.minDepth, child.minDepth);
+            range.maxDepth = std::max(range.maxDepth, child.maxDepth);
+          }
+        dst.tiles[ty * dst.width + tx] = range;
+      }
+  }
+}
+
+// rect is in pixels, inclusive
+bool OcclusionBuffer::test_tile(int level, int x, int y, const ivec4 &rect, float nearest_depth) const
+{
+  const Level &l = levels[level];
+  if (x >= l.width || y >= l.height)
+    return false;
+  int size = TileSize << level;
+  if (x * size > rect.z || (x + 1) * size <= rect.x || y * size > rect.w || (y + 1) * size <= rect.y)
+    return false;
+
+  const DepthRange &range = l.tiles[y * l.width + x];
+  if (nearest_depth > range.maxDepth)
+    return false;
+  if (nearest_depth <= range.minDepth || level == 0)
+    return true;
+  for (int cy = y * 2; cy <= y * 2 + 1; cy++)
+    for (int cx = x * 2; cx <= x * 2 + 1; cx++)
+      if (test_tile(level - 1, cx, cy, rect, nearest_depth))
+        return true;
+  return false;
+}
+
+bool OcclusionBuffer::is_visible(const BoundingBox &box) const
+{
+  vec2 minScreen(FLT_MAX), maxScreen(-FLT_MAX);
+  float nearestDepth = FLT_MAX;
+  for (int i = 0; i < 8; i++)
+  {
+    vec3 corner(i & 1 ? box.maxPoint.x : box.minPoint.x, i & 2 ? box.maxPoint.y : box.minPoint.y, i & 4 ? box.maxPoint.z : box.minPoint.z);
+    vec4 clip = viewProjection * vec4(corner, 1.f);
+    if (clip.z + clip.w <= 0.f)
+      return true;
+    vec4 screen = to_screen(clip);
+    minScreen = min(minScreen, vec2(screen));
+    maxScreen = max(maxScreen, vec2(screen));
+    nearestDepth = std::min(nearestDepth, screen.z);
+  }
+  ivec4 rect(
+    std::max(0, (int)floorf(minScreen.x)), std::max(0, (int)floorf(minScreen.y)),
+    std::min(Width - 1, (int)ceilf(maxScreen.x)), std::min(Height - 1, (int)ceilf(maxScreen.y)));
+  if (rect.x > rect.z || rect.y > rect.w)
+    return false;
+
+  // start from the level where the rect covers at most 2x2 tiles
+  int level = 0, size = TileSize;
+  while (level + 1 < (int)levels.size() && (rect.z / size - rect.x / size > 1 || rect.w / size - rect.y / size > 1))
+  {
+    level++;
+    size = TileSize << level;
+  }
+  for (int y = rect.y / size; y <= rect.w / size; y++)
+    for (int x = rect.x / size; x <= rect.z / size; x++)
+      if (test_tile(level, x, y, rect, nearestDepth))
+        return true;
+  return false;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "3dmath.h"
+#include <vector>
+#include <cstdint>
+#include <animation/skeleton.h>
+
+// Low resolution depth buffer for CPU occlusion culling.
+// Occluders are rasterized into it, then build_hierarchy collects min/max depth per tile
+// and per mip of tiles, which is used for conservative box tests.
+class OcclusionBuffer
+{
+public:
+  static constexpr int Width = 256;
+  static constexpr int Height = 128;
+  static constexpr int TileSize = 8;
+
+private:
+  struct DepthRange
+  {
+    float minDepth, maxDepth;
+  };
+  struct Level
+  {
+    int width, height;
+    std::vector<DepthRange> tiles;
+  };
+  std::vector<float> depth;
+  std::vector<Level> levels;
+  mat4 viewProjection;
+
+  void rasterize_triangle(const vec4 &a, const vec4 &b, const vec4 &c);
+  bool test_tile(int level, int x, int y, const ivec4 &rect, float nearest_depth) const;
+
+public:
+  OcclusionBuffer();
+
+  void begin(const mat4 &view_projection);
+  void rasterize(const vec3 *vertices, const uint32_t *indices, int index_count, const mat4 &transform);
+  // cube [-1, 1]^3 transformed by transform
+  void rasterize_box(const mat4 &transform);
+  void build_hierarchy();
+
+  bool is_visible(const BoundingBox &box) const;
+};
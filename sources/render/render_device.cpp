@@ -0,0 +1,325 @@
+#include "render_device.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "log.h"
+
+void GLRenderDevice::use_program(GLuint program)
+{
+  glUseProgram(program);
+}
+
+void GLRenderDevice::set_uniform(int location, GLenum type, const void *value, bool transpose)
+{
+  const float *v = (const float *)value;
+  switch (type)
+  {
+    case GL_FLOAT: glUniform1fv(location, 1, v); break;
+    case GL_FLOAT_VEC2: glUniform2fv(location, 1, v); break;
+    case GL_FLOAT_VEC3: glUniform3fv(location, 1, v); break;
+    case GL_FLOAT_VEC4: glUniform4fv(location, 1, v); break;
+    case GL_FLOAT_MAT3: glUniformMatrix3fv(location, 1, transpose, v); break;
+    case GL_FLOAT_MAT4: glUniformMatrix4fv(location, 1, transpose, v); break;
+    case GL_INT: glUniform1i(location, *(const int *)value); break;
+    default: debug_error("uniform type 0x%x isn't supported by render device", type);
+  }
+}
+
+void GLRenderDevice::bind_texture(int unit, GLenum target, GLuint texture)
+{
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(target, texture);
+}
+
+void GLRenderDevice::bind_buffer_range(GLenum target, int binding, GLuint buffer, size_t offset, size_t size)
+{
+  glBindBufferRange(target, binding, buffer, offset, size);
+}
+
+void GLRenderDevice::write_buffer(void *destination, const void *data, size_t size)
+{
+  memcpy(destination, data, size);
+}
+
+void GLRenderDevice::set_depth_state(bool test, GLenum func, bool write)
+{
+  if (test)
+    glEnable(GL_DEPTH_TEST);
+  else
+    glDisable(GL_DEPTH_TEST);
+  glDepthFunc(func);
+  glDepthMask(write ? GL_TRUE : GL_FALSE);
+}
+
+void GLRenderDevice::set_blend(bool enable)
+{
+  if (enable)
+    glEnable(GL_BLEND);
+  else
+    glDisable(GL_BLEND);
+}
+
+void GLRenderDevice::set_polygon_mode(GLenum mode)
+{
+  glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+void GLRenderDevice::clear(const vec4 &color, GLbitfield mask)
+{
+  glClearColor(color.r, color.g, color.b, color.a);
+  glClear(mask);
+}
+
+void GLRenderDevice::draw_indexed(GLuint vertex_array, GLenum primitive, int index_count, int instance_count)
+{
+  glBindVertexArray(vertex_array);
+  if (instance_count == 1)
+    glDrawElementsBaseVertex(primitive, index_count, GL_UNSIGNED_INT, 0, 0);
+  else
+    glDrawElementsInstancedBaseVertex(primitive, index_count, GL_UNSIGNED_INT, 0, instance_count, 0);
+}
+
+
+void RenderStats::max(const RenderStats &other)
+{
+  drawCalls = std::max(drawCalls, other.drawCalls);
+  instances = std::max(instances, other.instances);
+  indices = std::max(indices, other.indices);
+  programBinds = std::max(programBinds, other.programBinds);
+  vertexArrayBinds = std::max(vertexArrayBinds, other.vertexArrayBinds);
+  textureBinds = std::max(textureBinds, other.textureBinds);
+  bufferBinds = std::max(bufferBinds, other.bufferBinds);
+  uniformSets = std::max(uniformSets, other.uniformSets);
+  stateChanges = std::max(stateChanges, other.stateChanges);
+  clears = std::max(clears, other.clears);
+  redundantCalls = std::max(redundantCalls, other.redundantCalls);
+  bufferBytes = std::max(bufferBytes, other.bufferBytes);
+}
+
+static void accumulate(RenderStats &total, const RenderStats &frame)
+{
+  total.drawCalls += frame.drawCalls;
+  total.instances += frame.instances;
+  total.indices += frame.indices;
+  total.programBinds += frame.programBinds;
+  total.vertexArrayBinds += frame.vertexArrayBinds;
+  total.textureBinds += frame.textureBinds;
+  total.bufferBinds += frame.bufferBinds;
+  total.uniformSets += frame.uniformSets;
+  total.stateChanges += frame.stateChanges;
+  total.clears += frame.clears;
+  total.redundantCalls += frame.redundantCalls;
+  total.bufferBytes += frame.bufferBytes;
+}
+
+RecordingRenderDevice::RecordingRenderDevice(RenderDevice *forward_device) : device(forward_device)
+{
+  invalidate_state();
+}
+
+void RecordingRenderDevice::invalidate_state()
+{
+  program = vertexArray = Unknown;
+  std::fill(std::begin(textures), std::end(textures), Unknown);
+  buffers.clear();
+  depthState = blend = -1;
+  polygonMode = Unknown;
+}
+
+void RecordingRenderDevice::record(RenderCallType type, bool redundant, uint64_t a, uint64_t b, uint64_t c, uint64_t d)
+{
+  trace.push_back({type, redundant, {a, b, c, d}});
+  if (redundant)
+    frameStats.redundantCalls++;
+}
+
+void RecordingRenderDevice::use_program(GLuint new_program)
+{
+  frameStats.programBinds++;
+  record(RenderCallType::UseProgram, program == new_program, new_program);
+  program = new_program;
+  if (device)
+    device->use_program(new_program);
+}
+
+void RecordingRenderDevice::set_uniform(int location, GLenum type, const void *value, bool transpose)
+{
+  frameStats.uniformSets++;
+  record(RenderCallType::SetUniform, false, program, location, type);
+  if (device)
+    device->set_uniform(location, type, value, transpose);
+}
+
+void RecordingRenderDevice::bind_texture(int unit, GLenum target, GLuint texture)
+{
+  frameStats.textureBinds++;
+  bool redundant = false;
+  if (unit >= 0 && unit < MaxTextureUnits)
+  {
+    redundant = textures[unit] == texture;
+    textures[unit] = texture;
+  }
+  record(RenderCallType::BindTexture, redundant, unit, target, texture);
+  if (device)
+    device->bind_texture(unit, target, texture);
+}
+
+void RecordingRenderDevice::bind_buffer_range(GLenum target, int binding, GLuint buffer, size_t offset, size_t size)
+{
+  frameStats.bufferBinds++;
+  auto it = std::find_if(buffers.begin(), buffers.end(), [&](const BufferBinding &b) { return b.target == target && b.binding == binding; });
+  bool redundant = false;
+  if (it == buffers.end())
+    buffers.push_back({target, binding, buffer, offset, size});
+  else
+  {
+    redundant = it->buffer == buffer && it->offset == offset && it->size == size;
+    *it = {target, binding, buffer, offset, size};
+  }
+  record(RenderCallType::BindBufferRange, redundant, target, binding, offset, size);
+  if (device)
+    device->bind_buffer_range(target, binding, buffer, offset, size);
+}
+
+void RecordingRenderDevice::write_buffer(void *destination, const void *data, size_t size)
+{
+  frameStats.bufferBytes += size;
+  record(RenderCallType::WriteBuffer, false, size);
+  if (device)
+    device->write_buffer(destination, data, size);
+}
+
+void RecordingRenderDevice::set_depth_state(bool test, GLenum func, bool write)
+{
+  frameStats.stateChanges++;
+  int state = (test ? 1 : 0) | (write ? 2 : 0) | (int)(func << 2);
+  record(RenderCallType::SetDepthState, depthState == state, test, func, write);
+  depthState = state;
+  if (device)
+    device->set_depth_state(test, func, write);
+}
+
+void RecordingRenderDevice::set_blend(bool enable)
+{
+  frameStats.stateChanges++;
+  record(RenderCallType::SetBlend, blend == (int)enable, enable);
+  blend = enable;
+  if (device)
+    device->set_blend(enable);
+}
+
+void RecordingRenderDevice::set_polygon_mode(GLenum mode)
+{
+  frameStats.stateChanges++;
+  record(RenderCallType::SetPolygonMode, polygonMode == mode, mode);
+  polygonMode = mode;
+  if (device)
+    device->set_polygon_mode(mode);
+}
+
+void RecordingRenderDevice::clear(const vec4 &color, GLbitfield mask)
+{
+  frameStats.clears++;
+  record(RenderCallType::Clear, false, mask);
+  if (device)
+    device->clear(color, mask);
+}
+
+void RecordingRenderDevice::draw_indexed(GLuint vertex_array, GLenum primitive, int index_count, int instance_count)
+{
+  frameStats.drawCalls++;
+  frameStats.instances += instance_count;
+  frameStats.indices += (int64_t)index_count * instance_count;
+  if (vertexArray != vertex_array)
+    frameStats.vertexArrayBinds++;
+  vertexArray = vertex_array;
+  record(RenderCallType::DrawIndexed, false, vertex_array, primitive, index_count, instance_count);
+  if (device)
+    device->draw_indexed(vertex_array, primitive, index_count, instance_count);
+}
+
+void RecordingRenderDevice::begin_frame()
+{
+  frameStats = RenderStats();
+  trace.clear();
+  invalidate_state();
+}
+
+void RecordingRenderDevice::end_frame()
+{
+  peakStats.max(frameStats);
+  accumulate(totalStats, frameStats);
+  frameCount++;
+  std::swap(trace, lastFrameTrace);
+}
+
+void RecordingRenderDevice::print() const
+{
+  if (frameCount == 0)
+    return;
+  const float n = frameCount;
+  auto row = [&](const char *name, double total, double peak) { debug_log("%-20s %10.1f %10.0f", name, total / n, peak); };
+  debug_log("%-20s %10s %10s", "render calls", "avg", "max");
+  row("draw calls", totalStats.drawCalls, peakStats.drawCalls);
+  row("instances", totalStats.instances, peakStats.instances);
+  row("indices", totalStats.indices, peakStats.indices);
+  row("program binds", totalStats.programBinds, peakStats.programBinds);
+  row("vertex array binds", totalStats.vertexArrayBinds, peakStats.vertexArrayBinds);
+  row("texture binds", totalStats.textureBinds, peakStats.textureBinds);
+  row("buffer binds", totalStats.bufferBinds, peakStats.bufferBinds);
+  row("uniform sets", totalStats.uniformSets, peakStats.uniformSets);
+  row("state changes", totalStats.stateChanges, peakStats.stateChanges);
+  row("clears", totalStats.clears, peakStats.clears);
+  row("redundant calls", totalStats.redundantCalls, peakStats.redundantCalls);
+  row("buffer bytes", totalStats.bufferBytes, peakStats.bufferBytes);
+}
+
+static const char *call_name(RenderCallType type)
+{
+  switch (type)
+  {
+    case RenderCallType::UseProgram: return "use_program program=%llu";
+    case RenderCallType::SetUniform: return "set_uniform program=%llu location=%llu type=0x%llx";
+    case RenderCallType::BindTexture: return "bind_texture unit=%llu target=0x%llx texture=%llu";
+    case RenderCallType::BindBufferRange: return "bind_buffer_range target=0x%llx binding=%llu offset=%llu size=%llu";
+    case RenderCallType::WriteBuffer: return "write_buffer size=%llu";
+    case RenderCallType::SetDepthState: return "set_depth_state test=%llu func=0x%llx write=%llu";
+    case RenderCallType::SetBlend: return "set_blend enable=%llu";
+    case RenderCallType::SetPolygonMode: return "set_polygon_mode mode=0x%llx";
+    case RenderCallType::Clear: return "clear mask=0x%llx";
+    case RenderCallType::DrawIndexed: return "draw_indexed vertex_array=%llu primitive=0x%llx indices=%llu instances=%llu";
+  }
+  return "unknown";
+}
+
+bool RecordingRenderDevice::save_trace(const char *path) const
+{
+  FILE *file = fopen(path, "w");
+  if (!file)
+  {
+    debug_error("can't open %s to save render trace", path);
+    return false;
+  }
+  for (const RenderCall &call : lastFrameTrace)
+  {
+    unsigned long long a[4] = {call.args[0], call.args[1], call.args[2], call.args[3]};
+    fprintf(file, call_name(call.type), a[0], a[1], a[2], a[3]);
+    fprintf(file, call.redundant ? " redundant\n" : "\n");
+  }
+  fclose(file);
+  return true;
+}
+
+
+static GLRenderDevice glDevice;
+static RenderDevice *currentDevice = &glDevice;
+
+RenderDevice &render_device()
+{
+  return *currentDevice;
+}
+
+void set_render_device(RenderDevice *device)
+{
+  currentDevice = device ? device : &glDevice;
+}
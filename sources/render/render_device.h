@@ -0,0 +1,148 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "3dmath.h"
+#include "glad/glad.h"
+
+// Every GL call of the draw path goes through the current device.
+// Resources (programs, meshes, textures, buffers) are still created with GL directly,
+// so even the null device needs a context during loading.
+class RenderDevice
+{
+public:
+  virtual ~RenderDevice() = default;
+
+  virtual void use_program(GLuint program) = 0;
+  // type is GL_FLOAT, GL_FLOAT_VEC2..4, GL_FLOAT_MAT3, GL_FLOAT_MAT4 or GL_INT, value points to one element
+  virtual void set_uniform(int location, GLenum type, const void *value, bool transpose) = 0;
+  virtual void bind_texture(int unit, GLenum target, GLuint texture) = 0;
+  virtual void bind_buffer_range(GLenum target, int binding, GLuint buffer, size_t offset, size_t size) = 0;
+  // copy to mapped GPU memory
+  virtual void write_buffer(void *destination, const void *data, size_t size) = 0;
+
+  virtual void set_depth_state(bool test, GLenum func, bool write) = 0;
+  virtual void set_blend(bool enable) = 0;
+  virtual void set_polygon_mode(GLenum mode) = 0;
+  virtual void clear(const vec4 &color, GLbitfield mask) = 0;
+
+  // indices are GL_UNSIGNED_INT
+  virtual void draw_indexed(GLuint vertex_array, GLenum primitive, int index_count, int instance_count) = 0;
+};
+
+class GLRenderDevice final : public RenderDevice
+{
+public:
+  void use_program(GLuint program) override;
+  void set_uniform(int location, GLenum type, const void *value, bool transpose) override;
+  void bind_texture(int unit, GLenum target, GLuint texture) override;
+  void bind_buffer_range(GLenum target, int binding, GLuint buffer, size_t offset, size_t size) override;
+  void write_buffer(void *destination, const void *data, size_t size) override;
+  void set_depth_state(bool test, GLenum func, bool write) override;
+  void set_blend(bool enable) override;
+  void set_polygon_mode(GLenum mode) override;
+  void clear(const vec4 &color, GLbitfield mask) override;
+  void draw_indexed(GLuint vertex_array, GLenum primitive, int index_count, int instance_count) override;
+};
+
+// counters of one frame, a call is redundant when it sets the value which is already bound
+struct RenderStats
+{
+  int drawCalls = 0;
+  int instances = 0;
+  int64_t indices = 0;
+  int programBinds = 0;
+  int vertexArrayBinds = 0; // only changes, vertex array is bound by draw calls
+  int textureBinds = 0;
+  int bufferBinds = 0;
+  int uniformSets = 0;
+  int stateChanges = 0; // depth, blend and polygon mode calls
+  int clears = 0;
+  int redundantCalls = 0;
+  size_t bufferBytes = 0;
+
+  void max(const RenderStats &other);
+};
+
+enum class RenderCallType : uint8_t
+{
+  UseProgram,
+  SetUniform,
+  BindTexture,
+  BindBufferRange,
+  WriteBuffer,
+  SetDepthState,
+  SetBlend,
+  SetPolygonMode,
+  Clear,
+  DrawIndexed
+};
+
+struct RenderCall
+{
+  RenderCallType type;
+  bool redundant;
+  uint64_t args[4];
+};
+
+// Counts and logs every call and forwards it to the wrapped device.
+// Without wrapped device it is the null backend: nothing reaches GL, only CPU cost of the draw path stays.
+// Calls come from the thread which replays render commands, results are read after flush_render_thread.
+class RecordingRenderDevice final : public RenderDevice
+{
+  static constexpr int MaxTextureUnits = 32;
+  struct BufferBinding
+  {
+    GLenum target;
+    int binding;
+    GLuint buffer;
+    size_t offset, size;
+  };
+  static constexpr GLuint Unknown = ~0u;
+
+  RenderDevice *device;
+  RenderStats frameStats, peakStats, totalStats;
+  int frameCount = 0;
+  std::vector<RenderCall> trace, lastFrameTrace;
+
+  // mirror of GL state, reset every frame because code outside of the device (ImGui) changes it
+  GLuint program, vertexArray;
+  GLuint textures[MaxTextureUnits];
+  std::vector<BufferBinding> buffers;
+  int depthState, blend;
+  GLenum polygonMode;
+
+  void record(RenderCallType type, bool redundant, uint64_t a = 0, uint64_t b = 0, uint64_t c = 0, uint64_t d = 0);
+  void invalidate_state();
+
+public:
+  explicit RecordingRenderDevice(RenderDevice *forward_device);
+
+  void use_program(GLuint program) override;
+  void set_uniform(int location, GLenum type, const void *value, bool transpose) override;
+  void bind_texture(int unit, GLenum target, GLuint texture) override;
+  void bind_buffer_range(GLenum target, int binding, GLuint buffer, size_t offset, size_t size) override;
+  void write_buffer(void *destination, const void *data, size_t size) override;
+  void set_depth_state(bool test, GLenum func, bool write) override;
+  void set_blend(bool enable) override;
+  void set_polygon_mode(GLenum mode) override;
+  void clear(const vec4 &color, GLbitfield mask) override;
+  void draw_indexed(GLuint vertex_array, GLenum primitive, int index_count, int instance_count) override;
+
+  void begin_frame();
+  void end_frame();
+
+  int frames() const { return frameCount; }
+  const RenderStats &peak_frame_stats() const { return peakStats; }
+  const RenderStats &total_stats() const { return totalStats; }
+  const std::vector<RenderCall> &last_frame_trace() const { return lastFrameTrace; }
+
+  // average and peak per frame to the log
+  void print() const;
+  // every call of the last complete frame as text, one call per line
+  bool save_trace(const char *path) const;
+};
+
+// GL device unless another one is set, nullptr restores it
+RenderDevice &render_device();
+void set_render_device(RenderDevice *device);
@@ -0,0 +1,127 @@
+#include "ring_buffer.h"
+#include "render_device.h"
+#include "log.h"
+
+static size_t align_up(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void RingBuffer::init(size_t region_size)
+{
+  GLint alignment;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  uniformAlignment = alignment;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  storageAlignment = alignment;
+
+  regionSize = align_up(region_size, 256);
+  const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferStorage(GL_COPY_WRITE_BUFFER, regionSize * RegionCount, nullptr, flags);
+  mappedData = (char *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, regionSize * RegionCount, flags);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  if (!mappedData)
+    debug_error("failed to map dynamic buffer of %zu bytes", regionSize * RegionCount);
+  head = 0;
+  region = 0;
+}
+
+void RingBuffer::destroy()
+{
+  for (GLsync &fence : fences)
+  {
+    if (fence)
+      glDeleteSync(fence);
+    fence = nullptr;
+  }
+  if (buffer)
+  {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+  }
+  buffer = 0;
+  mappedData = nullptr;
+}
+
+void RingBuffer::begin_frame()
+{
+  GLsync &fence = fences[region];
+  if (fence)
+  {
+    GLbitfield waitFlags = 0;
+    while (true)
+    {
+      GLenum result = glClientWaitSync(fence, waitFlags, 1000000);
+      if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+        break;
+      waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+  head = 0;
+}
+
+void RingBuffer::end_frame()
+{
+  fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  region = (region + 1) % RegionCount;
+}
+
+RingBufferAllocation RingBuffer::allocate(size_t size, size_t alignment)
+{
+  size_t offset = align_up(head, alignment);
+  if (!mappedData || offset + size > regionSize)
+  {
+    debug_error("dynamic buffer overflow, requested %zu bytes, %zu of %zu used", size, head, regionSize);
+    return {};
+  }
+  head = offset + size;
+  if (head > peakUsage)
+    peakUsage = head;
+  size_t bufferOffset = region * regionSize + offset;
+  return {mappedData + bufferOffset, buffer, bufferOffset, size};
+}
+
+
+static RingBuffer dynamicBuffer;
+
+void init_dynamic_buffer(size_t region_size)
+{
+  dynamicBuffer.init(region_size);
+}
+
+void close_dynamic_buffer()
+{
+  dynamicBuffer.destroy();
+}
+
+RingBuffer &dynamic_buffer()
+{
+  return dynamicBuffer;
+}
+
+static RingBufferAllocation upload_block(GLenum target, RingBufferAllocation allocation, int binding, const void *data, size_t size)
+{
+  if (allocation)
+  {
+    RenderDevice &device = render_device();
+    device.write_buffer(allocation.data, data, size);
+    device.bind_buffer_range(target, binding, allocation.buffer, allocation.offset, size);
+  }
+  return allocation;
+}
+
+RingBufferAllocation upload_uniform_block(int binding, const void *data, size_t size)
+{
+  return upload_block(GL_UNIFORM_BUFFER, dynamicBuffer.allocate_uniform(size), binding, data, size);
+}
+
+RingBufferAllocation upload_storage_block(int binding, const void *data, size_t size)
+{
+  return upload_block(GL_SHADER_STORAGE_BUFFER, dynamicBuffer.allocate_storage(size), binding, data, size);
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include "glad/glad.h"
+
+struct RingBufferAllocation
+{
+  char *data = nullptr;
+  GLuint buffer = 0;
+  size_t offset = 0;
+  size_t size = 0;
+
+  explicit operator bool() const { return data != nullptr; }
+};
+
+// One persistently mapped buffer split into RegionCount regions.
+// Every frame allocates linearly from its own region, the fence placed in end_frame
+// guards the region until the GPU is done with it, so nothing is ever reallocated.
+class RingBuffer
+{
+public:
+  static constexpr int RegionCount = 3;
+
+private:
+  GLuint buffer = 0;
+  char *mappedData = nullptr;
+  size_t regionSize = 0;
+  size_t head = 0;
+  size_t peakUsage = 0;
+  int region = 0;
+  GLsync fences[RegionCount] = {};
+  size_t uniformAlignment = 256;
+  size_t storageAlignment = 256;
+
+public:
+  void init(size_t region_size);
+  void destroy();
+
+  void begin_frame();
+  void end_frame();
+
+  RingBufferAllocation allocate(size_t size, size_t alignment);
+  RingBufferAllocation allocate_uniform(size_t size) { return allocate(size, uniformAlignment); }
+  RingBufferAllocation allocate_storage(size_t size) { return allocate(size, storageAlignment); }
+
+  size_t used() const { return head; }
+  size_t peak_used() const { return peakUsage; }
+  size_t capacity() const { return regionSize; }
+};
+
+void init_dynamic_buffer(size_t region_size);
+void close_dynamic_buffer();
+RingBuffer &dynamic_buffer();
+
+// allocate, copy and bind with glBindBufferRange in one call
+RingBufferAllocation upload_uniform_block(int binding, const void *data, size_t size);
+RingBufferAllocation upload_storage_block(int binding, const void *data, size_t size);
@@ -7,126 +7,618 @@
 #include <array>
 #include <vector>
 #include <fstream>
+#include "file_watcher.h"
+#include "shader_preprocessor.h"
+#include "render_thread.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
 
 
-static void read_shader_info(Shader &shader)
+const ShaderBlockMember *ShaderBlock::find_member(const char *member_name) const
+{
+  for (const ShaderBlockMember &member : members)
+    if (member.name == member_name)
+      return &member;
+  return nullptr;
+}
+
+int find_block_offset(const ShaderBlock &block, const char *member_name, GLenum type)
+{
+  const ShaderBlockMember *member = block.find_member(member_name);
+  if (!member)
+    return -1;
+  if (member->type != type)
+  {
+    debug_error("member %s of block %s has type 0x%x, requested 0x%x", member_name, block.name.c_str(), member->type, type);
+    return -1;
+  }
+  if (type == GL_FLOAT_MAT4 && member->matrixStride != sizeof(vec4))
+  {
+    debug_error("member %s of block %s has matrix stride %d, it can't be written as mat4", member_name, block.name.c_str(), member->matrixStride);
+    return -1;
+  }
+  return member->offset;
+}
+
+static std::vector<BlockLayout> blockLayouts;
+
+void register_block_layout(BlockLayout layout)
+{
+  for (BlockLayout &registered : blockLayouts)
+    if (!strcmp(registered.name, layout.name))
+    {
+      registered = std::move(layout);
+      return;
+    }
+  blockLayouts.emplace_back(std::move(layout));
+}
+
+static void validate_block_layout(const Shader &shader, const ShaderBlock &block, const BlockLayout &layout)
+{
+  if (layout.arrayStride == 0 && (size_t)block.dataSize > layout.size)
+    debug_error("%s: block %s needs %d bytes, C++ struct has %zu", shader.name.c_str(), block.name.c_str(), block.dataSize, layout.size);
+  for (const BlockLayoutField &field : layout.fields)
+  {
+    // members unused by this program may be dropped by the linker
+    const ShaderBlockMember *member = block.find_member(field.name);
+    if (!member)
+      continue;
+    if (member->type != field.type || (size_t)member->offset != field.offset)
+      debug_error("%s: block %s member %s is type 0x%x at offset %d, C++ expects type 0x%x at offset %zu",
+        shader.name.c_str(), block.name.c_str(), field.name, member->type, member->offset, field.type, field.offset);
+    if (field.type == GL_FLOAT_MAT4 && member->matrixStride != sizeof(vec4))
+      debug_error("%s: block %s member %s has matrix stride %d, C++ expects %zu",
+        shader.name.c_str(), block.name.c_str(), field.name, member->matrixStride, sizeof(vec4));
+    // runtime array of structs has top level stride, runtime array of plain type has own stride
+    int stride = member->topLevelArrayStride ? member->topLevelArrayStride : member->arrayStride;
+    if (layout.arrayStride != 0 && (size_t)stride != layout.arrayStride)
+      debug_error("%s: block %s member %s has array stride %d, C++ expects %zu",
+        shader.name.c_str(), block.name.c_str(), field.name, stride, layout.arrayStride);
+  }
+}
+
+static void read_shader_blocks(Shader &shader, GLenum block_interface, GLenum member_interface)
 {
   GLuint program = shader.program;
+  const GLsizei bufSize = 128;
+  GLchar name[bufSize];
+
+  int count = 0;
+  glGetProgramInterfaceiv(program, block_interface, GL_ACTIVE_RESOURCES, &count);
+  for (int i = 0; i < count; i++)
+  {
+    const GLenum blockProps[] = {GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE, GL_NUM_ACTIVE_VARIABLES};
+    GLint blockValues[3];
+    glGetProgramResourceiv(program, block_interface, i, 3, blockProps, 3, nullptr, blockValues);
+    glGetProgramResourceName(program, block_interface, i, bufSize, nullptr, name);
+
+    ShaderBlock block{std::string(name), block_interface, blockValues[0], blockValues[1], {}};
+    std::vector<GLint> variables(blockValues[2]);
+    const GLenum activeVariables = GL_ACTIVE_VARIABLES;
+    glGetProgramResourceiv(program, block_interface, i, 1, &activeVariables, variables.size(), nullptr, variables.data());
+
+    const bool storage = member_interface == GL_BUFFER_VARIABLE;
+    for (GLint variable : variables)
+    {
+      const GLenum props[] = {GL_TYPE, GL_OFFSET, GL_ARRAY_SIZE, GL_ARRAY_STRIDE, GL_MATRIX_STRIDE, GL_TOP_LEVEL_ARRAY_STRIDE};
+      GLint values[6] = {};
+      glGetProgramResourceiv(program, member_interface, variable, storage ? 6 : 5, props, 6, nullptr, values);
+      glGetProgramResourceName(program, member_interface, variable, bufSize, nullptr, name);
+      block.members.emplace_back(ShaderBlockMember{std::string(name), (unsigned)values[0], values[1], values[2], values[3], values[4], values[5]});
+    }
+    std::sort(block.members.begin(), block.members.end(),
+      [](const ShaderBlockMember &a, const ShaderBlockMember &b) { return a.offset < b.offset; });
+    shader.blocks.emplace_back(std::move(block));
+  }
+}
 
-  int count;
+static void read_shader_info(Shader &shader)
+{
+  GLuint program = shader.program;
   const GLsizei bufSize = 128;
   GLchar name[bufSize];
-  GLsizei length;
+
   shader.uniforms.clear();
-  glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+  int count = 0;
+  glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
   for (int i = 0; i < count; i++)
   {
-    GLenum type;
-    GLint size;
-    glGetActiveUniform(program, (GLuint)i, bufSize, &length, &size, &type, name);
-    //debug_log("uniform %s #%d Type: %u Name: %s", shader.name.c_str(), i, type, name);
+    const GLenum props[] = {GL_TYPE, GL_LOCATION, GL_BLOCK_INDEX};
+    GLint values[3];
+    glGetProgramResourceiv(program, GL_UNIFORM, i, 3, props, 3, nullptr, values);
+    // block members are described by shader.blocks
+    if (values[2] >= 0)
+      continue;
+    glGetProgramResourceName(program, GL_UNIFORM, i, bufSize, nullptr, name);
+    shader.uniforms.emplace_back(ShaderUniform{std::string(name), (unsigned)values[0], values[1]});
+  }
+
+  shader.blocks.clear();
+  read_shader_blocks(shader, GL_UNIFORM_BLOCK, GL_UNIFORM);
+  read_shader_blocks(shader, GL_SHADER_STORAGE_BLOCK, GL_BUFFER_VARIABLE);
+  const ShaderBlock *drawData = shader.find_block("DrawData");
+  shader.drawDataSize = drawData ? drawData->dataSize : 0;
+  shader.drawTransform = drawData ? BlockField<mat4>(*drawData, "Transform") : BlockField<mat4>();
+
+  for (const ShaderBlock &block : shader.blocks)
+    for (const BlockLayout &layout : blockLayouts)
+      if (block.name == layout.name)
+        validate_block_layout(shader, block, layout);
+}
+
+using ShaderInfo = ShaderStageSource;
+
+static const char *shaderCacheDir = "cache/shaders";
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  return hash;
+}
 
-    GLint shaderLocation = glGetUniformLocation(program, name);
-    shader.uniforms.emplace_back(ShaderUniform{std::string(name), type, shaderLocation});
+static const std::string &driver_string()
+{
+  static std::string driver;
+  if (driver.empty())
+  {
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+    {
+      const GLubyte *value = glGetString(name);
+      driver += value ? (const char *)value : "";
+      driver += ';';
+    }
   }
+  return driver;
+}
+
+static bool program_binary_supported()
+{
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  return formats > 0;
 }
 
-struct ShaderInfo
+// the key covers the final source text of every stage (so defines too) and the driver,
+// a driver update invalidates all binaries
+static uint64_t content_hash(const std::vector<ShaderInfo> &shaders, uint64_t hash = 14695981039346656037ull)
 {
-  GLenum shaderType;
-  std::string path;
-  std::string sources;
+  for (const ShaderInfo &shader : shaders)
+  {
+    hash = hash_bytes(hash, &shader.shaderType, sizeof(shader.shaderType));
+    hash = hash_bytes(hash, shader.sources.data(), shader.sources.size());
+  }
+  return hash;
+}
+
+static std::string program_cache_path(const char *shaderName, const std::vector<ShaderInfo> &shaders)
+{
+  const std::string &driver = driver_string();
+  uint64_t hash = content_hash(shaders, hash_bytes(14695981039346656037ull, driver.data(), driver.size()));
+  char name[256];
+  snprintf(name, sizeof(name), "%s/%s_%016llx.bin", shaderCacheDir, shaderName, (unsigned long long)hash);
+  return name;
+}
+
+struct ProgramBinaryHeader
+{
+  uint32_t magic;
+  uint32_t format;
+  uint32_t length;
 };
+static constexpr uint32_t ProgramBinaryMagic = 0x42505347; // GSPB
 
-static bool compile_shader(const char *shaderName, const std::vector<ShaderInfo> &shaders, GLuint &program)
+static bool load_program_binary(const std::string &path, GLuint &program)
 {
-  std::vector<GLuint> compiled_shaders;
-  compiled_shaders.reserve(shaders.size());
-  GLchar infoLog[1024];
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+  ProgramBinaryHeader header;
+  if (!file.read((char *)&header, sizeof(header)) || header.magic != ProgramBinaryMagic)
+    return false;
+  std::vector<char> binary(header.length);
+  if (!file.read(binary.data(), header.length))
+    return false;
+
+  program = glCreateProgram();
+  glProgramBinary(program, header.format, binary.data(), header.length);
   GLint success;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success)
+  {
+    glDeleteProgram(program);
+    program = 0;
+    return false;
+  }
+  return true;
+}
+
+static void save_program_binary(const std::string &path, GLuint program)
+{
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+  std::vector<char> binary(length);
+  GLenum format;
+  glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+  std::error_code error;
+  std::filesystem::create_directories(shaderCacheDir, error);
+  std::ofstream file(path, std::ios::binary);
+  ProgramBinaryHeader header{ProgramBinaryMagic, format, (uint32_t)length};
+  file.write((const char *)&header, sizeof(header));
+  file.write(binary.data(), length);
+  if (!file)
+    debug_error("failed to write shader cache %s", path.c_str());
+}
+
+// compile and link are issued without reading back any status,
+// so with parallel shader compile the driver builds the program in background
+struct ProgramBuild
+{
+  std::string name;
+  GLuint program = 0;
+  std::vector<GLuint> shaders;
+  std::vector<std::string> paths;
+  std::string cachePath;
+  std::vector<std::string> dependencies;
+  bool fromCache = false;
+};
+
+static bool parallelCompile = false;
+
+static ProgramBuild start_build(const char *shaderName, const std::vector<ShaderInfo> &shaders)
+{
+  ProgramBuild build;
+  build.name = shaderName;
+  if (program_binary_supported())
+  {
+    build.cachePath = program_cache_path(shaderName, shaders);
+    if (load_program_binary(build.cachePath, build.program))
+    {
+      build.fromCache = true;
+      return build;
+    }
+    // stale or rejected by driver, rebuild it
+    std::error_code error;
+    std::filesystem::remove(build.cachePath, error);
+  }
+
   for (const ShaderInfo &shader : shaders)
   {
     GLuint shaderProg = glCreateShader(shader.shaderType);
     const GLchar * shaderCode = shader.sources.c_str();
     glShaderSource(shaderProg, 1, &shaderCode, NULL);
     glCompileShader(shaderProg);
-    glGetShaderiv(shaderProg, GL_COMPILE_STATUS, &success);
-    if(!success)
-    {
-      glGetShaderInfoLog(shaderProg, 512, NULL, infoLog);
-      debug_error("Shader (%s) compilation failed!\n Log: %s", shader.path.c_str(), infoLog);
-      return false;
-    };
-    compiled_shaders.push_back(shaderProg);
+    build.shaders.push_back(shaderProg);
+    build.paths.push_back(shader.path);
   }
 
+  build.program = glCreateProgram();
+  for (GLuint shaderProg : build.shaders)
+    glAttachShader(build.program, shaderProg);
+  if (!build.cachePath.empty())
+    glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glLinkProgram(build.program);
+  return build;
+}
 
-  program = glCreateProgram();
-  for (GLuint shaderProg : compiled_shaders)
-    glAttachShader(program, shaderProg);
+static bool build_ready(const ProgramBuild &build)
+{
+  if (!parallelCompile || build.fromCache || !build.program)
+    return true;
+  GLint completed;
+  glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &completed);
+  return completed;
+}
 
-  glLinkProgram(program);
-  glGetProgramiv(program, GL_LINK_STATUS, &success);
+// on failure logs errors and deletes the program
+static bool finish_build(ProgramBuild &build)
+{
+  if (build.fromCache)
+    return true;
+  if (!build.program)
+    return false;
 
-  if (!success)
+  GLchar infoLog[1024];
+  GLint success;
+  bool compiled = true;
+  for (size_t i = 0; i < build.shaders.size(); i++)
   {
-    glGetProgramInfoLog(program, 1024, NULL, infoLog);
-    debug_error("Shader programm (%s) linking failed!\n Log: %s", shaderName, infoLog);
-    return false;
+    glGetShaderiv(build.shaders[i], GL_COMPILE_STATUS, &success);
+    if(!success)
+    {
+      glGetShaderInfoLog(build.shaders[i], 512, NULL, infoLog);
+      debug_error("Shader (%s) compilation failed!\n Log: %s", build.paths[i].c_str(), infoLog);
+      compiled = false;
+    }
+  }
+  if (compiled)
+  {
+    glGetProgramiv(build.program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+      glGetProgramInfoLog(build.program, 1024, NULL, infoLog);
+      debug_error("Shader programm (%s) linking failed!\n Log: %s", build.name.c_str(), infoLog);
+      compiled = false;
+    }
   }
 
-  for (GLuint shaderProg : compiled_shaders)
+  for (GLuint shaderProg : build.shaders)
+  {
+    glDetachShader(build.program, shaderProg);
     glDeleteShader(shaderProg);
+  }
+  build.shaders.clear();
+
+  if (!compiled)
+  {
+    glDeleteProgram(build.program);
+    build.program = 0;
+    return false;
+  }
+  if (!build.cachePath.empty())
+    save_program_binary(build.cachePath, build.program);
   return true;
 }
 
+// sources are read once and dropped from the cache when the watcher reports a change
+static std::map<std::string, std::string> fileCache;
 
+static const std::string &read_file(const std::string &path)
+{
+  std::string key = normalize_path(path);
+  auto it = fileCache.find(key);
+  if (it == fileCache.end())
+  {
+    std::ifstream file(path);
+    it = fileCache.emplace(key, std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>())).first;
+  }
+  return it->second;
+}
 
-static std::string read_file(const char *path)
+static bool preprocess(const Shader::ShaderSources &sources, const std::vector<std::string> &keywords,
+  std::vector<ShaderInfo> &shaderCode, std::vector<std::string> &dependencies, std::string *name = nullptr)
 {
-  std::ifstream file(path);
-  return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  for (const auto &[shaderType, path] : sources)
+  {
+    PreprocessedShader preprocessed;
+    if (!preprocess_shader(path, shaderType, keywords, read_file, preprocessed))
+      return false;
+    for (ShaderInfo &stage : preprocessed.stages)
+      shaderCode.emplace_back(std::move(stage));
+    dependencies.insert(dependencies.end(), preprocessed.dependencies.begin(), preprocessed.dependencies.end());
+    if (name && !preprocessed.name.empty())
+      *name = preprocessed.name;
+  }
+  return true;
 }
 
-static bool compile_shader(const char *name, const Shader::ShaderSources &sources, GLuint &program)
+static ProgramBuild start_build(const char *name, const Shader::ShaderSources &sources, const std::vector<std::string> &keywords)
 {
   std::vector<ShaderInfo> shaderCode;
-
-  for (const auto &[shaderType, path] : sources)
+  std::vector<std::string> dependencies;
+  if (!preprocess(sources, keywords, shaderCode, dependencies))
   {
-    shaderCode.emplace_back(ShaderInfo{shaderType, path, read_file(path.c_str())});
+    ProgramBuild failed;
+    failed.name = name;
+    return failed;
   }
-  return compile_shader(name, shaderCode, program);
+  ProgramBuild build = start_build(name, shaderCode);
+  build.dependencies = std::move(dependencies);
+  return build;
 }
 
-static std::vector<ShaderPtr> shaderList;
+static void destroy_shader(Shader &shader)
+{
+  enqueue_render_command([program = shader.program]() { glDeleteProgram(program); });
+}
 
-ShaderPtr compile_shader(const char *name, const char *vs_path, const char *ps_path)
+template<>
+ResourcePool<Shader> &resource_pool<Shader>()
+{
+  static ResourcePool<Shader> pool("shaders", destroy_shader);
+  return pool;
+}
+
+// every shader is watched for hot reload, the list keeps one reference so shaders live until exit
+static std::vector<ShaderHandle> shaderList;
+
+static ShaderHandle create_shader(const std::string &name, ProgramBuild &build, const Shader::ShaderSources &sources, const std::vector<std::string> &keywords)
+{
+  if (!finish_build(build))
+    return {};
+  Shader shader(name, build.program, sources);
+  shader.keywords = keywords;
+  shader.dependencies = std::move(build.dependencies);
+  read_shader_info(shader);
+  GLint binarySize = 0;
+  glGetProgramiv(build.program, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+  ShaderHandle handle = resource_pool<Shader>().add(std::move(shader), binarySize);
+  shaderList.push_back(handle);
+  acquire_resource(handle);
+  return handle;
+}
+
+ShaderHandle compile_shader(const char *name, const char *vs_path, const char *ps_path)
 {
   Shader::ShaderSources shaderSources{{GL_VERTEX_SHADER, vs_path}, {GL_FRAGMENT_SHADER, ps_path}};
 
-  GLuint program;
-  if (compile_shader(name, shaderSources, program))
+  ProgramBuild build = start_build(name, shaderSources, {});
+  return create_shader(name, build, shaderSources, {});
+}
+
+// requested variants by path and keywords, and all variants by code so equal permutations share one program
+static std::map<std::string, ShaderHandle> variantCache;
+static std::map<uint64_t, ShaderHandle> contentCache;
+
+static ShaderHandle share_shader(ShaderHandle shader)
+{
+  resource_pool<Shader>().count_load(true);
+  acquire_resource(shader);
+  return shader;
+}
+
+ShaderHandle get_shader(const char *path, const std::vector<std::string> &keywords)
+{
+  std::vector<std::string> sortedKeywords = keywords;
+  std::sort(sortedKeywords.begin(), sortedKeywords.end());
+  sortedKeywords.erase(std::unique(sortedKeywords.begin(), sortedKeywords.end()), sortedKeywords.end());
+  std::string variantKey = normalize_path(path);
+  for (const std::string &keyword : sortedKeywords)
+    variantKey += " " + keyword;
+  auto variant = variantCache.find(variantKey);
+  if (variant != variantCache.end())
+    return share_shader(variant->second);
+
+  Shader::ShaderSources shaderSources{{MultiStageShader, path}};
+  std::vector<ShaderInfo> shaderCode;
+  std::vector<std::string> dependencies;
+  std::string name = std::filesystem::path(path).stem().string();
+  if (!preprocess(shaderSources, sortedKeywords, shaderCode, dependencies, &name))
+    return {};
+
+  uint64_t hash = content_hash(shaderCode);
+  auto sameCode = contentCache.find(hash);
+  if (sameCode != contentCache.end())
+    return share_shader(variantCache[variantKey] = sameCode->second);
+
+  resource_pool<Shader>().count_load(false);
+  for (const std::string &keyword : sortedKeywords)
+    name += "_" + keyword;
+  ProgramBuild build = start_build(name.c_str(), shaderCode);
+  build.dependencies = std::move(dependencies);
+  ShaderHandle shader = create_shader(name, build, shaderSources, sortedKeywords);
+  if (shader)
   {
-    auto shader = std::make_shared<Shader>(name, program, shaderSources);
-    read_shader_info(*shader);
-    shaderList.push_back(shader);
-    return shader;
+    contentCache[hash] = shader;
+    variantCache[variantKey] = shader;
   }
-  return nullptr;
+  return shader;
 }
 
+struct PendingReload
+{
+  ShaderHandle shader;
+  ProgramBuild build;
+};
+static std::vector<PendingReload> pendingReloads;
 
-void recompile_all_shaders()
+// linked programs with their layouts read on the render thread, the game thread swaps them in
+struct FinishedReload
+{
+  ShaderHandle shader;
+  Shader snapshot;
+};
+static std::vector<FinishedReload> finishedReloads;
+static std::mutex finishedReloadsMutex;
+
+// the old program keeps working until the new one is linked
+static void start_reload(ShaderHandle handle)
+{
+  const Shader *shader = get_resource(handle);
+  if (!shader)
+    return;
+  for (size_t i = 0; i < pendingReloads.size(); i++)
+    if (pendingReloads[i].shader == handle)
+    {
+      for (GLuint shaderProg : pendingReloads[i].build.shaders)
+        glDeleteShader(shaderProg);
+      glDeleteProgram(pendingReloads[i].build.program);
+      pendingReloads.erase(pendingReloads.begin() + i);
+      break;
+    }
+  pendingReloads.push_back({handle, start_build(shader->name.c_str(), shader->shaderSources, shader->keywords)});
+}
+
+void init_shader_hot_reload(const char *directory)
+{
+  if (GLAD_GL_KHR_parallel_shader_compile)
+  {
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    parallelCompile = true;
+  }
+  else if (GLAD_GL_ARB_parallel_shader_compile)
+  {
+    glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+    parallelCompile = true;
+  }
+  add_watch_directory(directory);
+}
+
+void update_shader_hot_reload()
 {
-  for (auto &shader : shaderList)
+  std::vector<std::string> changedFiles = poll_changed_files();
+  for (const std::string &path : changedFiles)
+    fileCache.erase(path);
+  for (ShaderHandle handle : shaderList)
   {
-    GLuint program;
-    if (compile_shader(shader->name.c_str(), shader->shaderSources, program))
+    const Shader *shader = get_resource(handle);
+    if (!shader)
+      continue;
+    bool changed = false;
+    for (const std::string &path : changedFiles)
+      for (const std::string &dependency : shader->dependencies)
+        changed |= path == dependency;
+    if (changed)
+      start_reload(handle);
+  }
+
+  for (size_t i = 0; i < pendingReloads.size();)
+  {
+    PendingReload &reload = pendingReloads[i];
+    if (!build_ready(reload.build))
     {
-      glDeleteProgram(shader->program);
-      shader->program = program;
-      read_shader_info(*shader);
+      i++;
+      continue;
     }
+    const Shader *shader = get_resource(reload.shader);
+    if (shader && finish_build(reload.build))
+    {
+      Shader snapshot(shader->name, reload.build.program, shader->shaderSources);
+      snapshot.dependencies = std::move(reload.build.dependencies);
+      read_shader_info(snapshot);
+      std::lock_guard<std::mutex> lock(finishedReloadsMutex);
+      finishedReloads.push_back({reload.shader, std::move(snapshot)});
+    }
+    pendingReloads.erase(pendingReloads.begin() + i);
   }
-}
\ No newline at end of file
+}
+
+void apply_shader_reloads()
+{
+  std::vector<FinishedReload> reloads;
+  {
+    std::lock_guard<std::mutex> lock(finishedReloadsMutex);
+    reloads.swap(finishedReloads);
+  }
+  if (reloads.empty())
+    return;
+  // commands of the previous frame still read programs and layouts
+  flush_render_thread();
+  for (FinishedReload &reload : reloads)
+  {
+    Shader *shader = get_resource(reload.shader);
+    GLuint unused = shader ? shader->program : reload.snapshot.program;
+    enqueue_render_command([unused]() { glDeleteProgram(unused); });
+    if (!shader)
+      continue;
+    shader->program = reload.snapshot.program;
+    shader->uniforms = std::move(reload.snapshot.uniforms);
+    shader->blocks = std::move(reload.snapshot.blocks);
+    shader->dependencies = std::move(reload.snapshot.dependencies);
+    shader->drawDataSize = reload.snapshot.drawDataSize;
+    shader->drawTransform = reload.snapshot.drawTransform;
+    debug_log("shader %s reloaded", shader->name.c_str());
+  }
+}
+
+void recompile_all_shaders()
+{
+  fileCache.clear();
+  for (ShaderHandle shader : shaderList)
+    start_reload(shader);
+}
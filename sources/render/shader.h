@@ -3,7 +3,11 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <cstring>
+#include <cstddef>
 #include "glad/glad.h"
+#include "render_device.h"
+#include <resource_registry.h>
 
 
 struct ShaderUniform
@@ -13,6 +17,82 @@ struct ShaderUniform
   int shaderLocation;
 };
 
+struct ShaderBlockMember
+{
+  std::string name;
+  unsigned int type;
+  int offset;
+  int arraySize; // 0 for runtime sized array
+  int arrayStride;
+  int matrixStride;
+  int topLevelArrayStride; // stride of the outermost array in storage blocks
+};
+
+// uniform or shader storage block as the linker laid it out
+struct ShaderBlock
+{
+  std::string name;
+  GLenum blockInterface; // GL_UNIFORM_BLOCK or GL_SHADER_STORAGE_BLOCK
+  int binding;
+  int dataSize;
+  std::vector<ShaderBlockMember> members;
+
+  const ShaderBlockMember *find_member(const char *member_name) const;
+};
+
+// GL type of C++ value, reflected types are checked against it
+template<typename T> struct ShaderType;
+template<> struct ShaderType<int> { static constexpr GLenum value = GL_INT; };
+template<> struct ShaderType<float> { static constexpr GLenum value = GL_FLOAT; };
+template<> struct ShaderType<vec2> { static constexpr GLenum value = GL_FLOAT_VEC2; };
+template<> struct ShaderType<vec3> { static constexpr GLenum value = GL_FLOAT_VEC3; };
+template<> struct ShaderType<vec4> { static constexpr GLenum value = GL_FLOAT_VEC4; };
+template<> struct ShaderType<mat4> { static constexpr GLenum value = GL_FLOAT_MAT4; };
+
+// returns offset of member with given type, -1 if it is inactive or has another type
+int find_block_offset(const ShaderBlock &block, const char *member_name, GLenum type);
+
+// Typed handle of a block member, name lookup and type check happen once,
+// writes are plain copies into block memory (mapped ring buffer or material block image).
+template<typename T>
+struct BlockField
+{
+  int offset = -1;
+
+  BlockField() = default;
+  BlockField(const ShaderBlock &block, const char *member_name) :
+    offset(find_block_offset(block, member_name, ShaderType<T>::value))
+  {}
+
+  explicit operator bool() const { return offset >= 0; }
+  void write(void *block_data, const T &value) const
+  {
+    if (offset >= 0)
+      memcpy((char *)block_data + offset, &value, sizeof(T));
+  }
+};
+
+// C++ mirror of a block, every linked program using a block with this name is validated against it
+struct BlockLayoutField
+{
+  const char *name;
+  GLenum type;
+  size_t offset;
+};
+
+struct BlockLayout
+{
+  const char *name;
+  size_t size;
+  size_t arrayStride; // size of element for storage blocks with runtime array, 0 otherwise
+  std::vector<BlockLayoutField> fields;
+};
+
+#define BLOCK_LAYOUT_FIELD(Struct, member, glsl_name) BlockLayoutField{glsl_name, ShaderType<decltype(Struct::member)>::value, offsetof(Struct, member)}
+
+// register before shaders which use the block are loaded
+void register_block_layout(BlockLayout layout);
+
 
 class Shader
 {
@@ -23,7 +103,13 @@ public:
 	const std::string name;
 	const ShaderSources shaderSources; //for hotreload
 	GLuint program;
-  std::vector<ShaderUniform> uniforms;
+  std::vector<ShaderUniform> uniforms; // only uniforms outside of blocks
+	std::vector<ShaderBlock> blocks;
+	std::vector<std::string> keywords;
+	std::vector<std::string> dependencies; // normalized paths of every file used by shader
+	// DrawData block of per draw values, resolved with the rest of the layout, size is 0 without the block
+	int drawDataSize = 0;
+	BlockField<mat4> drawTransform;
 
 	Shader(const std::string &shader_name, GLuint shader_program, ShaderSources sources):
 		name(shader_name),
@@ -31,9 +117,17 @@ public:
 		program(shader_program)
 	{}
 
+	const ShaderBlock *find_block(const char *block_name) const
+	{
+		for (const ShaderBlock &block : blocks)
+			if (block.name == block_name)
+				return &block;
+		return nullptr;
+	}
+
 	void use() const
 	{
-		glUseProgram(program);
+		render_device().use_program(program);
 	}
 
 	int get_uniform_location(const char *name)
@@ -42,11 +136,11 @@ public:
 	}
 	void set_mat3x3(const char*name, const mat3 &matrix, bool transpose = false) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(program, name), 1, transpose, glm::value_ptr(matrix));
+		set_mat3x3(glGetUniformLocation(program, name), matrix, transpose);
 	}
 	void set_mat3x3(int uniform_location, const mat3 &matrix, bool transpose = false) const
 	{
-		glUniformMatrix3fv(uniform_location, 1, transpose, glm::value_ptr(matrix));
+		render_device().set_uniform(uniform_location, GL_FLOAT_MAT3, glm::value_ptr(matrix), transpose);
 	}
 
 	void set_mat4x4(const char *name, const mat4 matrix, bool transpose = false) const
@@ -55,7 +149,7 @@ public:
 	}
 	void set_mat4x4(int uniform_location, const mat4 matrix, bool transpose = false) const
 	{
-		glUniformMatrix4fv(uniform_location, 1, transpose, glm::value_ptr(matrix));
+		render_device().set_uniform(uniform_location, GL_FLOAT_MAT4, glm::value_ptr(matrix), transpose);
 	}
 
 	void set_float(const char *name, const float &v) const
@@ -64,7 +158,7 @@ public:
   }
 	void set_float(int uniform_location, const float &v) const
 	{
-		glUniform1fv(uniform_location, 1, &v);
+		render_device().set_uniform(uniform_location, GL_FLOAT, &v, false);
   }
 	void set_int(const char *name, int v) const
 	{
@@ -72,7 +166,7 @@ public:
   }
 	void set_int(int uniform_location, int v) const
 	{
-		glUniform1i(uniform_location, v);
+		render_device().set_uniform(uniform_location, GL_INT, &v, false);
   }
 
 	void set_vec2(const char*name, const vec2 &v) const
@@ -81,7 +175,7 @@ public:
   }
 	void set_vec2(int uniform_location, const vec2 &v) const
 	{
-		glUniform2fv(uniform_location, 1, glm::value_ptr(v));
+		render_device().set_uniform(uniform_location, GL_FLOAT_VEC2, glm::value_ptr(v), false);
   }
 
 	void set_vec3(const char*name, const vec3 &v) const
@@ -90,7 +184,7 @@ public:
   }
 	void set_vec3(int uniform_location, const vec3 &v) const
 	{
-		glUniform3fv(uniform_location, 1, glm::value_ptr(v));
+		render_device().set_uniform(uniform_location, GL_FLOAT_VEC3, glm::value_ptr(v), false);
   }
 
 	void set_vec4(const char*name, const vec4 &v) const
@@ -99,12 +193,22 @@ public:
   }
 	void set_vec4(int uniform_location, const vec4 &v) const
 	{
-		glUniform4fv(uniform_location, 1, glm::value_ptr(v));
+		render_device().set_uniform(uniform_location, GL_FLOAT_VEC4, glm::value_ptr(v), false);
   }
 };
 
-using ShaderPtr = std::shared_ptr<Shader>;
+using ShaderHandle = Handle<Shader>;
+template<> ResourcePool<Shader> &resource_pool<Shader>();
 
-ShaderPtr compile_shader(const char *name, const char *vs_path, const char *ps_path);
+ShaderHandle compile_shader(const char *name, const char *vs_path, const char *ps_path);
+// single file with #vertex_shader and #pixel_shader sections, see shader_preprocessor.h.
+// Every keyword permutation is compiled on first request, permutations with equal code share a program.
+ShaderHandle get_shader(const char *path, const std::vector<std::string> &keywords = {});
 
+void init_shader_hot_reload(const char *directory);
+// render thread, starts rebuilding programs whose files changed and reads layouts of finished ones, call once per frame
+void update_shader_hot_reload();
+// game thread, before recording a frame: waits for the render thread if any program is ready
+// and replaces programs and layouts of reloaded shaders, old programs are deleted on the render thread
+void apply_shader_reloads();
 void recompile_all_shaders();
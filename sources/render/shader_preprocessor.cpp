@@ -0,0 +1,162 @@
+#include "shader_preprocessor.h"
+#include <sstream>
+#include <cstring>
+#include <cctype>
+#include <filesystem>
+#include <algorithm>
+#include "log.h"
+#include "file_watcher.h"
+
+static const char *defaultVersion = "#version 450";
+
+struct Line
+{
+  std::string text;
+  int file, line;
+};
+
+struct ExpandContext
+{
+  const ShaderFileReader &readFile;
+  std::vector<std::string> &files;
+  std::vector<Line> lines;
+};
+
+static bool starts_with(const std::string &line, const char *prefix, std::string *rest = nullptr)
+{
+  size_t begin = line.find_first_not_of(" \t");
+  if (begin == std::string::npos)
+    return false;
+  size_t len = strlen(prefix);
+  if (line.compare(begin, len, prefix) != 0)
+    return false;
+  if (begin + len < line.size() && !isspace((unsigned char)line[begin + len]))
+    return false;
+  if (rest)
+    *rest = begin + len < line.size() ? line.substr(begin + len) : std::string();
+  return true;
+}
+
+static bool expand_includes(const std::string &path, ExpandContext &context)
+{
+  std::string normalized = normalize_path(path);
+  if (std::find(context.files.begin(), context.files.end(), normalized) != context.files.end())
+    return true;
+  int fileIndex = context.files.size();
+  context.files.push_back(normalized);
+
+  std::istringstream stream(context.readFile(normalized));
+  if (stream.str().empty())
+  {
+    debug_error("shader file %s is empty or missing", normalized.c_str());
+    return false;
+  }
+  std::string line, rest;
+  for (int lineNumber = 1; std::getline(stream, line); lineNumber++)
+  {
+    if (starts_with(line, "#include", &rest))
+    {
+      size_t begin = rest.find('"'), end = rest.rfind('"');
+      if (begin == std::string::npos || end <= begin)
+      {
+        debug_error("%s(%d): bad #include", normalized.c_str(), lineNumber);
+        return false;
+      }
+      std::filesystem::path includePath = std::filesystem::path(normalized).parent_path() / rest.substr(begin + 1, end - begin - 1);
+      if (!expand_includes(includePath.string(), context))
+        return false;
+      continue;
+    }
+    context.lines.push_back({line, fileIndex, lineNumber});
+  }
+  return true;
+}
+
+static GLenum stage_directive(const std::string &line)
+{
+  if (starts_with(line, "#vertex_shader"))
+    return GL_VERTEX_SHADER;
+  if (starts_with(line, "#pixel_shader") || starts_with(line, "#fragment_shader"))
+    return GL_FRAGMENT_SHADER;
+  if (starts_with(line, "#compute_shader"))
+    return GL_COMPUTE_SHADER;
+  return GL_NONE;
+}
+
+static void append_lines(std::string &out, const std::vector<Line> &lines)
+{
+  int file = -1, line = -1;
+  for (const Line &l : lines)
+  {
+    // keeps compiler messages pointing to the original file and line, file index is in dependencies order
+    if (l.file != file || l.line != line)
+      out += "#line " + std::to_string(l.line) + " " + std::to_string(l.file) + "\n";
+    out += l.text;
+    out += '\n';
+    file = l.file;
+    line = l.line + 1;
+  }
+}
+
+bool preprocess_shader(const std::string &path, GLenum shader_type, const std::vector<std::string> &keywords,
+  const ShaderFileReader &read_file, PreprocessedShader &result)
+{
+  result = PreprocessedShader();
+  ExpandContext context{read_file, result.dependencies, {}};
+  if (!expand_includes(path, context))
+    return false;
+
+  std::string version = defaultVersion;
+  std::vector<Line> common;
+  std::vector<std::pair<GLenum, std::vector<Line>>> stages;
+  if (shader_type != MultiStageShader)
+    stages.emplace_back(shader_type, std::vector<Line>());
+
+  std::string rest;
+  for (const Line &line : context.lines)
+  {
+    if (starts_with(line.text, "#version"))
+    {
+      version = line.text;
+      continue;
+    }
+    if (starts_with(line.text, "#shader", &rest))
+    {
+      std::istringstream(rest) >> result.name;
+      continue;
+    }
+    if (starts_with(line.text, "#keywords", &rest))
+    {
+      std::istringstream words(rest);
+      for (std::string word; words >> word;)
+        result.keywords.push_back(word);
+      continue;
+    }
+    GLenum stage = shader_type == MultiStageShader ? stage_directive(line.text) : GL_NONE;
+    if (stage != GL_NONE)
+    {
+      stages.emplace_back(stage, std::vector<Line>());
+      continue;
+    }
+    (stages.empty() ? common : stages.back().second).push_back(line);
+  }
+  if (stages.empty())
+  {
+    debug_error("shader %s has no #vertex_shader or #pixel_shader sections", path.c_str());
+    return false;
+  }
+
+  std::string header = version + "\n";
+  for (const std::string &keyword : result.keywords)
+    if (std::find(keywords.begin(), keywords.end(), keyword) != keywords.end())
+      header += "#define " + keyword + " 1\n";
+
+  for (const auto &[type, lines] : stages)
+  {
+    std::string sources = header;
+    append_lines(sources, common);
+    append_lines(sources, lines);
+    result.stages.push_back({type, path, std::move(sources)});
+  }
+  return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include "glad/glad.h"
+
+// stage type for files holding all stages, split by #vertex_shader / #pixel_shader
+constexpr GLenum MultiStageShader = GL_NONE;
+
+struct ShaderStageSource
+{
+  GLenum shaderType;
+  std::string path;
+  std::string sources;
+};
+
+struct PreprocessedShader
+{
+  std::string name; // from #shader, empty if not set
+  std::vector<std::string> keywords; // declared with #keywords
+  std::vector<ShaderStageSource> stages;
+  std::vector<std::string> dependencies; // normalized paths of the file and all includes
+};
+
+using ShaderFileReader = std::function<const std::string &(const std::string &path)>;
+
+// Expands #include "file" (relative to the including file, every file once),
+// splits stages and adds #version and #define for every requested keyword
+// the file declares with #keywords, unknown keywords are ignored.
+bool preprocess_shader(const std::string &path, GLenum shader_type, const std::vector<std::string> &keywords,
+  const ShaderFileReader &read_file, PreprocessedShader &result);
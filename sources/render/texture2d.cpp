@@ -1,14 +1,28 @@
 #include "texture2d.h"
 #include "glad/glad.h"
 #include <cassert>
+#include <file_watcher.h>
+#include <render_thread.h>
+#include <log.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 
-Texture2DPtr create_texture(const unsigned char *image, int w, int h, int ch)
+static void destroy_texture(Texture2D &texture)
+{
+  enqueue_render_command([textureObject = texture.textureObject]() { glDeleteTextures(1, &textureObject); });
+}
+
+template<>
+ResourcePool<Texture2D> &resource_pool<Texture2D>()
+{
+  static ResourcePool<Texture2D> pool("textures", destroy_texture);
+  return pool;
+}
+
+static Texture2DHandle create_texture(const unsigned char *image, int w, int h, int ch, const std::string &key)
 {
   GLuint textureObject;
   glGenTextures(1, &textureObject);
-  auto texture = std::make_shared<Texture2D>(textureObject);
   GLuint textureType = GL_TEXTURE_2D;
 
   glBindTexture(textureType, textureObject);
@@ -36,20 +50,48 @@ Texture2DPtr create_texture(const unsigned char *image, int w, int h, int ch)
   }
   glBindTexture(textureType, 0);
 
-  return texture;
+  // mip chain adds a third
+  size_t bytes = (size_t)w * h * ch * (generateMips ? 4 : 3) / 3;
+  return resource_pool<Texture2D>().add(Texture2D(textureObject), bytes, key);
 }
 
-Texture2DPtr create_texture2d(const char *path)
+Texture2DHandle create_texture2d(const char *path)
 {
+  std::string key = normalize_path(path);
+  if (Texture2DHandle loaded = resource_pool<Texture2D>().find(key))
+    return loaded;
   int w, h, ch;
   stbi_set_flip_vertically_on_load(true);
   auto stbiData = stbi_load(path, &w, &h, &ch, 0);
   assert(ch == 4);
-  Texture2DPtr result;
+  Texture2DHandle result;
   if (stbiData)
   {
-    result = create_texture(stbiData, w, h, ch);
+    result = create_texture(stbiData, w, h, ch, key);
     stbi_image_free(stbiData);
   }
   return result;
 }
+
+Texture2DHandle create_float_texture2d(int w, int h, const float *texels, bool half_precision)
+{
+  GLint maxSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+  if (w > maxSize || h > maxSize)
+  {
+    debug_error("float texture %dx%d is bigger than max texture size %d", w, h, maxSize);
+    return {};
+  }
+  GLuint textureObject;
+  glGenTextures(1, &textureObject);
+  glBindTexture(GL_TEXTURE_2D, textureObject);
+  glTexImage2D(GL_TEXTURE_2D, 0, half_precision ? GL_RGBA16F : GL_RGBA32F, w, h, 0, GL_RGBA, GL_FLOAT, texels);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  size_t bytes = (size_t)w * h * 4 * (half_precision ? 2 : 4);
+  return resource_pool<Texture2D>().add(Texture2D(textureObject), bytes);
+}
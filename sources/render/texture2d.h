@@ -1,6 +1,6 @@
 #pragma once
 
-#include <memory>
+#include <resource_registry.h>
 
 struct Texture2D
 {
@@ -8,6 +8,11 @@ struct Texture2D
   Texture2D(unsigned textureObject) : textureObject(textureObject) {}
 };
 
-using Texture2DPtr = std::shared_ptr<Texture2D>;
+using Texture2DHandle = Handle<Texture2D>;
+template<> ResourcePool<Texture2D> &resource_pool<Texture2D>();
 
-Texture2DPtr create_texture2d(const char *path);
\ No newline at end of file
+// loads of the same path share one texture
+Texture2DHandle create_texture2d(const char *path);
+// float RGBA texels read by texelFetch: nearest filtering without mips,
+// half precision stores them as RGBA16F for half of the memory
+Texture2DHandle create_float_texture2d(int w, int h, const float *texels, bool half_precision);
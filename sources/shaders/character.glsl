@@ -0,0 +1,86 @@
+#shader character
+#keywords SKINNING LOD1
+
+#include "common.glsl"
+
+struct VsOutput
+{
+  vec3 EyespaceNormal;
+  vec3 WorldPosition;
+  vec2 UV;
+};
+
+#vertex_shader
+
+#ifdef SKINNING
+layout(std430, binding = 1) readonly buffer SkinningPalette
+{
+  mat4 Bones[];
+};
+#endif
+
+// per draw values, written through BlockField handles
+layout(std140, binding = 6) uniform DrawData
+{
+  mat4 Transform;
+};
+
+
+layout(location = 0) in vec3 Position;
+layout(location = 1) in vec3 Normal;
+layout(location = 2) in vec2 UV;
+layout(location = 3) in vec4 BoneWeights;
+layout(location = 4) in uvec4 BoneIndex;
+
+out VsOutput vsOutput;
+
+void main()
+{
+#ifdef SKINNING
+  mat4 Skinning =
+    Bones[BoneIndex.x] * BoneWeights.x + Bones[BoneIndex.y] * BoneWeights.y +
+    Bones[BoneIndex.z] * BoneWeights.z + Bones[BoneIndex.w] * BoneWeights.w;
+  mat4 SkinnedTransform = Transform * Skinning;
+#else
+  mat4 SkinnedTransform = Transform;
+#endif
+
+  vec3 VertexPosition = (SkinnedTransform * vec4(Position, 1)).xyz;
+  vsOutput.EyespaceNormal = (SkinnedTransform * vec4(Normal, 0)).xyz;
+
+  gl_Position = ViewProjection * vec4(VertexPosition, 1);
+  vsOutput.WorldPosition = VertexPosition;
+
+  vsOutput.UV = UV;
+
+}
+
+#pixel_shader
+
+in VsOutput vsOutput;
+out vec4 FragColor;
+
+uniform sampler2D mainTex;
+
+layout(std140, binding = 3) uniform MaterialData
+{
+  float Shininess;
+  float Metallness;
+};
+
+void main()
+{
+  vec3 color = texture(mainTex, vsOutput.UV).rgb ;
+#ifdef LOD1
+  // far characters: squared Blinn highlight instead of pow, MaterialData stays the same as in the full variant
+  vec3 N = normalize(vsOutput.EyespaceNormal);
+  vec3 H = normalize(normalize(CameraPosition - vsOutput.WorldPosition) - LightDirection);
+  float df = max(0.0, dot(N, -LightDirection));
+  float sf = max(0.0, dot(N, H));
+  sf *= sf;
+  color = color * (AmbientLight + df * SunLight) + vec3(sf * sf * Metallness);
+#else
+  color = LightedColor(color, Shininess, Metallness, vsOutput.WorldPosition, vsOutput.EyespaceNormal, LightDirection, CameraPosition);
+#endif
+  FragColor = vec4(color, 1.0);
+}
@@ -0,0 +1,105 @@
+#shader crowd
+
+#include "common.glsl"
+
+struct VsOutput
+{
+  vec3 EyespaceNormal;
+  vec3 WorldPosition;
+  vec2 UV;
+};
+
+#vertex_shader
+
+struct Instance
+{
+  vec4 Rows[3];
+  int Clip;
+  float StartTime;
+};
+
+struct BakedClip
+{
+  int FirstFrame;
+  int FrameCount;
+  float SampleRate;
+  float Duration;
+};
+
+layout(std430, binding = 4) readonly buffer CrowdInstances
+{
+  Instance instances[];
+};
+
+layout(std430, binding = 5) readonly buffer BakedClips
+{
+  BakedClip clips[];
+};
+
+// frame rows hold three texels with rows of affine bone matrices
+uniform sampler2D AnimationTexture;
+// seconds, instances add their own start time
+uniform float CrowdTime;
+
+layout(location = 0) in vec3 Position;
+layout(location = 1) in vec3 Normal;
+layout(location = 2) in vec2 UV;
+layout(location = 3) in vec4 BoneWeights;
+layout(location = 4) in uvec4 BoneIndex;
+
+out VsOutput vsOutput;
+
+mat4 RowsToMatrix(vec4 r0, vec4 r1, vec4 r2)
+{
+  return transpose(mat4(r0, r1, r2, vec4(0, 0, 0, 1)));
+}
+
+// rows of two frames are interpolated before they make the matrix
+vec4 BoneRow(int x, ivec2 frames, float t)
+{
+  return mix(texelFetch(AnimationTexture, ivec2(x, frames.x), 0), texelFetch(AnimationTexture, ivec2(x, frames.y), 0), t);
+}
+
+mat4 BoneMatrix(uint bone, ivec2 frames, float t)
+{
+  int x = int(bone) * 3;
+  return RowsToMatrix(BoneRow(x, frames, t), BoneRow(x + 1, frames, t), BoneRow(x + 2, frames, t));
+}
+
+void main()
+{
+  Instance instance = instances[gl_InstanceID];
+  BakedClip clip = clips[instance.Clip];
+  float frame = mod(CrowdTime + instance.StartTime, max(clip.Duration, 1e-4)) * clip.SampleRate;
+  int frame0 = min(int(frame), clip.FrameCount - 1);
+  ivec2 frames = clip.FirstFrame + ivec2(frame0, min(frame0 + 1, clip.FrameCount - 1));
+  float t = frame - float(frame0);
+  mat4 Skinning =
+    BoneMatrix(BoneIndex.x, frames, t) * BoneWeights.x + BoneMatrix(BoneIndex.y, frames, t) * BoneWeights.y +
+    BoneMatrix(BoneIndex.z, frames, t) * BoneWeights.z + BoneMatrix(BoneIndex.w, frames, t) * BoneWeights.w;
+  mat4 SkinnedTransform = RowsToMatrix(instance.Rows[0], instance.Rows[1], instance.Rows[2]) * Skinning;
+
+  vec3 VertexPosition = (SkinnedTransform * vec4(Position, 1)).xyz;
+  vsOutput.EyespaceNormal = (SkinnedTransform * vec4(Normal, 0)).xyz;
+
+  gl_Position = ViewProjection * vec4(VertexPosition, 1);
+  vsOutput.WorldPosition = VertexPosition;
+
+  vsOutput.UV = UV;
+}
+
+#pixel_shader
+
+in VsOutput vsOutput;
+out vec4 FragColor;
+
+uniform sampler2D mainTex;
+
+// crowds are seen from afar, they take diffuse lighting only
+void main()
+{
+  vec3 color = texture(mainTex, vsOutput.UV).rgb;
+  float df = max(0.0, dot(normalize(vsOutput.EyespaceNormal), -LightDirection));
+  color = color * (AmbientLight + df * SunLight);
+  FragColor = vec4(color, 1.0);
+}